@@ -0,0 +1,440 @@
+//! \file bench.c
+//! \authors Douglas Healy (u16018100)
+//! \authors Llewellyn Moyse (u15100708)
+//! \authors Mohamed Ameen Omar (u16055323)
+//! \date 2019/02/14
+//! \brief Benchmark mode of the client (--bench), loads the server with HTTPS requests either at a fixed concurrency
+//! (closed loop) or at a fixed request rate (open loop) and reports the latency percentiles of every request phase
+//! \version 1.0
+//! \copyright Copyright &copy; 2019 - EHN410 Group 7
+
+
+//--------------------------------------------------------------
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/bio.h>
+#include <openssl/err.h>
+
+#include "bench.h"
+#include "session.h"
+
+
+//--------------------------------------------------------------
+// Defines
+
+#define BENCH_HTTP_DELIM    "\r\n"
+
+//! Nanoseconds per second
+#define BENCH_NANOS         1000000000ULL
+
+#ifndef TRUE
+#define TRUE    (1 == 1)
+#define FALSE   (1 == 0)
+#endif
+
+
+//--------------------------------------------------------------
+// Private variables
+
+//! The server location in the format [host]:[port]
+static const char *benchHost;
+
+//! The SSL context shared by the benchmark threads
+static SSL_CTX *benchCtx;
+
+//! The request written for every connection
+static char benchRequest[4096];
+
+//! The length of benchRequest
+static int benchRequestLength;
+
+//! The time the benchmark started, requests started before benchWarmupEnd are not recorded
+static uint64_t benchStart;
+static uint64_t benchWarmupEnd;
+
+//! No request is started at or after this time
+static uint64_t benchEnd;
+
+//! Releases all benchmark threads at once, after every thread has been created
+static pthread_barrier_t benchBarrier;
+
+//! The names of the phases, indexed by bench_phase
+static const char *benchPhaseNames[BENCH_PHASE_COUNT] = { "connect", "handshake", "ttfb", "total" };
+
+//! The percentiles reported for every phase
+static const double benchPercentiles[] = { 50, 90, 99, 99.9 };
+static const char *benchPercentileNames[] = { "p50", "p90", "p99", "p99.9" };
+#define BENCH_PERCENTILE_COUNT (sizeof(benchPercentiles) / sizeof(benchPercentiles[0]))
+
+
+//--------------------------------------------------------------
+// Private function prototypes
+
+//! \brief Returns the current time of the monotonic clock
+//! \return The time in nanoseconds
+static inline uint64_t BENCH_Nanos(void);
+
+//! \brief Records a latency in a histogram
+//! \param histogram The histogram, owned by the calling thread
+//! \param nanos The latency in nanoseconds
+static void BENCH_Record(bench_histogram *histogram, uint64_t nanos);
+
+//! \brief Returns a percentile of the latencies recorded in a histogram
+//! \param histogram The histogram
+//! \param percentile The percentile, between 0 and 100
+//! \return The upper bound of the bucket holding the percentile in nanoseconds, at most the largest latency recorded
+static uint64_t BENCH_Percentile(const bench_histogram *histogram, double percentile);
+
+//! \brief Adds the latencies recorded in one histogram to another one
+//! \param into The histogram the latencies are added to
+//! \param from The histogram whose latencies are added
+static void BENCH_Merge(bench_histogram *into, const bench_histogram *from);
+
+//! \brief Connects to the server, writes the request and reads the whole response, which ends with the connection
+//! \param phases Receives the latency of the connect, handshake and ttfb phases in nanoseconds
+//! \param bytes Receives the number of bytes of the response
+//! \param status Receives the status code of the response, 0 if it could not be parsed
+//! \param resumed Receives TRUE if the handshake resumed a cached session
+//! \return TRUE if a response was read / FALSE if the connection, handshake, write or read failed
+static uint8_t BENCH_Request(uint64_t phases[BENCH_PHASE_COUNT], uint64_t *bytes, int *status, uint8_t *resumed);
+
+//! \brief Thread handler of a benchmark thread, issues requests until the benchmark ends
+//! \param workerArgs The bench_worker of the thread
+//! \return
+static void *BENCH_ThreadHandler(void *workerArgs);
+
+//! \brief Prints the results of a benchmark as text
+//! \param options The options of the benchmark
+//! \param total The merged results of every thread
+//! \param resource The path requested from the server
+static void BENCH_PrintText(const bench_options *options, const bench_worker *total, const char *resource);
+
+//! \brief Prints the results of a benchmark as a JSON object
+//! \param options The options of the benchmark
+//! \param total The merged results of every thread
+//! \param resource The path requested from the server
+static void BENCH_PrintJson(const bench_options *options, const bench_worker *total, const char *resource);
+
+
+//--------------------------------------------------------------
+// Function implementations
+int BENCH_Run(SSL_CTX *ctx, const char *host, const char *resource, const bench_options *options)
+{
+    uint32_t i;
+
+    benchCtx = ctx;
+    benchHost = host;
+    benchRequestLength = snprintf(benchRequest, sizeof(benchRequest), "GET %s HTTP/1.1"BENCH_HTTP_DELIM"Host: %s" \
+            BENCH_HTTP_DELIM"Accept: */*"BENCH_HTTP_DELIM"Connection: close"BENCH_HTTP_DELIM BENCH_HTTP_DELIM, \
+            resource, host);
+    if (benchRequestLength >= (int) sizeof(benchRequest)) {
+        fprintf(stderr, "The path is too long for a request. Exiting...\n");
+        return EXIT_FAILURE;
+    }
+
+    bench_worker *workers = calloc(options->connections, sizeof(bench_worker));
+    if (workers == NULL) {
+        fprintf(stderr, "Unable to allocate the benchmark threads. Exiting...\n");
+        return EXIT_FAILURE;
+    }
+
+    // The threads wait at the barrier until all of them exist, the clock starts when main releases them
+    pthread_barrier_init(&benchBarrier, NULL, options->connections + 1);
+    for (i = 0; i < options->connections; ++i) {
+        workers[i].index = i;
+        workers[i].options = options;
+        if (pthread_create(&workers[i].thread_id, NULL, BENCH_ThreadHandler, &workers[i]) != 0) {
+            fprintf(stderr, "Error creating thread. Exiting...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    benchStart = BENCH_Nanos();
+    benchWarmupEnd = benchStart + (uint64_t) (options->warmup * BENCH_NANOS);
+    benchEnd = benchWarmupEnd + (uint64_t) (options->duration * BENCH_NANOS);
+    pthread_barrier_wait(&benchBarrier);
+
+    bench_worker *total = calloc(1, sizeof(bench_worker));
+    if (total == NULL) {
+        fprintf(stderr, "Unable to allocate the benchmark results. Exiting...\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < options->connections; ++i) {
+        pthread_join(workers[i].thread_id, NULL);
+        for (int phase = 0; phase < BENCH_PHASE_COUNT; phase++) {
+            BENCH_Merge(&total->phases[phase], &workers[i].phases[phase]);
+        }
+        total->requests += workers[i].requests;
+        total->errors += workers[i].errors;
+        total->statusErrors += workers[i].statusErrors;
+        total->bytes += workers[i].bytes;
+        total->resumed += workers[i].resumed;
+    }
+
+    if (options->json) {
+        BENCH_PrintJson(options, total, resource);
+    } else {
+        BENCH_PrintText(options, total, resource);
+    }
+
+    int result = total->errors == 0 && total->statusErrors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    pthread_barrier_destroy(&benchBarrier);
+    free(total);
+    free(workers);
+    return result;
+}
+
+static void *BENCH_ThreadHandler(void *workerArgs)
+{
+    bench_worker *worker = (bench_worker*) workerArgs;
+    const bench_options *options = worker->options;
+
+    // Wait until every benchmark thread has been created
+    pthread_barrier_wait(&benchBarrier);
+
+    // In open loop mode every thread sends connections / rate requests per second, the threads are staggered evenly.
+    // A request is timed from the moment it was scheduled, so a server that stalls is charged for the requests that
+    // queued up behind the stall instead of those requests silently being sent later (coordinated omission)
+    uint64_t interval = 0, next = benchStart;
+    if (options->rate > 0) {
+        interval = (uint64_t) (options->connections * BENCH_NANOS / options->rate);
+        next = benchStart + (uint64_t) (worker->index * BENCH_NANOS / options->rate);
+    }
+
+    while (1) {
+        uint64_t start;
+        if (interval > 0) {
+            start = next;
+            if (start >= benchEnd) {
+                break;
+            }
+            struct timespec at = { .tv_sec = start / BENCH_NANOS, .tv_nsec = start % BENCH_NANOS };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) != 0) {
+                // interrupted, sleep for the rest
+            }
+            next += interval;
+        } else {
+            start = BENCH_Nanos();
+            if (start >= benchEnd) {
+                break;
+            }
+        }
+
+        uint64_t phases[BENCH_PHASE_COUNT] = { 0 };
+        uint64_t bytes = 0;
+        int status = 0;
+        uint8_t resumed = FALSE;
+        uint8_t success = BENCH_Request(phases, &bytes, &status, &resumed);
+        phases[BENCH_TOTAL] = BENCH_Nanos() - start;
+
+        // Requests started during the warmup only warm up the connections and caches of the server
+        if (start < benchWarmupEnd) {
+            continue;
+        }
+        if (!success) {
+            worker->errors++;
+            continue;
+        }
+        for (int phase = 0; phase < BENCH_PHASE_COUNT; phase++) {
+            BENCH_Record(&worker->phases[phase], phases[phase]);
+        }
+        worker->requests++;
+        worker->bytes += bytes;
+        worker->resumed += resumed;
+        if (status == 0 || status >= 400) {
+            worker->statusErrors++;
+        }
+    }
+
+    return NULL;
+}
+
+static uint8_t BENCH_Request(uint64_t phases[BENCH_PHASE_COUNT], uint64_t *bytes, int *status, uint8_t *resumed)
+{
+    BIO *conn = BIO_new_connect(benchHost);
+    if (conn == NULL) {
+        return FALSE;
+    }
+    // Without TCP_NODELAY the request waits for the acknowledgement of the Finished message of a resumed handshake
+    BIO_set_conn_mode(conn, BIO_SOCK_NODELAY);
+
+    uint64_t connectAt = BENCH_Nanos();
+    if (BIO_do_connect(conn) <= 0) {
+        BIO_free_all(conn);
+        return FALSE;
+    }
+    uint64_t handshakeAt = BENCH_Nanos();
+    phases[BENCH_CONNECT] = handshakeAt - connectAt;
+
+    SSL *ssl = SSL_new(benchCtx);
+    if (ssl == NULL) {
+        BIO_free_all(conn);
+        return FALSE;
+    }
+    SSL_set_bio(ssl, conn, conn); // the SSL instance owns the connection from now on
+    SESSION_Prepare(ssl, benchHost);
+    if (SSL_connect(ssl) <= 0) {
+        SSL_free(ssl);
+        return FALSE;
+    }
+    uint64_t requestAt = BENCH_Nanos();
+    phases[BENCH_HANDSHAKE] = requestAt - handshakeAt;
+    *resumed = SSL_session_reused(ssl);
+
+    if (SSL_write(ssl, benchRequest, benchRequestLength) <= 0) {
+        SSL_free(ssl);
+        return FALSE;
+    }
+
+    // The server closes the connection after the response (Connection: close)
+    char buff[BENCH_READ_BUFFER_SIZE];
+    uint8_t success = FALSE;
+    while (1) {
+        int buffLen = SSL_read(ssl, buff, sizeof(buff) - 1);
+        if (buffLen > 0) {
+            if (*bytes == 0) {
+                phases[BENCH_TTFB] = BENCH_Nanos() - requestAt;
+                buff[buffLen] = '\0';
+                if (sscanf(buff, "HTTP/%*d.%*d %d", status) != 1) {
+                    *status = 0;
+                }
+            }
+            *bytes += buffLen;
+            continue;
+        }
+
+        int error = SSL_get_error(ssl, buffLen);
+        // a server closing the socket without a close_notify has still sent a complete response
+        success = *bytes > 0 && (error == SSL_ERROR_ZERO_RETURN || error == SSL_ERROR_SYSCALL);
+        break;
+    }
+
+    // A connection freed without a shutdown marks its session as not resumable
+    if (success) {
+        SSL_shutdown(ssl);
+    }
+    SSL_free(ssl);
+    ERR_clear_error();
+    return success;
+}
+
+static inline uint64_t BENCH_Nanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * BENCH_NANOS + now.tv_nsec;
+}
+
+static void BENCH_Record(bench_histogram *histogram, uint64_t nanos)
+{
+    // Values below BENCH_SUB_BUCKETS are exact, larger ones keep their top BENCH_SUB_BUCKET_BITS + 1 bits
+    int exponent = 0;
+    if (nanos >= BENCH_SUB_BUCKETS) {
+        exponent = 63 - __builtin_clzll(nanos) - BENCH_SUB_BUCKET_BITS;
+    }
+    uint64_t index = (uint64_t) exponent * BENCH_SUB_BUCKETS + (nanos >> exponent);
+    if (index >= BENCH_HISTOGRAM_BUCKETS) {
+        index = BENCH_HISTOGRAM_BUCKETS - 1;
+    }
+
+    histogram->counts[index]++;
+    histogram->total++;
+    histogram->sum += nanos;
+    if (nanos > histogram->max) {
+        histogram->max = nanos;
+    }
+}
+
+static uint64_t BENCH_Percentile(const bench_histogram *histogram, double percentile)
+{
+    if (histogram->total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (percentile / 100 * histogram->total + 0.5), seen = 0;
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (uint64_t index = 0; index < BENCH_HISTOGRAM_BUCKETS; index++) {
+        seen += histogram->counts[index];
+        if (seen >= rank) {
+            int exponent = index < 2 * BENCH_SUB_BUCKETS ? 0 : (int) (index / BENCH_SUB_BUCKETS) - 1;
+            uint64_t upper = (((index - (uint64_t) exponent * BENCH_SUB_BUCKETS) + 1) << exponent) - 1;
+            return upper < histogram->max ? upper : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+static void BENCH_Merge(bench_histogram *into, const bench_histogram *from)
+{
+    for (int index = 0; index < BENCH_HISTOGRAM_BUCKETS; index++) {
+        into->counts[index] += from->counts[index];
+    }
+    into->total += from->total;
+    into->sum += from->sum;
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+}
+
+static void BENCH_PrintText(const bench_options *options, const bench_worker *total, const char *resource)
+{
+    double requestRate = total->requests / options->duration;
+    double byteRate = total->bytes / options->duration / (1024 * 1024);
+
+    if (options->rate > 0) {
+        printf("Benchmark of %s%s: open loop at %.1f requests/s, %u connections, %.1f s (%.1f s warmup)\n", \
+                benchHost, resource, options->rate, options->connections, options->duration, options->warmup);
+    } else {
+        printf("Benchmark of %s%s: closed loop, %u connections, %.1f s (%.1f s warmup)\n", \
+                benchHost, resource, options->connections, options->duration, options->warmup);
+    }
+    printf("  %lu requests, %lu errors, %lu responses with status >= 400\n", (unsigned long) total->requests, \
+            (unsigned long) total->errors, (unsigned long) total->statusErrors);
+    printf("  %.1f requests/s, %.2f MB/s\n", requestRate, byteRate);
+    printf("  %lu of %lu handshakes resumed a session (%.1f%%)\n", (unsigned long) total->resumed, \
+            (unsigned long) total->requests, total->requests > 0 ? 100.0 * total->resumed / total->requests : 0);
+
+    printf("  %-10s %10s", "(ms)", "mean");
+    for (size_t i = 0; i < BENCH_PERCENTILE_COUNT; i++) {
+        printf(" %10s", benchPercentileNames[i]);
+    }
+    printf(" %10s\n", "max");
+    for (int phase = 0; phase < BENCH_PHASE_COUNT; phase++) {
+        const bench_histogram *histogram = &total->phases[phase];
+        double mean = histogram->total > 0 ? (double) histogram->sum / histogram->total : 0;
+        printf("  %-10s %10.3f", benchPhaseNames[phase], mean / 1e6);
+        for (size_t i = 0; i < BENCH_PERCENTILE_COUNT; i++) {
+            printf(" %10.3f", BENCH_Percentile(histogram, benchPercentiles[i]) / 1e6);
+        }
+        printf(" %10.3f\n", histogram->max / 1e6);
+    }
+}
+
+static void BENCH_PrintJson(const bench_options *options, const bench_worker *total, const char *resource)
+{
+    printf("{\"host\": \"%s\", \"path\": \"%s\", \"mode\": \"%s\", \"connections\": %u, \"rate\": %.3f, " \
+            "\"duration\": %.3f, \"warmup\": %.3f, ", benchHost, resource, options->rate > 0 ? "open" : "closed", \
+            options->connections, options->rate, options->duration, options->warmup);
+    printf("\"requests\": %lu, \"errors\": %lu, \"status_errors\": %lu, \"bytes\": %lu, ", \
+            (unsigned long) total->requests, (unsigned long) total->errors, (unsigned long) total->statusErrors, \
+            (unsigned long) total->bytes);
+    printf("\"resumed\": %lu, \"resumption_rate\": %.3f, ", (unsigned long) total->resumed, \
+            total->requests > 0 ? (double) total->resumed / total->requests : 0);
+    printf("\"requests_per_second\": %.3f, \"mb_per_second\": %.3f, \"latency_ms\": {", \
+            total->requests / options->duration, total->bytes / options->duration / (1024 * 1024));
+    for (int phase = 0; phase < BENCH_PHASE_COUNT; phase++) {
+        const bench_histogram *histogram = &total->phases[phase];
+        double mean = histogram->total > 0 ? (double) histogram->sum / histogram->total : 0;
+        printf("%s\"%s\": {\"mean\": %.3f", phase > 0 ? ", " : "", benchPhaseNames[phase], mean / 1e6);
+        for (size_t i = 0; i < BENCH_PERCENTILE_COUNT; i++) {
+            printf(", \"%s\": %.3f", benchPercentileNames[i], BENCH_Percentile(histogram, benchPercentiles[i]) / 1e6);
+        }
+        printf(", \"max\": %.3f}", histogram->max / 1e6);
+    }
+    printf("}}\n");
+}
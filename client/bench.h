@@ -0,0 +1,136 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+//! \file bench.h
+//! \authors Douglas Healy (u16018100)
+//! \authors Llewellyn Moyse (u15100708)
+//! \authors Mohamed Ameen Omar (u16055323)
+//! \date 2019/02/14
+//! \brief Benchmark mode of the client (--bench), loads the server with HTTPS requests either at a fixed concurrency
+//! (closed loop) or at a fixed request rate (open loop) and reports the latency percentiles of every request phase
+//! \version 1.0
+//! \copyright Copyright &copy; 2019 - EHN410 Group 7
+
+
+//--------------------------------------------------------------
+// User includes
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <openssl/ssl.h>
+
+
+//--------------------------------------------------------------
+// Defines
+
+//! Buffer size used when reading a response, the body is discarded
+#define BENCH_READ_BUFFER_SIZE      16384
+
+//! Number of sub-buckets per power of two in a latency histogram, latencies are recorded with a precision of 1/32
+#define BENCH_SUB_BUCKET_BITS       5
+#define BENCH_SUB_BUCKETS           (1 << BENCH_SUB_BUCKET_BITS)
+
+//! Number of buckets in a latency histogram, covering latencies up to 2^40 ns (about 18 minutes)
+#define BENCH_HISTOGRAM_BUCKETS     ((40 - BENCH_SUB_BUCKET_BITS + 1) * BENCH_SUB_BUCKETS)
+
+//! Default length of the measurement in seconds
+#define BENCH_DEFAULT_DURATION      10
+
+//! Default length of the warmup in seconds, requests started during the warmup are not recorded
+#define BENCH_DEFAULT_WARMUP        1
+
+
+//--------------------------------------------------------------
+// Types
+
+//! The phases of a request that are timed
+typedef enum _bench_phase
+{
+    BENCH_CONNECT,      //!< TCP connection, from the start of the connection until it was established
+    BENCH_HANDSHAKE,    //!< TLS handshake, from the established connection until the handshake completed
+    BENCH_TTFB,         //!< Time to first byte, from writing the request until the first byte of the response arrived
+    BENCH_TOTAL,        //!< From the start of the request until the last byte of the response arrived, in open loop
+                        //!< mode from the time the request was scheduled to start (corrects coordinated omission)
+    BENCH_PHASE_COUNT
+} bench_phase;
+
+//! A log-linear latency histogram in nanoseconds, written by a single thread and merged after it was joined
+typedef struct _bench_histogram
+{
+    //! The number of latencies recorded per bucket
+    uint64_t counts[BENCH_HISTOGRAM_BUCKETS];
+
+    //! The number of latencies recorded
+    uint64_t total;
+
+    //! The sum of the latencies recorded
+    uint64_t sum;
+
+    //! The largest latency recorded
+    uint64_t max;
+} bench_histogram;
+
+//! The options of a benchmark, given on the command line
+typedef struct _bench_options
+{
+    //! The number of threads, each with one request in flight at a time
+    uint32_t connections;
+
+    //! The requests per second of all threads together in open loop mode, 0 for closed loop mode
+    double rate;
+
+    //! The length of the measurement in seconds, after the warmup
+    double duration;
+
+    //! The length of the warmup in seconds
+    double warmup;
+
+    //! TRUE to print the results as JSON instead of text
+    uint8_t json;
+} bench_options;
+
+//! The state and results of one benchmark thread
+typedef struct _bench_worker
+{
+    //! The index of the thread
+    uint32_t index;
+
+    //! The thread ID
+    pthread_t thread_id;
+
+    //! The options of the benchmark
+    const bench_options *options;
+
+    //! The latencies of the recorded requests, one histogram per phase
+    bench_histogram phases[BENCH_PHASE_COUNT];
+
+    //! The number of recorded requests that completed with a response
+    uint64_t requests;
+
+    //! The number of recorded requests that failed to connect, complete the handshake, write or read
+    uint64_t errors;
+
+    //! The number of recorded responses with a status code of 400 or above
+    uint64_t statusErrors;
+
+    //! The number of bytes of the recorded responses (header and body)
+    uint64_t bytes;
+
+    //! The number of recorded requests whose handshake resumed a cached session
+    uint64_t resumed;
+} bench_worker;
+
+
+//--------------------------------------------------------------
+// Function prototypes
+
+//! \brief Runs the benchmark given by options against the server, prints the results to the standard output
+//! \param ctx The SSL context shared by the benchmark threads
+//! \param host The server location in the format [host]:[port]
+//! \param resource The path requested from the server
+//! \param options The options of the benchmark
+//! \return EXIT_SUCCESS if every recorded request succeeded, EXIT_FAILURE otherwise
+int BENCH_Run(SSL_CTX *ctx, const char *host, const char *resource, const bench_options *options);
+
+#endif
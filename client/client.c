@@ -17,10 +17,10 @@
 // Function implementations
 int main(int argc, char **argv)
 {
-    uint8_t i;
+    uint32_t i;
 
     int c = 0, option_index = 0; // option index for command-line args
-    while ((c = getopt_long(argc, argv, "u:n:h::", long_options, &option_index)) != EOF) {
+    while ((c = getopt_long(argc, argv, "u:m:n:c:P:h::", long_options, &option_index)) != EOF) {
         switch (c) {
             case 0: // Currently not being used
                 switch (option_index) {
@@ -32,29 +32,76 @@ int main(int argc, char **argv)
                         CLIENT_PrintUsage(argv[0]);
                         exit(EXIT_FAILURE);
                         break;
+                    case 2:
+                        trace("Benchmark mode enabled");
+                        benchMode = TRUE;
+                        break;
+                    case 3:
+                        benchOptions.rate = atof(optarg);
+                        if (benchOptions.rate <= 0) {
+                            fprintf(stderr, "The request rate must be positive. Exiting...\n");
+                            exit(EXIT_FAILURE);
+                        }
+                        break;
+                    case 4:
+                        benchOptions.duration = atof(optarg);
+                        if (benchOptions.duration <= 0) {
+                            fprintf(stderr, "The duration must be positive. Exiting...\n");
+                            exit(EXIT_FAILURE);
+                        }
+                        break;
+                    case 5:
+                        benchOptions.warmup = atof(optarg);
+                        if (benchOptions.warmup < 0) {
+                            fprintf(stderr, "The warmup can not be negative. Exiting...\n");
+                            exit(EXIT_FAILURE);
+                        }
+                        break;
+                    case 6:
+                        benchOptions.json = TRUE;
+                        break;
                 }
                 break;
 
             case 'u':
-                url = malloc(1024 * sizeof(char));
-                path = malloc(1024 * sizeof(char));
-
-                if (strstr(optarg, "/") == NULL) {
-                    strcpy(path, "/");
-                } else {
-                    strcpy(path, strstr(optarg, "/"));
+                if (!CLIENT_AddLocation(optarg)) {
+                    exit(EXIT_FAILURE);
                 }
+                break;
 
-                strcpy(url, strtok(optarg, "/"));
-                trace("Host address: %s", url);
-                trace("Path: %s", path);
+            case 'm':
+                if (!CLIENT_ReadManifest(optarg)) {
+                    exit(EXIT_FAILURE);
+                }
                 break;
 
             case 'n':
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "The number of client instances must be positive. Exiting...\n");
+                    exit(EXIT_FAILURE);
+                }
                 clientInstances = atoi(optarg);
                 trace("Client instances: %d", clientInstances);
                 break;
 
+            case 'c':
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "The number of connections must be positive. Exiting...\n");
+                    exit(EXIT_FAILURE);
+                }
+                poolSize = atoi(optarg);
+                trace("Connections per server: %d", poolSize);
+                break;
+
+            case 'P':
+                if (atoi(optarg) <= 0 || atoi(optarg) > CLIENT_MAX_DEPTH) {
+                    fprintf(stderr, "The pipelining depth must be between 1 and %d. Exiting...\n", CLIENT_MAX_DEPTH);
+                    exit(EXIT_FAILURE);
+                }
+                pipelineDepth = atoi(optarg);
+                trace("Pipelining depth: %d", pipelineDepth);
+                break;
+
             case 'h':
                 trace("Printing help menu (short option)");
                 CLIENT_PrintUsage(argv[0]);
@@ -68,35 +115,20 @@ int main(int argc, char **argv)
         }
     }
 
-    // Check if all command-line arguments were provided
-    if (url == NULL || path == NULL) {
-        _printf("Missing required parameter [-u]");
-        CLIENT_PrintUsage(argv[0]);
-        exit(EXIT_FAILURE);
-    }
-
-    // Get file extension
-    fileExt = strstr(path, ".");
-
-    while (fileExt != NULL) {
-        if (strstr(fileExt+1, ".") == NULL) {
-            break;
-        } else {
-            fileExt = strstr(fileExt+1, ".");
+    // Check if all command-line arguments were provided, the first location with a server gives the server of paths
+    for (i = 0; i < locationCount && url == NULL; ++i) {
+        if (locations[i][0] != '/') {
+            char *target = strchr(locations[i], '/');
+            url = target != NULL ? strndup(locations[i], target - locations[i]) : strdup(locations[i]);
+            path = strdup(target != NULL ? target : "/");
+            trace("Host address: %s", url);
+            trace("Path: %s", path);
         }
     }
-
-    if (fileExt == NULL) {
-        _printf("Can't find file extension in path, Exiting...");
+    if (url == NULL) {
+        _printf("Missing required parameter [-u]");
+        CLIENT_PrintUsage(argv[0]);
         exit(EXIT_FAILURE);
-    } else {
-        trace("File extension: %s", fileExt);
-        if (strstr(fileExt, "/") != NULL) {
-            _printf("Can't find file extension in path, Exiting...");
-            exit(EXIT_FAILURE);
-        } else {
-            trace("Found file extension: %s", fileExt);
-        }
     }
 
     // Initialization
@@ -105,30 +137,155 @@ int main(int argc, char **argv)
     SSL_library_init();
     OpenSSL_add_all_algorithms();
 
+    // A server closing a connection first must not kill every client thread
+    signal(SIGPIPE, SIG_IGN);
+
+    // One context for every thread, creating a context loads the default settings and ciphers every time
+    clientCtx = CLIENT_InitCTX();
+
+    // The benchmark requests the first location and discards the responses
+    if (benchMode) {
+        benchOptions.connections = clientInstances;
+        int result = BENCH_Run(clientCtx, url, path, &benchOptions);
+        SSL_CTX_free(clientCtx);
+        SESSION_Clear();
+        return result;
+    }
+
     outbio = BIO_new_fp(stdout, BIO_NOCLOSE); // Set file output stream to standard output for debugging
 
     trace("URL: %s", url);
 
-    pthread_t thread_id[clientInstances];
-    for (i = 0; i < clientInstances; ++i) {
-        thread_args threadArgs = { .thread_id = &thread_id[i], .thread_count = i };
-        if (pthread_create(&thread_id[i], NULL, CLIENT_ThreadHandler, &threadArgs) != 0) {
+    // Every server gets a queue of its downloads, every instance downloads every location once
+    hosts = calloc(locationCount, sizeof(client_host));
+    uint32_t *locationHosts = calloc(locationCount, sizeof(uint32_t));
+    client_download *downloads = calloc((size_t) locationCount * clientInstances, sizeof(client_download));
+    if (hosts == NULL || locationHosts == NULL || downloads == NULL) {
+        fprintf(stderr, "Unable to allocate the downloads. Exiting...\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < locationCount; ++i) {
+        char *server, *target = strchr(locations[i], '/');
+        if (target == locations[i]) {
+            server = strdup(url);
+        } else {
+            server = target != NULL ? strndup(locations[i], target - locations[i]) : strdup(locations[i]);
+            target = target != NULL ? target : "/";
+        }
+
+        uint32_t h;
+        for (h = 0; h < hostCount && strcmp(hosts[h].url, server) != 0; ++h);
+        if (h == hostCount) {
+            hosts[h].url = server;
+            pthread_mutex_init(&hosts[h].lock, NULL);
+            pthread_cond_init(&hosts[h].changed, NULL);
+            hostCount++;
+        } else {
+            free(server);
+        }
+        locationHosts[i] = h;
+        hosts[h].count += clientInstances;
+
+        for (uint32_t copy = 0; copy < clientInstances; ++copy) {
+            downloads[copy * locationCount + i].path = target;
+            downloads[copy * locationCount + i].copy = copy;
+        }
+    }
+
+    // Every server gets a pool of -c connections (-n by default), never more than it has downloads
+    uint32_t pool = poolSize > 0 ? poolSize : clientInstances, threadCount = 0;
+    for (i = 0; i < hostCount; ++i) {
+        hosts[i].queue = calloc(hosts[i].count, sizeof(client_download*));
+        if (hosts[i].queue == NULL) {
+            fprintf(stderr, "Unable to allocate the downloads. Exiting...\n");
+            exit(EXIT_FAILURE);
+        }
+        threadCount += hosts[i].count < pool ? hosts[i].count : pool;
+    }
+    for (i = 0; i < locationCount * clientInstances; ++i) {
+        client_host *host = &hosts[locationHosts[i % locationCount]];
+        host->queue[host->pending++] = &downloads[i];
+    }
+
+    // Every thread gets its own arguments, which stay valid until it has been joined
+    pthread_t *thread_id = calloc(threadCount, sizeof(pthread_t));
+    thread_args *threadArgs = calloc(threadCount, sizeof(thread_args));
+    if (thread_id == NULL || threadArgs == NULL) {
+        fprintf(stderr, "Unable to allocate the client threads. Exiting...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The threads wait at the barrier until all of them exist, main releases them and starts the clock
+    pthread_barrier_init(&startBarrier, NULL, threadCount + 1);
+    uint32_t h = 0, connections = 0;
+    for (i = 0; i < threadCount; ++i) {
+        if (connections == (hosts[h].count < pool ? hosts[h].count : pool)) {
+            h++;
+            connections = 0;
+        }
+        connections++;
+        threadArgs[i].thread_id = &thread_id[i];
+        threadArgs[i].thread_count = i;
+        threadArgs[i].host = &hosts[h];
+        if (pthread_create(&thread_id[i], NULL, CLIENT_ThreadHandler, &threadArgs[i]) != 0) {
             fprintf(stderr, "Error creating thread. Exiting...\n");
             exit(EXIT_FAILURE);
         } else {
             trace("Thread created with ID: %ld", thread_id[i]);
         }
+    }
+
+    double start = CLIENT_Now();
+    pthread_barrier_wait(&startBarrier);
 
+    // Wait for all client threads
+    thread_args total = { 0 };
+    double slowest = 0;
+    for (i = 0; i < threadCount; ++i) {
         pthread_join(thread_id[i], NULL);
+        total.downloads += threadArgs[i].downloads;
+        total.failures += threadArgs[i].failures;
+        total.bytes += threadArgs[i].bytes;
+        total.requests += threadArgs[i].requests;
+        total.responses += threadArgs[i].responses;
+        total.handshakes += threadArgs[i].handshakes;
+        total.resumed += threadArgs[i].resumed;
+        if (threadArgs[i].seconds > slowest) {
+            slowest = threadArgs[i].seconds;
+        }
     }
+    double elapsed = CLIENT_Now() - start;
 
-    // Release all client threads
-    for (i = 0; i < clientInstances; ++i) {
-        pthread_cancel(thread_id[i]);
+    _printf(COLOUR_GRN"\r\n%u of %u downloads succeeded, %lu bytes in %.3f s (slowest connection %.3f s)"COLOUR_RESET, \
+            total.downloads, locationCount * clientInstances, (unsigned long) total.bytes, elapsed, slowest);
+    if (elapsed > 0) {
+        _printf(COLOUR_GRN"Throughput: %.2f MB/s, %.1f downloads/s"COLOUR_RESET, \
+                total.bytes / elapsed / (1024 * 1024), total.downloads / elapsed);
     }
-
+    _printf(COLOUR_GRN"%u connections to %u servers, %u handshakes (%u resumed sessions, %.1f%%), %u requests, " \
+            "%u responses"COLOUR_RESET, threadCount, hostCount, total.handshakes, total.resumed, \
+            total.handshakes > 0 ? 100.0 * total.resumed / total.handshakes : 0, total.requests, total.responses);
+
+    pthread_barrier_destroy(&startBarrier);
+    for (i = 0; i < hostCount; ++i) {
+        pthread_mutex_destroy(&hosts[i].lock);
+        pthread_cond_destroy(&hosts[i].changed);
+        free(hosts[i].queue);
+        free(hosts[i].url);
+    }
+    for (i = 0; i < locationCount; ++i) {
+        free(locations[i]);
+    }
+    free(locations);
+    free(locationHosts);
+    free(hosts);
+    free(downloads);
+    free(threadArgs);
+    free(thread_id);
+    SSL_CTX_free(clientCtx);
+    SESSION_Clear();
     BIO_free_all(outbio);
-    return EXIT_SUCCESS;
+    return total.downloads == locationCount * clientInstances ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 BIO *CLIENT_AttemptConnect(SSL *ssl, SSL_CTX *ctx, char *url)
@@ -138,17 +295,19 @@ BIO *CLIENT_AttemptConnect(SSL *ssl, SSL_CTX *ctx, char *url)
     }
     BIO *_bio = BIO_new_ssl_connect(ctx);
     BIO_get_ssl(_bio, &ssl);
+    SESSION_Prepare(ssl, url); // resume the session of a previous connection to the server
     SSL_set_mode(ssl, SSL_MODE_AUTO_RETRY);
     BIO_set_conn_hostname(_bio, url);
+    BIO_set_conn_mode(_bio, BIO_SOCK_NODELAY); // the request must not wait for the acknowledgement of the Finished message
 
     if (BIO_do_connect(_bio) <= 0) {
         BIO_free_all(_bio);
         trace("Unsuccessful connection");
-        fprintf(stderr, "Error connecting to server. Exiting...\n");
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "Error connecting to server %s\n", url);
+        return NULL;
     } else {
         _printf("Secure connection to %s successful", url);
-        _printf("SSL Cipher: %s\r\n", SSL_get_cipher(ssl));
+        _printf("SSL Cipher: %s%s\r\n", SSL_get_cipher(ssl), SSL_session_reused(ssl) ? " (resumed session)" : "");
     }
 
     return _bio;
@@ -157,31 +316,198 @@ BIO *CLIENT_AttemptConnect(SSL *ssl, SSL_CTX *ctx, char *url)
 void *CLIENT_ThreadHandler(void *args)
 {
     thread_args *threadArgs = (thread_args*) args;
-    BIO *bio = NULL;
+    client_host *host = threadArgs->host;
+    client_download *batch[CLIENT_MAX_DEPTH];
     SSL *ssl = NULL;
-    SSL_CTX *ctx = CLIENT_InitCTX();
+    uint32_t i, count;
 
-    _printf(COLOUR_RED"\r\nClient %d (Thread ID: %ld) attempting to connect..."COLOUR_RESET, \
-            threadArgs->thread_count+1, (long int) threadArgs->thread_id);
-
-    bio = CLIENT_AttemptConnect(ssl, ctx, url);
-
-    char writeBuff[WRITE_BUFFER_SIZE];
-    sprintf(writeBuff, "GET %s HTTP/1.1"HTTP_DELIM"Host: %s"HTTP_DELIM"Accept: "HTTP_DELIM"Connection: close"HTTP_DELIM""HTTP_DELIM, path, url);
-    trace("Writing to server:\n%s", writeBuff);
-    if (!CLIENT_Write(bio, writeBuff)) {
-        fprintf(stderr, "Unable to write to server. Exiting...\n");
+    client_connection *conn = calloc(1, sizeof(client_connection));
+    char *writeBuff = malloc(pipelineDepth * WRITE_BUFFER_SIZE);
+    if (conn == NULL || writeBuff == NULL) {
+        fprintf(stderr, "Unable to allocate the connection. Exiting...\n");
         exit(EXIT_FAILURE);
     }
 
-    _printf("Attempting to download from %s%s", url, path);
-    CLIENT_Read(bio, threadArgs);
+    // Wait until every client thread has been created
+    pthread_barrier_wait(&startBarrier);
+    double start = CLIENT_Now();
+
+    while ((count = CLIENT_Take(host, batch, pipelineDepth)) > 0) {
+        // Open the connection, or open it again after the server closed it
+        if (conn->bio == NULL) {
+            _printf(COLOUR_RED"\r\nClient %d (Thread ID: %ld) attempting to connect..."COLOUR_RESET, \
+                    threadArgs->thread_count+1, (long int) threadArgs->thread_id);
+            conn->bio = CLIENT_AttemptConnect(ssl, clientCtx, host->url);
+            if (conn->bio == NULL) {
+                for (i = 0; i < count; ++i) {
+                    threadArgs->failures += !CLIENT_Finish(host, batch[i], TRUE);
+                }
+                continue;
+            }
+            BIO_get_ssl(conn->bio, &ssl);
+            threadArgs->handshakes++;
+            threadArgs->resumed += SSL_session_reused(ssl);
+        }
+
+        // The requests of the batch are written at once (pipelined), the server answers them in order
+        int length = 0;
+        for (i = 0; i < count; ++i) {
+            length += sprintf(writeBuff + length, "GET %s HTTP/1.1"HTTP_DELIM"Host: %s"HTTP_DELIM"Accept: */*" \
+                    HTTP_DELIM HTTP_DELIM, batch[i]->path, host->url);
+        }
+        trace("Writing to server:\n%s", writeBuff);
+        if (!CLIENT_Write(conn->bio, writeBuff)) {
+            CLIENT_Close(conn);
+            for (i = 0; i < count; ++i) {
+                threadArgs->failures += !CLIENT_Finish(host, batch[i], TRUE);
+            }
+            continue;
+        }
+        threadArgs->requests += count;
+
+        for (i = 0; i < count; ++i) {
+            // A request without a response, the server closed the connection before it, is retried on a new one
+            if (conn->bio == NULL || !CLIENT_Read(conn, host, batch[i])) {
+                CLIENT_Close(conn);
+                threadArgs->failures += !CLIENT_Finish(host, batch[i], TRUE);
+                continue;
+            }
+            threadArgs->responses++;
+            if (batch[i]->status >= 200 && batch[i]->status < 300) {
+                threadArgs->downloads++;
+                threadArgs->bytes += batch[i]->bytes;
+            } else {
+                fprintf(stderr, "%s%s failed with status %d\n", host->url, batch[i]->path, batch[i]->status);
+                threadArgs->failures++;
+            }
+            CLIENT_Finish(host, batch[i], FALSE);
+            if (conn->closing) {
+                CLIENT_Close(conn);
+            }
+        }
+    }
+    threadArgs->seconds = CLIENT_Now() - start;
 
-    SSL_CTX_free(ctx);
-    BIO_free_all(bio);
+    CLIENT_Close(conn);
+    free(writeBuff);
+    free(conn);
     return NULL;
 }
 
+uint8_t CLIENT_AddLocation(const char *location)
+{
+    // Every request of a pipelined batch must fit into its part of the write buffer
+    if (strlen(location) >= WRITE_BUFFER_SIZE / 2) {
+        fprintf(stderr, "The location %.64s... is too long\n", location);
+        return FALSE;
+    }
+
+    char **grown = realloc(locations, (locationCount + 1) * sizeof(char*));
+    if (grown == NULL) {
+        fprintf(stderr, "Unable to allocate the locations\n");
+        return FALSE;
+    }
+    locations = grown;
+    locations[locationCount++] = strdup(location);
+    trace("Location: %s", location);
+    return TRUE;
+}
+
+uint8_t CLIENT_ReadManifest(const char *fileName)
+{
+    FILE *fp = fopen(fileName, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to open the manifest %s\n", fileName);
+        return FALSE;
+    }
+
+    char line[HTTP_MAX_LINE];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *location = line + strspn(line, " \t");
+        location[strcspn(location, " \t\r\n")] = '\0';
+        if (*location == '\0' || *location == '#') {
+            continue;
+        }
+        if (!CLIENT_AddLocation(location)) {
+            fclose(fp);
+            return FALSE;
+        }
+    }
+
+    fclose(fp);
+    return TRUE;
+}
+
+uint32_t CLIENT_Take(client_host *host, client_download **downloads, uint32_t count)
+{
+    pthread_mutex_lock(&host->lock);
+    // A download of another connection may still be put back, the last connection to finish must not be left alone
+    while (host->pending == 0 && host->inFlight > 0) {
+        pthread_cond_wait(&host->changed, &host->lock);
+    }
+
+    uint32_t taken = 0;
+    while (taken < count && host->pending > 0) {
+        downloads[taken] = host->queue[host->head];
+        downloads[taken]->attempts++;
+        host->head = (host->head + 1) % host->count;
+        host->pending--;
+        taken++;
+    }
+    host->inFlight += taken;
+    pthread_mutex_unlock(&host->lock);
+    return taken;
+}
+
+uint8_t CLIENT_Finish(client_host *host, client_download *download, uint8_t retry)
+{
+    pthread_mutex_lock(&host->lock);
+    host->inFlight--;
+    retry = retry && download->attempts < CLIENT_MAX_ATTEMPTS;
+    if (retry) {
+        host->queue[(host->head + host->pending) % host->count] = download;
+        host->pending++;
+    } else if (download->status == 0) {
+        fprintf(stderr, "%s%s failed after %d attempts\n", host->url, download->path, download->attempts);
+    }
+    pthread_cond_broadcast(&host->changed);
+    pthread_mutex_unlock(&host->lock);
+    return retry;
+}
+
+void CLIENT_FileName(const client_host *host, const client_download *download, char *fileName, size_t size)
+{
+    char prefix[32] = "";
+    if (clientInstances > 1) {
+        sprintf(prefix, "CLIENT_%u_", download->copy + 1);
+    }
+
+    // The files of several servers are kept apart in a directory per server
+    size_t length = snprintf(fileName, size, "%s", HTTP_DOWNLOAD_PATH);
+    if (hostCount > 1) {
+        length += snprintf(fileName + length, size - length, "/%s", host->url);
+    }
+
+    // The path is mirrored without its query, empty, . and .. components are skipped
+    const char *p = download->path, *end = p + strcspn(p, "?#");
+    uint8_t named = FALSE;
+    while (p < end) {
+        size_t n = strcspn(p, "/");
+        if (p + n > end) {
+            n = end - p;
+        }
+        uint8_t last = p + n == end;
+        if (n > 0 && !(n == 1 && p[0] == '.') && !(n == 2 && p[0] == '.' && p[1] == '.')) {
+            length += snprintf(fileName + length, size - length, "/%s%.*s", last ? prefix : "", (int) n, p);
+            named = last;
+        }
+        p += last ? n : n + 1;
+    }
+    if (!named) {
+        snprintf(fileName + length, size - length, "/%sindex.html", prefix);
+    }
+}
+
 SSL_CTX *CLIENT_InitCTX(void)
 {
     SSL_CTX *ctx = SSL_CTX_new(SSLv23_client_method());
@@ -190,6 +516,7 @@ SSL_CTX *CLIENT_InitCTX(void)
         ERR_print_errors_fp(stderr);
         exit(EXIT_FAILURE);
     }
+    SESSION_Attach(ctx);
     return ctx;
 }
 
@@ -204,49 +531,125 @@ uint8_t CLIENT_Write(BIO *bio, char *buff)
     return TRUE;
 }
 
-uint8_t CLIENT_Read(BIO *bio, thread_args *threadArgs)
+uint8_t CLIENT_Read(client_connection *conn, const client_host *host, client_download *download)
 {
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
-
-    char *fileName = malloc(256*sizeof(char));
-    sprintf(fileName, HTTP_DOWNLOAD_PATH"/CLIENT_%d[%d_%d_%d-%d_%d_%d]%s", \
-            threadArgs->thread_count+1, tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, \
-            tm.tm_hour, tm.tm_min, tm.tm_sec, fileExt);
+    response_parser parser;
+    const char *body;
+    size_t bodyLength, used;
+    FILE *fp = NULL;
+    char fileName[HTTP_MAX_LINE];
+    uint8_t header = TRUE;
+
+    RESPONSE_Init(&parser);
+    while (parser.state != RESPONSE_DONE && parser.state != RESPONSE_ERROR) {
+        used = RESPONSE_Parse(&parser, conn->buff + conn->start, conn->end - conn->start, &body, &bodyLength);
+        if (used == 0) {
+            if (parser.state == RESPONSE_DONE || parser.state == RESPONSE_ERROR) {
+                break;
+            }
+            // The rest of a line or more body bytes, a body without a length ends with the connection
+            if (CLIENT_Fill(conn) == 0) {
+                conn->closing = TRUE;
+                RESPONSE_Closed(&parser);
+                break;
+            }
+            continue;
+        }
+        conn->start += used;
+
+        // Only a successful response is written to its file, the body of any other one is read and discarded
+        if (header && parser.state > RESPONSE_HEADER) {
+            header = FALSE;
+            trace("Status: %d", parser.status);
+            if (parser.status >= 200 && parser.status < 300) {
+                CLIENT_FileName(host, download, fileName, sizeof(fileName));
+                trace("File name: %s", fileName);
+                for (char *slash = strchr(fileName, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+                    *slash = '\0';
+                    mkdir(fileName, 0700);
+                    *slash = '/';
+                }
+                mkdir(HTTP_DOWNLOAD_PATH, 0700);
+                fp = fopen(fileName, "wb");
+                if (fp == NULL) {
+                    fprintf(stderr, "Unable to open %s: %s\n", fileName, strerror(errno));
+                }
+            }
+        }
+        if (body != NULL && fp != NULL) {
+            fwrite(body, sizeof(char), bodyLength, fp);
+        }
+    }
 
-    trace("File name: %s", fileName);
-    mkdir(HTTP_DOWNLOAD_PATH, 0700);
+    uint8_t complete = parser.state == RESPONSE_DONE;
+    conn->closing |= parser.closing;
+    download->status = complete ? parser.status : 0;
+    download->bytes = parser.bytes;
+    if (fp != NULL) {
+        fclose(fp);
+        if (complete) {
+            _printf("%lu bytes written to %s", (unsigned long) download->bytes, fileName);
+        }
+    }
+    return complete;
+}
 
-    FILE *fp;
-    fp = fopen(fileName, "wb");
-    int buffLen = 0, buffCount = 0, totalLen = 0;
+int CLIENT_Fill(client_connection *conn)
+{
+    // Move the unparsed bytes to the front once the end of the buffer was reached
+    if (conn->start == conn->end) {
+        conn->start = conn->end = 0;
+    } else if (conn->end == READ_BUFFER_SIZE) {
+        memmove(conn->buff, conn->buff + conn->start, conn->end - conn->start);
+        conn->end -= conn->start;
+        conn->start = 0;
+    }
+    if (conn->end == READ_BUFFER_SIZE) {
+        return 0; // a line longer than the buffer
+    }
 
+    int buffLen;
     do {
-        char buff[READ_BUFFER_SIZE] = {};
-        buffLen = BIO_read(bio, buff, sizeof(buff));
-
-        if (buffLen > 0) {
-            if (buffCount == 0) {
-                char *content = strstr(buff, HTTP_DELIM""HTTP_DELIM) + 4;
-                fwrite(content, buffLen - (int)((long int)content - (long int) buff), sizeof(char), fp);
-            } else {
-                fwrite(buff, buffLen, sizeof(char), fp);
-            }
-
-            totalLen += buffLen;
-            trace("%d bytes writting to %s", buffLen, fileName);
-        }
+        buffLen = BIO_read(conn->bio, conn->buff + conn->end, READ_BUFFER_SIZE - conn->end);
+    } while (buffLen <= 0 && BIO_should_retry(conn->bio));
+    if (buffLen <= 0) {
+        return 0;
+    }
+    conn->end += buffLen;
+    return buffLen;
+}
 
-        buffCount++;
-    } while (buffLen > 0 || BIO_should_retry(bio));
+void CLIENT_Close(client_connection *conn)
+{
+    if (conn->bio != NULL) {
+        BIO_free_all(conn->bio);
+        conn->bio = NULL;
+    }
+    conn->start = conn->end = 0;
+    conn->closing = FALSE;
+}
 
-    fclose(fp);
-    _printf("%d bytes written to %s", totalLen, fileName);
-    return TRUE;
+static inline double CLIENT_Now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
 }
 
 static inline void CLIENT_PrintUsage(char *fileName)
 {
-    _printf("usage: %s\t[-u host:port/path]\n\t\t[-n client-instances] [-h help]", fileName);
+    _printf("usage: %s\t[-u host:port/path]... [-m manifest]\n\t\t[-n client-instances] [-c connections-per-server] "
+            "[-P pipelining-depth] [-h help]\n"
+            "\t\t[--bench [--rate requests-per-second] [--duration seconds] [--warmup seconds] [--json]]\n\n"
+            "-u may be repeated, -m lists one location per line, a location starting with / is requested from the\n"
+            "server of the first location. Every instance downloads every location once over a pool of -c persistent\n"
+            "connections per server (-n by default), -P requests are written to a connection before their responses\n"
+            "are read (%d). The files are written to "HTTP_DOWNLOAD_PATH" mirroring their paths.\n\n"
+            "--bench benchmarks the server with -n concurrent connections instead of downloading the file, one request\n"
+            "per connection. Without --rate every connection sends its next request as soon as the previous one\n"
+            "completed (closed loop), with --rate the requests are sent at that rate (open loop) and timed from when\n"
+            "they were due. The benchmark runs for --duration seconds (%d) after --warmup seconds (%d) and reports the\n"
+            "connect, handshake, time to first byte and total latency percentiles, as JSON with --json.", fileName,
+            CLIENT_DEFAULT_DEPTH, BENCH_DEFAULT_DURATION, BENCH_DEFAULT_WARMUP);
     return;
 }
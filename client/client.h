@@ -21,6 +21,8 @@
 #include <getopt.h>
 #include <pthread.h>
 #include <time.h>
+#include <signal.h>
+#include <errno.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -29,6 +31,10 @@
 #include <openssl/bio.h>
 #include <openssl/err.h>
 
+#include "bench.h"
+#include "session.h"
+#include "response.h"
+
 
 //--------------------------------------------------------------
 // Defines
@@ -36,13 +42,26 @@
 //! Buffer size used when writing to server
 #define WRITE_BUFFER_SIZE   4096
 
-//! Buffer size used when reading from server
-#define READ_BUFFER_SIZE    1024
+//! Buffer size used when reading from server, one TLS record holds at most 16 KB of data. A header line or chunk size
+//! line must fit into it
+#define READ_BUFFER_SIZE    16384
 #define HTTP_DELIM          "\r\n"
 #define HTTP_SPACE          " "
 #define HTTP_CONTENT_TYPE   "Content-Type:"
 #define HTTP_CONTENT_LEGNTH "Content-Length:"
 
+//! Longest line of the manifest and longest file name written to
+#define HTTP_MAX_LINE       4096
+
+//! Default number of requests written to a connection before the first response is read (1 disables pipelining)
+#define CLIENT_DEFAULT_DEPTH    1
+
+//! Most requests written to a connection before the first response is read
+#define CLIENT_MAX_DEPTH        64
+
+//! Number of times a download is attempted, a download is retried when its connection closed before the response
+#define CLIENT_MAX_ATTEMPTS     3
+
 // it is defined at compile time (in the makefile) so check first if
 // it has been defined otherwise assign it a default value
 
@@ -87,7 +106,62 @@
 //--------------------------------------------------------------
 // Types
 
-//! A structure used to encapsulate arguments sent to a new client thread handler
+//! A file to download
+typedef struct _client_download
+{
+    //! The path requested from the server
+    char *path;
+
+    //! The instance downloading the file, each of the -n instances downloads every path once
+    uint32_t copy;
+
+    //! The number of times the download was attempted
+    uint8_t attempts;
+
+    //! The status code of the last response, 0 if none was received
+    int status;
+
+    //! The number of bytes of the body written to the file
+    uint64_t bytes;
+} client_download;
+
+//! A server and the queue of the files to download from it, shared by the connections of its pool
+typedef struct _client_host
+{
+    //! The server location in the format [host]:[port]
+    char *url;
+
+    //! The pending downloads, a ring buffer with room for every download of the server
+    client_download **queue;
+
+    //! The number of downloads of the server, the first pending download and the number of pending downloads
+    uint32_t count, head, pending;
+
+    //! The number of downloads taken from the queue by a connection which are not finished yet
+    uint32_t inFlight;
+
+    //! Protects the queue, signalled when a download was finished or put back
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} client_host;
+
+//! A persistent connection to a server, the bytes read but not parsed yet are kept in its buffer
+typedef struct _client_connection
+{
+    //! The BIO instance of the connection, NULL if it is closed
+    BIO *bio;
+
+    //! The bytes read from the server, the unparsed ones are buff[start] to buff[end - 1]
+    char buff[READ_BUFFER_SIZE];
+    int start, end;
+
+    //! TRUE if the server closes the connection after the current response
+    uint8_t closing;
+} client_connection;
+
+//! A structure used to encapsulate arguments sent to a new client thread handler, one per thread which stays valid
+//! until the thread was joined, the thread reports its results in it. Every thread is one connection of the pool of
+//! its server
 typedef struct _thread_args
 {
     //! The index of the current thread
@@ -95,12 +169,35 @@ typedef struct _thread_args
 
     //! The thead ID of the current thread
     pthread_t *thread_id;
+
+    //! The server the thread downloads from
+    client_host *host;
+
+    //! The number of files downloaded and the number of downloads that failed
+    uint32_t downloads, failures;
+
+    //! The number of bytes of the bodies written to the files
+    uint64_t bytes;
+
+    //! The number of requests written and the number of responses read
+    uint32_t requests, responses;
+
+    //! The number of handshakes and the number of those which resumed a cached session
+    uint32_t handshakes, resumed;
+
+    //! The time the thread took in seconds, from the first connection attempt until the last byte was read
+    double seconds;
 } thread_args;
 
 //! Command line options that can be used when running the application
 static struct option long_options[] = {
    {"debug", optional_argument, 0, 0},
    {"help", optional_argument, 0, 0},
+   {"bench", no_argument, 0, 0},
+   {"rate", required_argument, 0, 0},
+   {"duration", required_argument, 0, 0},
+   {"warmup", required_argument, 0, 0},
+   {"json", no_argument, 0, 0},
    {0, 0, 0, 0}
 };
 
@@ -108,19 +205,52 @@ static struct option long_options[] = {
 //--------------------------------------------------------------
 // Function prototypes
 
-//! \brief Thread handler used for each client thread created
-//! \param threadArgs the encapsulated thread arguments containing the thread index and ID
+//! \brief Thread handler used for each client thread created, downloads the files of its server over one persistent
+//! connection until none is left, writing up to pipelineDepth requests before reading their responses
+//! \param threadArgs the encapsulated thread arguments containing the thread index, ID and server
 //! \return
 void *CLIENT_ThreadHandler(void *threadArgs);
 
+//! \brief Adds a [host]:[port]/[path] location to the files to download
+//! \param location The location, a path starting with / is requested from the server of the first location
+//! \return TRUE if the location was added / FALSE if it is too long
+uint8_t CLIENT_AddLocation(const char *location);
+
+//! \brief Adds every location listed in a manifest file, one per line, empty lines and lines starting with # are skipped
+//! \param fileName The manifest file
+//! \return TRUE if the manifest was read / FALSE if it could not be opened or a location is too long
+uint8_t CLIENT_ReadManifest(const char *fileName);
+
+//! \brief Takes up to count pending downloads from the queue of a server, waits while the queue is empty but other
+//! connections still have downloads that could be put back
+//! \param host The server
+//! \param downloads Receives the downloads taken
+//! \param count The most downloads taken
+//! \return The number of downloads taken, 0 once every download of the server is finished
+uint32_t CLIENT_Take(client_host *host, client_download **downloads, uint32_t count);
+
+//! \brief Finishes a download taken from the queue of a server, or puts it back to be retried on another connection
+//! \param host The server
+//! \param download The download
+//! \param retry TRUE to put the download back, FALSE if it is finished
+//! \return TRUE if the download was put back / FALSE if it is finished, also after CLIENT_MAX_ATTEMPTS attempts
+uint8_t CLIENT_Finish(client_host *host, client_download *download, uint8_t retry);
+
+//! \brief Builds the name of the file a download is written to, the path mirrored below HTTP_DOWNLOAD_PATH
+//! \param host The server
+//! \param download The download
+//! \param fileName Receives the name of the file
+//! \param size The size of fileName
+void CLIENT_FileName(const client_host *host, const client_download *download, char *fileName, size_t size);
+
 //! \brief Attempt secure connection to the server specified by the url parameter
 //! \param ssl The SSL instance created by the client
 //! \param ctx The SSL context created by the client
 //! \param url The server location in the format [host]:[port]
-//! \return The BIO instance created if connection is successful
+//! \return The BIO instance created if connection is successful, NULL otherwise
 BIO *CLIENT_AttemptConnect(SSL *ssl, SSL_CTX *ctx, char *url);
 
-//! \brief Attempt to create an SSL context
+//! \brief Attempt to create an SSL context, which is shared by every client thread and caches their sessions
 //! \return The SSL context if instantiation was successful
 SSL_CTX *CLIENT_InitCTX(void);
 
@@ -130,11 +260,27 @@ SSL_CTX *CLIENT_InitCTX(void);
 //! \return TRUE for a successful write / FALSE for an unsuccessful write
 uint8_t CLIENT_Write(BIO *bio, char *buff);
 
-//! \brief Attempts to read from the server
-//! \param bio The BIO instance created when establishing a connection to the server
-//! \param threadArgs Encapsulated thread arguments containing the thread index and ID
-//! \return TRUE for a successful read / FALSE for unsuccessful read
-uint8_t CLIENT_Read(BIO *bio, thread_args *threadArgs);
+//! \brief Reads a response from a connection with an incremental parser, the body is framed by its Content-Length, its
+//! chunked encoding or the end of the connection, and written to the file of the download straight from the read
+//! buffer if the status is 2xx. The bytes of the following pipelined responses stay in the buffer
+//! \param conn The connection the request was written to
+//! \param host The server
+//! \param download The download the response belongs to
+//! \return TRUE if a complete response was read / FALSE if the connection failed or closed before
+uint8_t CLIENT_Read(client_connection *conn, const client_host *host, client_download *download);
+
+//! \brief Reads more bytes from the server into the buffer of a connection
+//! \param conn The connection
+//! \return The number of bytes read, 0 if the connection closed or failed, or the buffer is full of unparsed bytes
+int CLIENT_Fill(client_connection *conn);
+
+//! \brief Closes a connection
+//! \param conn The connection
+void CLIENT_Close(client_connection *conn);
+
+//! \brief Returns the current time of the monotonic clock
+//! \return The time in seconds
+static inline double CLIENT_Now(void);
 
 //! \brief prints the usage, containing required and optional command line arguments
 //! \param fileName argv[0] should be passed in this parameter which contains the name of the executable file
@@ -147,16 +293,40 @@ static inline void CLIENT_PrintUsage(char *fileName);
 //! BIO instance used for printing errors
 BIO *outbio = NULL;
 
-//! The url of the server in the format [host]:[port]
+//! The url of the server of the first location in the format [host]:[port], the server benchmarked by --bench
 char *url = NULL;
 
-//! The path to the file to be downloaded, must contain file extension
+//! The path of the first location, the path benchmarked by --bench
 char *path = NULL;
 
-//! The file name of the file to download which is obtained from the given path
-char *fileExt;
+//! The servers to download from, each with its own pool of connections
+client_host *hosts = NULL;
+uint32_t hostCount = 0;
+
+//! The locations given by -u and -m, in the format [host]:[port]/[path]
+char **locations = NULL;
+uint32_t locationCount = 0;
 
-//! Number of client instances which is defined by -n command-line argument, defaults to 1
+//! The SSL context shared by every client thread, created once in main
+SSL_CTX *clientCtx = NULL;
+
+//! Number of client instances which is defined by -n command-line argument, defaults to 1. Every instance downloads
+//! every location once
 uint32_t clientInstances = 1;
 
+//! Number of connections to every server which is defined by the -c command-line argument, defaults to -n
+uint32_t poolSize = 0;
+
+//! Number of requests written to a connection before the first response is read, defined by -P
+uint32_t pipelineDepth = CLIENT_DEFAULT_DEPTH;
+
+//! TRUE if the --bench command-line argument was given, the server is benchmarked instead of downloading a file
+uint8_t benchMode = FALSE;
+
+//! The options of the benchmark given by --rate, --duration, --warmup and --json, -n gives the number of connections
+bench_options benchOptions = { .rate = 0, .duration = BENCH_DEFAULT_DURATION, .warmup = BENCH_DEFAULT_WARMUP, .json = FALSE };
+
+//! Releases all client threads at once, after every thread has been created, so that they load the server together
+pthread_barrier_t startBarrier;
+
 #endif
@@ -0,0 +1,295 @@
+//! \file response.c
+//! \authors Douglas Healy (u16018100)
+//! \authors Llewellyn Moyse (u15100708)
+//! \authors Mohamed Ameen Omar (u16055323)
+//! \date 2019/02/14
+//! \brief Incremental HTTP/1.x response parser. It is fed the bytes read from a connection in pieces of any size, keeps
+//! no copy of them and allocates nothing, and hands out the body bytes as spans of the caller's buffer
+//! \version 1.0
+//! \copyright Copyright &copy; 2019 - EHN410 Group 7
+
+
+//--------------------------------------------------------------
+// Includes
+#include <string.h>
+#include <strings.h>
+
+#include "response.h"
+
+
+//--------------------------------------------------------------
+// Defines
+#define TRUE    (1 == 1)
+#define FALSE   (1 == 0)
+
+//! The header fields the parser acts on, compared without case
+#define RESPONSE_CONTENT_LENGTH     "Content-Length"
+#define RESPONSE_TRANSFER_ENCODING  "Transfer-Encoding"
+#define RESPONSE_CONNECTION         "Connection"
+
+
+//--------------------------------------------------------------
+// Private function prototypes
+
+//! \brief Parses the status line, "HTTP/1.[minor] [code] [reason]"
+//! \param parser The parser
+//! \param line The line without its terminator, not NUL-terminated
+//! \param length The length of the line
+static void RESPONSE_ParseStatus(response_parser *parser, const char *line, size_t length);
+
+//! \brief Parses a header line, or ends the header on an empty line and chooses how the body is framed
+//! \param parser The parser
+//! \param line The line without its terminator, not NUL-terminated
+//! \param length The length of the line
+static void RESPONSE_ParseHeader(response_parser *parser, const char *line, size_t length);
+
+//! \brief Parses the size line of a chunk, the size in hex optionally followed by chunk extensions
+//! \param parser The parser
+//! \param line The line without its terminator, not NUL-terminated
+//! \param length The length of the line
+static void RESPONSE_ParseChunkSize(response_parser *parser, const char *line, size_t length);
+
+//! \brief Returns whether a comma separated header value lists a token, compared without case
+//! \param value The header value, not NUL-terminated
+//! \param length The length of the value
+//! \param token The token
+//! \return TRUE if the value lists the token
+static uint8_t RESPONSE_HasToken(const char *value, size_t length, const char *token);
+
+
+//--------------------------------------------------------------
+// Function implementations
+void RESPONSE_Init(response_parser *parser)
+{
+    memset(parser, 0, sizeof(response_parser));
+    parser->state = RESPONSE_STATUS;
+    parser->length = RESPONSE_UNTIL_CLOSE;
+}
+
+size_t RESPONSE_Parse(response_parser *parser, const char *data, size_t length, const char **body, size_t *bodyLength)
+{
+    *body = NULL;
+    *bodyLength = 0;
+
+    // Body bytes are handed out where they are, as many as the buffer holds
+    if (parser->state == RESPONSE_BODY || parser->state == RESPONSE_CHUNK_DATA) {
+        size_t span = length;
+        if (parser->remaining != RESPONSE_UNTIL_CLOSE && parser->remaining < span) {
+            span = parser->remaining;
+        }
+        if (span == 0) {
+            return 0;
+        }
+        *body = data;
+        *bodyLength = span;
+        parser->bytes += span;
+        if (parser->remaining != RESPONSE_UNTIL_CLOSE) {
+            parser->remaining -= span;
+            if (parser->remaining == 0) {
+                parser->state = parser->state == RESPONSE_BODY ? RESPONSE_DONE : RESPONSE_CHUNK_END;
+            }
+        }
+        return span;
+    }
+    if (parser->state == RESPONSE_DONE || parser->state == RESPONSE_ERROR) {
+        return 0;
+    }
+
+    // Every other part is a line terminated by CRLF (or LF), which is parsed once it arrived completely
+    const char *newline = memchr(data, '\n', length);
+    if (newline == NULL) {
+        return 0;
+    }
+    size_t consumed = newline - data + 1;
+    size_t lineLength = newline - data;
+    if (lineLength > 0 && data[lineLength - 1] == '\r') {
+        lineLength--;
+    }
+
+    switch (parser->state) {
+        case RESPONSE_STATUS:
+            RESPONSE_ParseStatus(parser, data, lineLength);
+            break;
+        case RESPONSE_HEADER:
+            RESPONSE_ParseHeader(parser, data, lineLength);
+            break;
+        case RESPONSE_CHUNK_SIZE:
+            RESPONSE_ParseChunkSize(parser, data, lineLength);
+            break;
+        case RESPONSE_CHUNK_END:
+            parser->state = lineLength == 0 ? RESPONSE_CHUNK_SIZE : RESPONSE_ERROR;
+            break;
+        case RESPONSE_TRAILER:
+            // The trailer fields are not used, the response ends with an empty line
+            if (lineLength == 0) {
+                parser->state = RESPONSE_DONE;
+            }
+            break;
+        default:
+            break;
+    }
+    return consumed;
+}
+
+uint8_t RESPONSE_Closed(response_parser *parser)
+{
+    if (parser->state == RESPONSE_BODY && parser->length == RESPONSE_UNTIL_CLOSE) {
+        parser->state = RESPONSE_DONE;
+    }
+    return parser->state == RESPONSE_DONE;
+}
+
+uint8_t RESPONSE_HasBody(int status)
+{
+    return status >= 200 && status != 204 && status != 304;
+}
+
+static void RESPONSE_ParseStatus(response_parser *parser, const char *line, size_t length)
+{
+    // An empty line before the status line is tolerated
+    if (length == 0) {
+        return;
+    }
+    if (length < 12 || memcmp(line, "HTTP/1.", 7) != 0 || line[7] < '0' || line[7] > '9' || line[8] != ' ' || \
+            line[9] < '1' || line[9] > '9' || line[10] < '0' || line[10] > '9' || line[11] < '0' || line[11] > '9' || \
+            (length > 12 && line[12] != ' ')) {
+        parser->state = RESPONSE_ERROR;
+        return;
+    }
+
+    // An HTTP/1.0 server closes the connection unless it keeps it alive
+    parser->status = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+    parser->closing = line[7] == '0';
+    parser->chunked = FALSE;
+    parser->length = RESPONSE_UNTIL_CLOSE;
+    parser->state = RESPONSE_HEADER;
+}
+
+static void RESPONSE_ParseHeader(response_parser *parser, const char *line, size_t length)
+{
+    if (length == 0) {
+        if (parser->status < 200) {
+            parser->state = RESPONSE_STATUS; // an interim response, the final one follows
+        } else if (!RESPONSE_HasBody(parser->status)) {
+            parser->state = RESPONSE_DONE;
+        } else if (parser->chunked) {
+            parser->state = RESPONSE_CHUNK_SIZE; // the transfer encoding takes precedence over the Content-Length
+        } else if (parser->length != RESPONSE_UNTIL_CLOSE) {
+            parser->remaining = parser->length;
+            parser->state = parser->length == 0 ? RESPONSE_DONE : RESPONSE_BODY;
+        } else {
+            // Without a length the body ends with the connection
+            parser->remaining = RESPONSE_UNTIL_CLOSE;
+            parser->closing = TRUE;
+            parser->state = RESPONSE_BODY;
+        }
+        return;
+    }
+
+    // Continuation lines and lines without a field name are ignored
+    const char *colon = memchr(line, ':', length);
+    if (colon == NULL || line[0] == ' ' || line[0] == '\t') {
+        return;
+    }
+    size_t nameLength = colon - line;
+    const char *value = colon + 1;
+    size_t valueLength = length - nameLength - 1;
+    while (valueLength > 0 && (*value == ' ' || *value == '\t')) {
+        value++;
+        valueLength--;
+    }
+    while (valueLength > 0 && (value[valueLength - 1] == ' ' || value[valueLength - 1] == '\t')) {
+        valueLength--;
+    }
+
+    if (nameLength == strlen(RESPONSE_CONTENT_LENGTH) && \
+            strncasecmp(line, RESPONSE_CONTENT_LENGTH, nameLength) == 0) {
+        uint64_t contentLength = 0;
+        for (size_t i = 0; i < valueLength; i++) {
+            if (value[i] < '0' || value[i] > '9' || contentLength > (RESPONSE_UNTIL_CLOSE - 1 - 9) / 10) {
+                parser->state = RESPONSE_ERROR;
+                return;
+            }
+            contentLength = contentLength * 10 + (value[i] - '0');
+        }
+        if (valueLength == 0) {
+            parser->state = RESPONSE_ERROR;
+            return;
+        }
+        parser->length = contentLength;
+    } else if (nameLength == strlen(RESPONSE_TRANSFER_ENCODING) && \
+            strncasecmp(line, RESPONSE_TRANSFER_ENCODING, nameLength) == 0) {
+        parser->chunked = RESPONSE_HasToken(value, valueLength, "chunked");
+    } else if (nameLength == strlen(RESPONSE_CONNECTION) && \
+            strncasecmp(line, RESPONSE_CONNECTION, nameLength) == 0) {
+        if (RESPONSE_HasToken(value, valueLength, "close")) {
+            parser->closing = TRUE;
+        } else if (RESPONSE_HasToken(value, valueLength, "keep-alive")) {
+            parser->closing = FALSE;
+        }
+    }
+}
+
+static void RESPONSE_ParseChunkSize(response_parser *parser, const char *line, size_t length)
+{
+    uint64_t chunkLength = 0;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        int digit;
+        if (line[i] >= '0' && line[i] <= '9') {
+            digit = line[i] - '0';
+        } else if (line[i] >= 'a' && line[i] <= 'f') {
+            digit = line[i] - 'a' + 10;
+        } else if (line[i] >= 'A' && line[i] <= 'F') {
+            digit = line[i] - 'A' + 10;
+        } else {
+            break;
+        }
+        if (chunkLength >> 60 != 0) {
+            parser->state = RESPONSE_ERROR; // larger than 2^64 - 1
+            return;
+        }
+        chunkLength = (chunkLength << 4) | digit;
+    }
+    if (i == 0 || (i < length && line[i] != ';' && line[i] != ' ' && line[i] != '\t')) {
+        parser->state = RESPONSE_ERROR;
+        return;
+    }
+
+    // The last chunk is empty and followed by the trailer
+    if (chunkLength == 0) {
+        parser->state = RESPONSE_TRAILER;
+    } else {
+        parser->remaining = chunkLength;
+        parser->state = RESPONSE_CHUNK_DATA;
+    }
+}
+
+static uint8_t RESPONSE_HasToken(const char *value, size_t length, const char *token)
+{
+    size_t tokenLength = strlen(token);
+    while (length > 0) {
+        const char *comma = memchr(value, ',', length);
+        size_t elementLength = comma != NULL ? (size_t) (comma - value) : length;
+
+        const char *element = value;
+        size_t trimmed = elementLength;
+        while (trimmed > 0 && (*element == ' ' || *element == '\t')) {
+            element++;
+            trimmed--;
+        }
+        while (trimmed > 0 && (element[trimmed - 1] == ' ' || element[trimmed - 1] == '\t')) {
+            trimmed--;
+        }
+        if (trimmed == tokenLength && strncasecmp(element, token, tokenLength) == 0) {
+            return TRUE;
+        }
+
+        if (comma == NULL) {
+            break;
+        }
+        value = comma + 1;
+        length -= elementLength + 1;
+    }
+    return FALSE;
+}
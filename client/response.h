@@ -0,0 +1,99 @@
+#ifndef _RESPONSE_H
+#define _RESPONSE_H
+
+//! \file response.h
+//! \authors Douglas Healy (u16018100)
+//! \authors Llewellyn Moyse (u15100708)
+//! \authors Mohamed Ameen Omar (u16055323)
+//! \date 2019/02/14
+//! \brief Incremental HTTP/1.x response parser. It is fed the bytes read from a connection in pieces of any size, keeps
+//! no copy of them and allocates nothing, and hands out the body bytes as spans of the caller's buffer
+//! \version 1.0
+//! \copyright Copyright &copy; 2019 - EHN410 Group 7
+
+
+//--------------------------------------------------------------
+// User includes
+#include <stdint.h>
+#include <stddef.h>
+
+
+//--------------------------------------------------------------
+// Defines
+
+//! Length of the body of a response that ends with the connection
+#define RESPONSE_UNTIL_CLOSE    UINT64_MAX
+
+
+//--------------------------------------------------------------
+// Types
+
+//! The part of a response the parser expects next
+typedef enum _response_state
+{
+    RESPONSE_STATUS,        //!< The status line
+    RESPONSE_HEADER,        //!< A header line, or the empty line ending the header
+    RESPONSE_BODY,          //!< Body bytes framed by Content-Length, or by the end of the connection
+    RESPONSE_CHUNK_SIZE,    //!< The line holding the size of the next chunk in hex
+    RESPONSE_CHUNK_DATA,    //!< Bytes of the current chunk
+    RESPONSE_CHUNK_END,     //!< The CRLF following the bytes of a chunk
+    RESPONSE_TRAILER,       //!< A trailer line after the last chunk, or the empty line ending the response
+    RESPONSE_DONE,          //!< The response is complete
+    RESPONSE_ERROR          //!< The response is malformed, the connection cannot be used any more
+} response_state;
+
+//! The state of the response being parsed, initialised by RESPONSE_Init for every response
+typedef struct _response_parser
+{
+    //! The part of the response expected next
+    response_state state;
+
+    //! The status code, 0 until the status line was parsed
+    int status;
+
+    //! TRUE if the server closes the connection after the response (HTTP/1.0 or Connection: close)
+    uint8_t closing;
+
+    //! TRUE if the body uses the chunked transfer encoding
+    uint8_t chunked;
+
+    //! The Content-Length of the body, RESPONSE_UNTIL_CLOSE if the header had none
+    uint64_t length;
+
+    //! The bytes left of the body or of the current chunk
+    uint64_t remaining;
+
+    //! The number of body bytes handed out so far
+    uint64_t bytes;
+} response_parser;
+
+
+//--------------------------------------------------------------
+// Function prototypes
+
+//! \brief Prepares a parser for the next response of a connection
+//! \param parser The parser
+void RESPONSE_Init(response_parser *parser);
+
+//! \brief Parses the next part of a response: one line of the status, header, chunk sizes or trailer, or a span of
+//! body bytes. The parser stops after the header, so the caller can decide where the body goes before the first byte
+//! of it is handed out
+//! \param parser The parser
+//! \param data The unparsed bytes, a line must be complete to be parsed and is never copied
+//! \param length The number of unparsed bytes
+//! \param body Receives the body bytes of this step as a span of data, NULL if the step consumed no body bytes
+//! \param bodyLength Receives the number of body bytes of this step
+//! \return The number of bytes consumed, 0 if more bytes are needed or the response is done (check the state)
+size_t RESPONSE_Parse(response_parser *parser, const char *data, size_t length, const char **body, size_t *bodyLength);
+
+//! \brief Tells the parser that the connection closed, which completes a body without a length
+//! \param parser The parser
+//! \return TRUE if the response is complete / FALSE if it was cut short
+uint8_t RESPONSE_Closed(response_parser *parser);
+
+//! \brief Returns whether a status code has a body, 1xx, 204 and 304 responses never have one
+//! \param status The status code
+//! \return TRUE if a response with the status code has a body
+uint8_t RESPONSE_HasBody(int status);
+
+#endif
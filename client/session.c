@@ -0,0 +1,147 @@
+//! \file session.c
+//! \authors Douglas Healy (u16018100)
+//! \authors Llewellyn Moyse (u15100708)
+//! \authors Mohamed Ameen Omar (u16055323)
+//! \date 2019/02/14
+//! \brief Client-side TLS session cache keyed by [host]:[port], shared by every client thread, so that a connection to
+//! a server that was connected to before resumes the session (session ID or ticket) instead of a full handshake
+//! \version 1.0
+//! \copyright Copyright &copy; 2019 - EHN410 Group 7
+
+
+//--------------------------------------------------------------
+// Includes
+#include <string.h>
+
+#include "session.h"
+
+
+//--------------------------------------------------------------
+// Private variables
+
+//! The cached sessions, protected by sessionLock
+static session_entry sessionCache[SESSION_CACHE_SIZE];
+static uint64_t sessionStored = 0;
+static pthread_mutex_t sessionLock = PTHREAD_MUTEX_INITIALIZER;
+
+//! The index of the ex data of an SSL instance holding the [host]:[port] key of its server
+static int sessionKeyIndex = -1;
+static pthread_once_t sessionKeyOnce = PTHREAD_ONCE_INIT;
+
+
+//--------------------------------------------------------------
+// Private function prototypes
+
+//! \brief Allocates the ex data index of the [host]:[port] key, called once
+static void SESSION_CreateKeyIndex(void);
+
+//! \brief Returns the entry a new session is stored in, the entry of the same server for a TLS 1.2 session, otherwise an
+//! unused or the oldest entry. The cache must be locked
+//! \param key The server location in the format [host]:[port]
+//! \param session The new session
+//! \return The entry to store the session in
+static session_entry *SESSION_FindEntry(const char *key, SSL_SESSION *session);
+
+//! \brief Called by OpenSSL when a connection received a new session, with TLS 1.3 once for every session ticket
+//! \param ssl The SSL instance of the connection
+//! \param session The new session
+//! \return 1 if the session was stored in the cache (the cache owns the reference) / 0 if it was not
+static int SESSION_New(SSL *ssl, SSL_SESSION *session);
+
+
+//--------------------------------------------------------------
+// Function implementations
+void SESSION_Attach(SSL_CTX *ctx)
+{
+    pthread_once(&sessionKeyOnce, SESSION_CreateKeyIndex);
+
+    // The sessions are stored by SESSION_New, the internal cache of OpenSSL is only used by servers
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, SESSION_New);
+}
+
+void SESSION_Prepare(SSL *ssl, const char *key)
+{
+    pthread_once(&sessionKeyOnce, SESSION_CreateKeyIndex);
+    SSL_set_ex_data(ssl, sessionKeyIndex, (void*) key);
+
+    // Use the newest session of the server
+    session_entry *entry = NULL;
+    pthread_mutex_lock(&sessionLock);
+    for (int i = 0; i < SESSION_CACHE_SIZE; i++) {
+        if (sessionCache[i].session == NULL || strcmp(sessionCache[i].key, key) != 0) {
+            continue;
+        }
+        if (!SSL_SESSION_is_resumable(sessionCache[i].session)) {
+            SSL_SESSION_free(sessionCache[i].session);
+            sessionCache[i].session = NULL;
+        } else if (entry == NULL || sessionCache[i].stored > entry->stored) {
+            entry = &sessionCache[i];
+        }
+    }
+
+    SSL_SESSION *session = NULL;
+    if (entry != NULL) {
+        session = entry->session;
+        if (SSL_SESSION_get_protocol_version(session) >= TLS1_3_VERSION) {
+            entry->session = NULL; // a TLS 1.3 ticket is only used once, the reference moves to the connection
+        } else {
+            SSL_SESSION_up_ref(session); // the entry may be replaced while the connection uses it
+        }
+    }
+    pthread_mutex_unlock(&sessionLock);
+
+    if (session != NULL) {
+        SSL_set_session(ssl, session);
+        SSL_SESSION_free(session);
+    }
+}
+
+void SESSION_Clear(void)
+{
+    pthread_mutex_lock(&sessionLock);
+    for (int i = 0; i < SESSION_CACHE_SIZE; i++) {
+        SSL_SESSION_free(sessionCache[i].session);
+        sessionCache[i].session = NULL;
+    }
+    pthread_mutex_unlock(&sessionLock);
+}
+
+static void SESSION_CreateKeyIndex(void)
+{
+    sessionKeyIndex = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+}
+
+static session_entry *SESSION_FindEntry(const char *key, SSL_SESSION *session)
+{
+    // A TLS 1.2 session replaces the previous one of the server, TLS 1.3 tickets are collected since each is used once
+    uint8_t replace = SSL_SESSION_get_protocol_version(session) < TLS1_3_VERSION;
+    session_entry *entry = NULL;
+    for (int i = 0; i < SESSION_CACHE_SIZE; i++) {
+        if (replace && sessionCache[i].session != NULL && strcmp(sessionCache[i].key, key) == 0) {
+            return &sessionCache[i];
+        }
+        if (entry == NULL || (entry->session != NULL && \
+                (sessionCache[i].session == NULL || sessionCache[i].stored < entry->stored))) {
+            entry = &sessionCache[i];
+        }
+    }
+    return entry;
+}
+
+static int SESSION_New(SSL *ssl, SSL_SESSION *session)
+{
+    const char *key = SSL_get_ex_data(ssl, sessionKeyIndex);
+    if (key == NULL || strlen(key) >= SESSION_KEY_SIZE || !SSL_SESSION_is_resumable(session)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&sessionLock);
+    session_entry *entry = SESSION_FindEntry(key, session);
+    SSL_SESSION_free(entry->session);
+    strcpy(entry->key, key);
+    entry->session = session;
+    entry->stored = ++sessionStored;
+    pthread_mutex_unlock(&sessionLock);
+    return 1;
+}
@@ -0,0 +1,67 @@
+#ifndef _SESSION_H
+#define _SESSION_H
+
+//! \file session.h
+//! \authors Douglas Healy (u16018100)
+//! \authors Llewellyn Moyse (u15100708)
+//! \authors Mohamed Ameen Omar (u16055323)
+//! \date 2019/02/14
+//! \brief Client-side TLS session cache keyed by [host]:[port], shared by every client thread, so that a connection to
+//! a server that was connected to before resumes the session (session ID or ticket) instead of a full handshake
+//! \version 1.0
+//! \copyright Copyright &copy; 2019 - EHN410 Group 7
+
+
+//--------------------------------------------------------------
+// User includes
+#include <stdint.h>
+#include <pthread.h>
+
+#include <openssl/ssl.h>
+
+
+//--------------------------------------------------------------
+// Defines
+
+//! Number of sessions kept, for every server one TLS 1.2 session or several TLS 1.3 tickets, which are only used once.
+//! The oldest session is replaced when the cache is full
+#define SESSION_CACHE_SIZE  64
+
+//! Longest [host]:[port] key stored in the cache
+#define SESSION_KEY_SIZE    256
+
+
+//--------------------------------------------------------------
+// Types
+
+//! An entry of the session cache
+typedef struct _session_entry
+{
+    //! The server the session was established with, in the format [host]:[port]
+    char key[SESSION_KEY_SIZE];
+
+    //! The session, NULL if the entry is unused
+    SSL_SESSION *session;
+
+    //! The order in which the entries were stored, the entry stored first is replaced when the cache is full
+    uint64_t stored;
+} session_entry;
+
+
+//--------------------------------------------------------------
+// Function prototypes
+
+//! \brief Enables the client session cache of an SSL context, new sessions of its connections are stored in the cache.
+//! The context must not be used for connections yet
+//! \param ctx The SSL context shared by the client threads
+void SESSION_Attach(SSL_CTX *ctx);
+
+//! \brief Prepares a connection to resume the session cached for its server, must be called before the handshake
+//! \param ssl The SSL instance of the connection
+//! \param key The server location in the format [host]:[port], must stay valid as long as the SSL instance
+void SESSION_Prepare(SSL *ssl, const char *key);
+
+//! \brief Frees every cached session
+void SESSION_Clear(void);
+
+#endif
@@ -0,0 +1,135 @@
+/**
+ * @file alloccount.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Allocation counter implementation file.
+ * This file replaces the allocation functions of the process in the allocation counting build (make alloc-count). Every
+ * function counts the call and hands it to the allocator of glibc, the libraries of the process use these definitions as well.
+ * OpenSSL is given allocation functions of its own (CRYPTO_set_mem_functions) so that its allocations are counted apart.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "alloccount.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "openssl/crypto.h"
+
+//! the allocator of glibc, wrapped by the functions below.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *pointer);
+
+//! the allocations of the process, those of OpenSSL excluded.
+static atomic_ulong allocations;
+
+//! the allocations of OpenSSL.
+static atomic_ulong opensslAllocations;
+
+static void *opensslMalloc(size_t size, const char *file, int line)
+{
+	(void)file;
+	(void)line;
+	atomic_fetch_add_explicit(&opensslAllocations, 1, memory_order_relaxed);
+	return __libc_malloc(size);
+}
+
+static void *opensslRealloc(void *pointer, size_t size, const char *file, int line)
+{
+	(void)file;
+	(void)line;
+	atomic_fetch_add_explicit(&opensslAllocations, 1, memory_order_relaxed);
+	return __libc_realloc(pointer, size);
+}
+
+static void opensslFree(void *pointer, const char *file, int line)
+{
+	(void)file;
+	(void)line;
+	__libc_free(pointer);
+}
+
+/**
+ * @brief Function name: allocationCountInit
+ * Hands the allocation functions of OpenSSL over before main runs, OpenSSL only accepts them before its first allocation.
+ */
+__attribute__((constructor)) static void allocationCountInit(void)
+{
+	if(!CRYPTO_set_mem_functions(opensslMalloc, opensslRealloc, opensslFree)){
+		fprintf(stderr, "WARNING: the allocations of OpenSSL are counted as those of the server\n");
+	}
+}
+
+/**
+ * @brief Function name: allocationCount
+ * Returns the number of heap allocations (malloc, calloc, realloc and the aligned allocations) of the process so far,
+ * those made by OpenSSL excluded.
+ *
+ * @return unsigned long - the number of allocations.
+ */
+unsigned long allocationCount(void)
+{
+	return atomic_load_explicit(&allocations, memory_order_relaxed);
+}
+
+/**
+ * @brief Function name: opensslAllocationCount
+ * Returns the number of heap allocations made by OpenSSL so far.
+ *
+ * @return unsigned long - the number of allocations.
+ */
+unsigned long opensslAllocationCount(void)
+{
+	return atomic_load_explicit(&opensslAllocations, memory_order_relaxed);
+}
+
+void *malloc(size_t size)
+{
+	atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size)
+{
+	atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+	return __libc_realloc(pointer, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+	return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+int posix_memalign(void **pointer, size_t alignment, size_t size)
+{
+	void *memory = memalign(alignment, size);
+	if(memory == NULL){
+		return ENOMEM;
+	}
+	*pointer = memory;
+	return 0;
+}
+
+void free(void *pointer)
+{
+	__libc_free(pointer);
+}
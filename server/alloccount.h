@@ -0,0 +1,37 @@
+#ifndef ALLOCCOUNT_H
+#define ALLOCCOUNT_H
+
+/**
+ * @file alloccount.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the heap allocation counter of the allocation counting build (make alloc-count).
+ * That build replaces malloc and its relatives of the whole process with counting versions and counts the allocations of
+ * OpenSSL apart, the server console then shows the allocations per response, which must stay at zero once the pools of the
+ * workers are warm.
+ * See files alloccount.c and serverMain.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+/**
+ * @brief Function name: allocationCount
+ * Returns the number of heap allocations (malloc, calloc, realloc and the aligned allocations) of the process so far,
+ * those made by OpenSSL excluded.
+ *
+ * @return unsigned long - the number of allocations.
+ */
+unsigned long allocationCount(void);
+
+/**
+ * @brief Function name: opensslAllocationCount
+ * Returns the number of heap allocations made by OpenSSL so far. Its record layer allocates for every record it writes
+ * (and reads), which the server can not avoid.
+ *
+ * @return unsigned long - the number of allocations.
+ */
+unsigned long opensslAllocationCount(void);
+
+#endif
@@ -0,0 +1,687 @@
+/**
+ * @file content.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Content cache implementation file.
+ * This file contains the sharded cache of the served files and the inotify thread invalidating its entries.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "server.h"
+#include <limits.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+//! the counters of the content cache.
+contentStats contentCounters;
+
+//! the target of CONTENT_NO_VARIANT.
+const char contentNoVariant = 0;
+
+//! the shards of the content cache.
+static contentShard shards[CONTENT_SHARDS];
+
+//! the number of bytes of memory that may be used for copied files.
+static size_t memoryLimit = (size_t)DEFAULT_CONTENT_MEMORY * 1024 * 1024;
+
+//! incremented by every invalidation, a file loaded while it changes is not cached.
+static atomic_ulong generation = 0;
+
+//! the inotify instance watching the directories of the cached files, -1 if inotify is not available.
+static int inotifyFd = -1;
+
+//! non-zero while the files are watched, without inotify files are loaded for every request and not cached.
+static atomic_int cachingEnabled = 0;
+
+//! A directory watched for changes to the cached files in it.
+typedef struct watchedDirectory
+{
+	//! the inotify watch descriptor.
+	int wd;
+	//! the path of the directory, "." for the server root.
+	char path[PATH_MAX];
+} watchedDirectory;
+
+//! the watched directories.
+static watchedDirectory *watched = NULL;
+
+//! the number of watched directories.
+static int watchedCount = 0;
+
+//! protects the watched directories.
+static pthread_mutex_t watchLock = PTHREAD_MUTEX_INITIALIZER;
+
+//! the events that invalidate the cached files of a directory.
+#define WATCH_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/**
+ * @brief Function name: contentHash
+ * Hashes the path given by @param path (FNV-1a).
+ *
+ * @param path - the path.
+ * @return size_t - the hash of the path.
+ */
+static size_t contentHash(const char *path)
+{
+	size_t hash = 14695981039346656037UL;
+	for(const unsigned char *c = (const unsigned char*)path; *c != '\0'; c++){
+		hash ^= *c;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+/**
+ * @brief Function name: normalizePath
+ * Copies the path given by @param path to @param normal without a leading "./", "/./" segments and repeated slashes,
+ * so that every spelling of a path finds the same entry and matches the paths reported by inotify.
+ *
+ * @param path - the path requested.
+ * @param normal - the buffer of PATH_MAX bytes receiving the normalized path.
+ * @return int - 0 on success, -1 if the path is empty or too long.
+ */
+static int normalizePath(const char *path, char *normal)
+{
+	size_t length = 0;
+	while(*path != '\0'){
+		if(path[0] == '/' && (length == 0 || normal[length - 1] == '/')){
+			path++;
+		} else if(path[0] == '.' && path[1] == '/' && (length == 0 || normal[length - 1] == '/')){
+			path += 2;
+		} else {
+			if(length >= PATH_MAX - 1){
+				return -1;
+			}
+			normal[length++] = *path++;
+		}
+	}
+	normal[length] = '\0';
+	return length > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Function name: watchDirectory
+ * Adds an inotify watch for the directory of the file with the path @param path, unless it is watched already.
+ *
+ * @param path - the normalized path of the file.
+ */
+static void watchDirectory(const char *path)
+{
+	if(inotifyFd < 0){
+		return;
+	}
+	char directory[PATH_MAX];
+	const char *slash = strrchr(path, '/');
+	if(slash == NULL){
+		strcpy(directory, ".");
+	} else {
+		snprintf(directory, sizeof(directory), "%.*s", (int)(slash - path), path);
+	}
+
+	pthread_mutex_lock(&watchLock);
+	for(int i = 0; i < watchedCount; i++){
+		if(strcmp(watched[i].path, directory) == 0){
+			pthread_mutex_unlock(&watchLock);
+			return;
+		}
+	}
+	int wd = inotify_add_watch(inotifyFd, directory, WATCH_EVENTS);
+	watchedDirectory *grown = wd >= 0 ? realloc(watched, (watchedCount + 1) * sizeof(watchedDirectory)) : NULL;
+	if(grown != NULL){
+		watched = grown;
+		watched[watchedCount].wd = wd;
+		strcpy(watched[watchedCount].path, directory);
+		watchedCount++;
+	}
+	pthread_mutex_unlock(&watchLock);
+}
+
+/**
+ * @brief Function name: contentPrepareFields
+ * Renders the header fields of the entry given by @param entry from its mime-type, size and validators.
+ * A compressible file is sent with "Vary: Accept-Encoding", since the client's Accept-Encoding selects the variant sent.
+ *
+ * @param entry - contentEntry* to the entry.
+ * @param coding - the content coding of a variant, NULL for the file itself.
+ */
+static void contentPrepareFields(contentEntry *entry, const char *coding)
+{
+	char encodingField[64] = "";
+	if(coding != NULL){
+		snprintf(encodingField, sizeof(encodingField), "Content-Encoding: %s\r\n", coding);
+	}
+	int typeLength = 0, validatorOffset = 0;
+	int length = snprintf(entry->headerFields, CONTENT_HEADER_SIZE,
+		"Content-Type: %s\r\n%s%nContent-Length: %lld\r\n%n%sETag: %s\r\nLast-Modified: %s\r\n",
+		entry->mimeType, encodingField, &typeLength, (long long)entry->size, &validatorOffset,
+		entry->compressible ? "Vary: Accept-Encoding\r\n" : "", entry->etag, entry->lastModified);
+	entry->typeLength = typeLength;
+	entry->validatorOffset = validatorOffset;
+	entry->headerLength = length < CONTENT_HEADER_SIZE ? (size_t)length : CONTENT_HEADER_SIZE - 1;
+}
+
+/**
+ * @brief Function name: contentLoad
+ * Opens the file with the path @param path and creates its entry. Files up to CONTENT_SMALL_FILE bytes are copied
+ * into memory while the memory limit allows it, other files are mapped and stay open for SSL_sendfile.
+ *
+ * @param path - the normalized path of the file.
+ * @return contentEntry* - the entry holding one reference (for the caller), NULL if the file can not be served.
+ */
+static contentEntry *contentLoad(const char *path)
+{
+	// watch before reading, so that a change made while the file is loaded is not missed
+	watchDirectory(path);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0){
+		return NULL;
+	}
+	struct stat fileStat;
+	if(fstat(fd, &fileStat) < 0 || !S_ISREG(fileStat.st_mode)){
+		close(fd);
+		return NULL;
+	}
+	contentEntry *entry = calloc(1, sizeof(contentEntry) + strlen(path) + 1);
+	if(entry == NULL){
+		close(fd);
+		return NULL;
+	}
+	strcpy(entry->path, path);
+	atomic_init(&entry->references, 1);
+	entry->size = fileStat.st_size;
+	entry->fd = -1;
+
+	size_t used = atomic_load_explicit(&contentCounters.memoryUsed, memory_order_relaxed);
+	if(entry->size <= CONTENT_SMALL_FILE && used + entry->size <= memoryLimit){
+		char *copy = malloc(entry->size > 0 ? entry->size : 1);
+		off_t copied = 0;
+		while(copy != NULL && copied < entry->size){
+			ssize_t bytesread = pread(fd, copy + copied, entry->size - copied, copied);
+			if(bytesread <= 0){
+				free(copy);
+				copy = NULL;
+				break;
+			}
+			copied += bytesread;
+		}
+		close(fd);
+		if(copy == NULL){
+			free(entry);
+			return NULL;
+		}
+		entry->data = copy;
+		atomic_fetch_add_explicit(&contentCounters.memoryUsed, entry->size, memory_order_relaxed);
+	} else {
+		void *map = mmap(NULL, entry->size, PROT_READ, MAP_SHARED, fd, 0);
+		if(map == MAP_FAILED){
+			close(fd);
+			free(entry);
+			return NULL;
+		}
+		madvise(map, entry->size, MADV_SEQUENTIAL);
+		entry->data = map;
+		entry->mapped = 1;
+		entry->fd = fd;
+		atomic_fetch_add_explicit(&contentCounters.mappedFiles, 1, memory_order_relaxed);
+	}
+
+	// the header fields depend only on the file, they are rendered once here instead of for every response
+	entry->modified = fileStat.st_mtime;
+	snprintf(entry->etag, sizeof(entry->etag), "\"%llx-%llx\"", (unsigned long long)fileStat.st_mtime,
+		(unsigned long long)entry->size);
+	httpDate(entry->modified, entry->lastModified);
+	snprintf(entry->mimeType, sizeof(entry->mimeType), "%s", getMimeType(path));
+	entry->compressible = mimeCompressible(entry->mimeType);
+	contentPrepareFields(entry, NULL);
+	return entry;
+}
+
+/**
+ * @brief Function name: contentFree
+ * Unmaps or frees the contents of the entry given by @param entry, releases its variants and frees the entry.
+ *
+ * @param entry - contentEntry* to the entry no longer referenced.
+ */
+static void contentFree(contentEntry *entry)
+{
+	for(int i = 0; i < CONTENT_ENCODINGS; i++){
+		contentEntry *variant = atomic_load_explicit(&entry->variants[i], memory_order_acquire);
+		if(variant != NULL && variant != CONTENT_NO_VARIANT){
+			contentRelease(variant);
+		}
+	}
+	if(entry->compressedCopy){
+		free((void*)entry->data);
+		atomic_fetch_sub_explicit(&contentCounters.variantMemory, entry->size, memory_order_relaxed);
+	} else if(entry->mapped){
+		munmap((void*)entry->data, entry->size);
+		close(entry->fd);
+		atomic_fetch_sub_explicit(&contentCounters.mappedFiles, 1, memory_order_relaxed);
+	} else {
+		free((void*)entry->data);
+		atomic_fetch_sub_explicit(&contentCounters.memoryUsed, entry->size, memory_order_relaxed);
+	}
+	free(entry);
+}
+
+/**
+ * @brief Function name: contentRelease
+ * Releases a reference to the entry given by @param entry, freeing it when it was the last one.
+ *
+ * @param entry - contentEntry* to the entry, may be NULL.
+ */
+void contentRelease(contentEntry *entry)
+{
+	if(entry != NULL && atomic_fetch_sub_explicit(&entry->references, 1, memory_order_acq_rel) == 1){
+		contentFree(entry);
+	}
+}
+
+/**
+ * @brief Function name: variantFinish
+ * Completes the variant given by @param variant of the file given by @param entry: it takes over the mime-type and
+ * modification time of the file, gets an entity tag of its own and the header fields of the content coding.
+ *
+ * @param variant - contentEntry* to the variant.
+ * @param entry - contentEntry* to the file.
+ * @param encoding - the content coding of the variant.
+ */
+static void variantFinish(contentEntry *variant, contentEntry *entry, contentEncoding encoding)
+{
+	static const char *codings[CONTENT_ENCODINGS] = { "br", "gzip" };
+	memcpy(variant->mimeType, entry->mimeType, sizeof(variant->mimeType));
+	variant->modified = entry->modified;
+	memcpy(variant->lastModified, entry->lastModified, sizeof(variant->lastModified));
+	// the variant has other bytes than the file, so it needs another entity tag: "<tag>-<coding>"
+	size_t etagLength = strlen(entry->etag);
+	snprintf(variant->etag, sizeof(variant->etag), "%.*s-%s\"", (int)(etagLength - 1), entry->etag, codings[encoding]);
+	variant->compressible = 1;
+	contentPrepareFields(variant, codings[encoding]);
+	atomic_fetch_add_explicit(&contentCounters.variants, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Function name: variantCompress
+ * Compresses the file given by @param entry with the content coding @param encoding.
+ *
+ * @param entry - contentEntry* to the file.
+ * @param encoding - the content coding.
+ * @param length - size_t* receiving the length of the compressed file.
+ * @return char* - the compressed file (malloc), NULL if it could not be compressed.
+ */
+static char *variantCompress(contentEntry *entry, contentEncoding encoding, size_t *length)
+{
+	char *compressed = NULL;
+	if(encoding == ENCODING_GZIP){
+		z_stream stream;
+		memset(&stream, 0, sizeof(stream));
+		if(deflateInit2(&stream, CONTENT_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK){
+			return NULL;
+		}
+		*length = deflateBound(&stream, entry->size);
+		compressed = malloc(*length);
+		stream.next_in = (Bytef*)entry->data;
+		stream.avail_in = entry->size;
+		stream.next_out = (Bytef*)compressed;
+		stream.avail_out = *length;
+		if(compressed != NULL && deflate(&stream, Z_FINISH) != Z_STREAM_END){
+			free(compressed);
+			compressed = NULL;
+		}
+		*length = stream.total_out;
+		deflateEnd(&stream);
+	} else {
+#ifdef HAVE_BROTLI
+		*length = BrotliEncoderMaxCompressedSize(entry->size);
+		compressed = *length > 0 ? malloc(*length) : NULL;
+		if(compressed != NULL && !BrotliEncoderCompress(CONTENT_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC,
+			entry->size, (const uint8_t*)entry->data, length, (uint8_t*)compressed)){
+			free(compressed);
+			compressed = NULL;
+		}
+#endif
+	}
+	return compressed;
+}
+
+/**
+ * @brief Function name: variantCreate
+ * Creates the variant of the file given by @param entry in the content coding @param encoding, from a precompressed
+ * sibling if there is one that is not older than the file, otherwise by compressing the file.
+ *
+ * @param entry - contentEntry* to the file.
+ * @param encoding - the content coding.
+ * @return contentEntry* - the variant holding one reference, CONTENT_NO_VARIANT if the coding is not worthwhile.
+ */
+static contentEntry *variantCreate(contentEntry *entry, contentEncoding encoding)
+{
+	static const char *suffixes[CONTENT_ENCODINGS] = { ".br", ".gz" };
+	char siblingPath[PATH_MAX];
+	if(snprintf(siblingPath, sizeof(siblingPath), "%s%s", entry->path, suffixes[encoding]) < (int)sizeof(siblingPath)){
+		contentEntry *sibling = contentLoad(siblingPath);
+		if(sibling != NULL && sibling->modified >= entry->modified){
+			variantFinish(sibling, entry, encoding);
+			return sibling;
+		}
+		contentRelease(sibling); // older than the file, it was not recompressed after the file changed
+	}
+
+	// an uncached file would be compressed again for every request
+	if(!atomic_load(&cachingEnabled) || entry->size < CONTENT_COMPRESS_MIN || entry->size > CONTENT_COMPRESS_MAX){
+		return CONTENT_NO_VARIANT;
+	}
+	size_t length = 0;
+	char *compressed = variantCompress(entry, encoding, &length);
+	size_t used = atomic_load_explicit(&contentCounters.variantMemory, memory_order_relaxed);
+	if(compressed == NULL || length >= (size_t)entry->size || used + length > memoryLimit / 4){
+		free(compressed);
+		return CONTENT_NO_VARIANT;
+	}
+	contentEntry *variant = calloc(1, sizeof(contentEntry) + strlen(siblingPath) + 1);
+	if(variant == NULL){
+		free(compressed);
+		return CONTENT_NO_VARIANT;
+	}
+	strcpy(variant->path, siblingPath);
+	atomic_init(&variant->references, 1);
+	char *shrunk = realloc(compressed, length);
+	variant->data = shrunk != NULL ? shrunk : compressed;
+	variant->size = length;
+	variant->fd = -1;
+	variant->compressedCopy = 1;
+	atomic_fetch_add_explicit(&contentCounters.variantMemory, length, memory_order_relaxed);
+	variantFinish(variant, entry, encoding);
+	return variant;
+}
+
+/**
+ * @brief Function name: contentGetVariant
+ * Returns the variant of the file given by @param entry in the content coding @param encoding. The variant is read from
+ * a precompressed sibling (".gz" or ".br", unless it is older than the file) or compressed once on the first request,
+ * and kept with the entry until the file changes. The compressed variants use at most a quarter of the content memory.
+ * The caller holds a reference to the variant and must release it with contentRelease.
+ *
+ * @param entry - contentEntry* to the file, the caller holds a reference to it.
+ * @param encoding - the content coding.
+ * @return contentEntry* - the variant, NULL if the file is not sent in the coding.
+ */
+contentEntry *contentGetVariant(contentEntry *entry, contentEncoding encoding)
+{
+	if(!entry->compressible || entry->compressedCopy){
+		return NULL;
+	}
+	contentEntry *variant = atomic_load_explicit(&entry->variants[encoding], memory_order_acquire);
+	if(variant == NULL){
+		// the first request creates the variant, should another worker beat it to it, its variant is used
+		variant = variantCreate(entry, encoding);
+		contentEntry *expected = NULL;
+		if(!atomic_compare_exchange_strong(&entry->variants[encoding], &expected, variant)){
+			if(variant != CONTENT_NO_VARIANT){
+				contentRelease(variant);
+			}
+			variant = expected;
+		}
+	}
+	if(variant == CONTENT_NO_VARIANT){
+		return NULL;
+	}
+	// the reference of the entry keeps the variant alive meanwhile
+	atomic_fetch_add_explicit(&variant->references, 1, memory_order_relaxed);
+	return variant;
+}
+
+/**
+ * @brief Function name: shardFind
+ * Finds the entry with the path @param path in @param shard. The shard must be locked.
+ *
+ * @param shard - contentShard* to the shard to search.
+ * @param path - the normalized path.
+ * @param hash - the hash of the path.
+ * @return contentEntry* - the entry, NULL if the file is not cached.
+ */
+static contentEntry *shardFind(contentShard *shard, const char *path, size_t hash)
+{
+	for(contentEntry *entry = shard->buckets[hash % CONTENT_BUCKETS]; entry != NULL; entry = entry->next){
+		if(strcmp(entry->path, path) == 0){
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Function name: contentGet
+ * Returns the cached file with the path @param path, loading it into the cache if it is not cached yet.
+ * The caller holds a reference to the entry and must release it with contentRelease.
+ *
+ * @param path - the path of the file, relative to the server root.
+ * @param cached - int* set to 1 if the file was found in the cache, 0 if it had to be loaded, may be NULL.
+ * @return contentEntry* - the entry, NULL if the file does not exist or is not a regular file.
+ */
+contentEntry *contentGet(const char *path, int *cached)
+{
+	char normal[PATH_MAX];
+	if(cached != NULL){
+		*cached = 0;
+	}
+	if(normalizePath(path, normal) < 0){
+		return NULL;
+	}
+	size_t hash = contentHash(normal);
+	contentShard *shard = &shards[(hash / CONTENT_BUCKETS) % CONTENT_SHARDS];
+
+	pthread_mutex_lock(&shard->lock);
+	contentEntry *entry = shardFind(shard, normal, hash);
+	if(entry != NULL){
+		atomic_fetch_add_explicit(&entry->references, 1, memory_order_relaxed);
+		pthread_mutex_unlock(&shard->lock);
+		if(cached != NULL){
+			*cached = 1;
+		}
+		return entry;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	unsigned long loadGeneration = atomic_load(&generation);
+	entry = contentLoad(normal);
+	if(entry == NULL){
+		return NULL;
+	}
+	pthread_mutex_lock(&shard->lock);
+	contentEntry *existing = shardFind(shard, normal, hash);
+	if(existing != NULL){
+		// another worker loaded the same file meanwhile
+		atomic_fetch_add_explicit(&existing->references, 1, memory_order_relaxed);
+		pthread_mutex_unlock(&shard->lock);
+		contentRelease(entry);
+		return existing;
+	}
+	if(atomic_load(&cachingEnabled) && atomic_load(&generation) == loadGeneration){
+		atomic_fetch_add_explicit(&entry->references, 1, memory_order_relaxed); // the reference of the cache
+		entry->next = shard->buckets[hash % CONTENT_BUCKETS];
+		shard->buckets[hash % CONTENT_BUCKETS] = entry;
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return entry;
+}
+
+/**
+ * @brief Function name: contentInvalidate
+ * Drops the entry of the file with the path @param path from the cache. Connections still sending the file
+ * keep their reference to the old entry.
+ *
+ * @param path - the path of the file, relative to the server root.
+ */
+void contentInvalidate(const char *path)
+{
+	char normal[PATH_MAX];
+	if(normalizePath(path, normal) < 0){
+		return;
+	}
+	size_t hash = contentHash(normal);
+	contentShard *shard = &shards[(hash / CONTENT_BUCKETS) % CONTENT_SHARDS];
+	atomic_fetch_add(&generation, 1);
+
+	pthread_mutex_lock(&shard->lock);
+	contentEntry *entry = NULL;
+	for(contentEntry **link = &shard->buckets[hash % CONTENT_BUCKETS]; *link != NULL; link = &(*link)->next){
+		if(strcmp((*link)->path, normal) == 0){
+			entry = *link;
+			*link = entry->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&shard->lock);
+	if(entry != NULL){
+		atomic_fetch_add_explicit(&contentCounters.invalidated, 1, memory_order_relaxed);
+		contentRelease(entry);
+	}
+}
+
+/**
+ * @brief Function name: contentFlush
+ * Drops every entry from the cache, used when inotify lost events, a watched directory disappeared or the mime-types were reloaded.
+ */
+void contentFlush(void)
+{
+	atomic_fetch_add(&generation, 1);
+	for(int s = 0; s < CONTENT_SHARDS; s++){
+		contentShard *shard = &shards[s];
+		pthread_mutex_lock(&shard->lock);
+		for(int b = 0; b < CONTENT_BUCKETS; b++){
+			contentEntry *entry = shard->buckets[b];
+			shard->buckets[b] = NULL;
+			while(entry != NULL){
+				contentEntry *next = entry->next;
+				atomic_fetch_add_explicit(&contentCounters.invalidated, 1, memory_order_relaxed);
+				contentRelease(entry);
+				entry = next;
+			}
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+/**
+ * @brief Function name: contentWatcher
+ * Thread reading the inotify events of the watched directories and dropping the entries of the files that changed.
+ *
+ * @param arg - unused.
+ * @return void* - NULL, the thread only ends if inotify fails.
+ */
+static void *contentWatcher(void *arg)
+{
+	(void)arg;
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while(1){
+		ssize_t length = read(inotifyFd, events, sizeof(events));
+		if(length <= 0){
+			if(length < 0 && errno == EINTR){
+				continue;
+			}
+			logWarning("inotify failed, the content cache is flushed and no longer used");
+			atomic_store(&cachingEnabled, 0);
+			contentFlush();
+			return NULL;
+		}
+		for(char *ptr = events; ptr < events + length; ){
+			struct inotify_event *event = (struct inotify_event*)ptr;
+			ptr += sizeof(struct inotify_event) + event->len;
+			if(event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)){
+				if(event->mask & IN_IGNORED){
+					// the directory is gone, it is watched again once a file in it is loaded
+					pthread_mutex_lock(&watchLock);
+					for(int i = 0; i < watchedCount; i++){
+						if(watched[i].wd == event->wd){
+							watched[i] = watched[--watchedCount];
+							break;
+						}
+					}
+					pthread_mutex_unlock(&watchLock);
+				}
+				contentFlush();
+				continue;
+			}
+			if(event->len == 0){
+				continue;
+			}
+			char path[PATH_MAX * 2];
+			path[0] = '\0';
+			pthread_mutex_lock(&watchLock);
+			for(int i = 0; i < watchedCount; i++){
+				if(watched[i].wd == event->wd){
+					if(strcmp(watched[i].path, ".") == 0){
+						snprintf(path, sizeof(path), "%s", event->name);
+					} else {
+						snprintf(path, sizeof(path), "%s/%s", watched[i].path, event->name);
+					}
+					break;
+				}
+			}
+			pthread_mutex_unlock(&watchLock);
+			if(path[0] != '\0'){
+				contentInvalidate(path);
+				// a precompressed sibling changed, the variant is kept with the entry of the file
+				size_t pathLength = strlen(path);
+				if(pathLength > 3 && (strcmp(path + pathLength - 3, ".gz") == 0 || strcmp(path + pathLength - 3, ".br") == 0)){
+					path[pathLength - 3] = '\0';
+					contentInvalidate(path);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @brief Function name: contentCacheInit
+ * Creates the content cache and starts the thread watching the cached files for changes (inotify).
+ * Without inotify the files are served, but loaded for every request.
+ *
+ * @param limit - the number of bytes of memory used for copied files, once it is reached small files are mapped as well.
+ * @return int - 0 on success, -1 if the watching thread could not be started.
+ */
+int contentCacheInit(size_t limit)
+{
+	memoryLimit = limit;
+	for(int i = 0; i < CONTENT_SHARDS; i++){
+		pthread_mutex_init(&shards[i].lock, NULL);
+	}
+	inotifyFd = inotify_init1(IN_CLOEXEC);
+	if(inotifyFd < 0){
+		// still serve the files, but load them for every request
+		logWarning("inotify is not available, files are not cached");
+		return 0;
+	}
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, contentWatcher, NULL) != 0){
+		close(inotifyFd);
+		inotifyFd = -1;
+		return -1;
+	}
+	pthread_detach(thread);
+	atomic_store(&cachingEnabled, 1);
+	return 0;
+}
+
+/**
+ * @brief Function name: contentPrintStats
+ * Prints the content cache counters to @param out.
+ *
+ * @param out - FILE* to write the counters to.
+ */
+void contentPrintStats(FILE *out)
+{
+	fprintf(out, "Content cache: %lu invalidated, %lu KB in memory, %lu files mapped, "
+		"%lu compressed variants (%lu KB)\n",
+		atomic_load(&contentCounters.invalidated), atomic_load(&contentCounters.memoryUsed) / 1024,
+		atomic_load(&contentCounters.mappedFiles), atomic_load(&contentCounters.variants),
+		atomic_load(&contentCounters.variantMemory) / 1024);
+}
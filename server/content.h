@@ -0,0 +1,202 @@
+#ifndef CONTENT_H
+#define CONTENT_H
+
+/**
+ * @file content.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the cache of the static files served by the server. Small files are kept in memory,
+ * large files are mapped (mmap), both with their header fields prepared in advance. Entries are dropped by an inotify
+ * thread as soon as their file changes, so a cached file is served without any file system call.
+ * See files content.c and server.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "header.h"
+
+//! the number of independently locked shards of the content cache.
+#define CONTENT_SHARDS 16
+
+//! the number of hash buckets per shard.
+#define CONTENT_BUCKETS 256
+
+//! files up to this size (in bytes) are copied into memory, larger files are mapped.
+#define CONTENT_SMALL_FILE (64 * 1024)
+
+//! the default number of megabytes of memory used for the copied (small) files.
+#define DEFAULT_CONTENT_MEMORY 64
+
+//! the largest prepared header fields (Content-Type, Content-Length, ETag and Last-Modified) of an entry.
+#define CONTENT_HEADER_SIZE 320
+
+//! the largest entity tag of an entry, including the quotes.
+#define CONTENT_ETAG_SIZE 48
+
+//! files smaller than this (in bytes) are not compressed, the saving would not outweigh the Content-Encoding field.
+#define CONTENT_COMPRESS_MIN 256
+
+//! files larger than this (in bytes) are only sent compressed from a precompressed sibling, compressing them would stall the worker.
+#define CONTENT_COMPRESS_MAX (1024 * 1024)
+
+//! the zlib level of the gzip variants, they are compressed once and sent many times.
+#define CONTENT_GZIP_LEVEL 9
+
+//! the brotli quality of the br variants.
+#define CONTENT_BROTLI_QUALITY 9
+
+//! The content codings a file may be sent with, besides identity.
+typedef enum contentEncoding
+{
+	ENCODING_BROTLI,   //!< br, from a ".br" sibling or compressed with brotli.
+	ENCODING_GZIP,     //!< gzip, from a ".gz" sibling or compressed with zlib.
+	CONTENT_ENCODINGS  //!< the number of content codings.
+} contentEncoding;
+
+//! A cached file, shared by every connection sending it and freed once the last of them released it.
+typedef struct contentEntry
+{
+	//! the next entry in the same hash bucket.
+	struct contentEntry *next;
+	//! the number of references, one held by the cache and one by every connection sending the file.
+	atomic_int references;
+	//! the contents of the file, copied into memory or mapped.
+	const char *data;
+	//! the size of the file.
+	off_t size;
+	//! non-zero if data is mapped (large file), zero if it was copied into memory.
+	int mapped;
+	//! the open file of a mapped entry (used by SSL_sendfile), -1 for a copied entry.
+	int fd;
+	//! the mime-type of the file.
+	char mimeType[128];
+	//! the time the file was last modified.
+	time_t modified;
+	//! the entity tag of the file (derived from its modification time and size), including the quotes.
+	char etag[CONTENT_ETAG_SIZE];
+	//! the modification time as an HTTP date.
+	char lastModified[HTTP_DATE_LENGTH + 1];
+	//! the prepared "Content-Type", "Content-Encoding", "Content-Length", "Vary", "ETag" and "Last-Modified" header fields,
+	//! each ending with "\r\n".
+	char headerFields[CONTENT_HEADER_SIZE];
+	//! the length of headerFields.
+	size_t headerLength;
+	//! the length of the Content-Type (and Content-Encoding) fields at the start of headerFields.
+	size_t typeLength;
+	//! the offset of the Vary, ETag and Last-Modified fields (repeated in 304 responses) in headerFields, they end it.
+	size_t validatorOffset;
+	//! non-zero if the mime-type of the file is worth compressing (see mimeCompressible).
+	int compressible;
+	//! non-zero if data was compressed by the server, its size is counted in the variant memory.
+	int compressedCopy;
+	//! the compressed variants of the file, NULL until requested, CONTENT_NO_VARIANT if the coding is not worthwhile.
+	_Atomic(struct contentEntry*) variants[CONTENT_ENCODINGS];
+	//! the path of the file, relative to the server root.
+	char path[];
+} contentEntry;
+
+//! marks a variant that is not worth sending: no sibling and not compressible, or not smaller than the file.
+#define CONTENT_NO_VARIANT ((contentEntry*)&contentNoVariant)
+
+//! the target of CONTENT_NO_VARIANT.
+extern const char contentNoVariant;
+
+//! A shard of the content cache, with its own lock and hash table.
+typedef struct contentShard
+{
+	//! protects every field of the shard.
+	pthread_mutex_t lock;
+	//! the hash buckets.
+	contentEntry *buckets[CONTENT_BUCKETS];
+} contentShard;
+
+//! The counters of the content cache, read by the server console (the hits are counted by the workers, see stats.h).
+typedef struct contentStats
+{
+	//! entries dropped since their file changed.
+	atomic_ulong invalidated;
+	//! the bytes of memory used by copied files.
+	atomic_ulong memoryUsed;
+	//! the number of mapped files.
+	atomic_ulong mappedFiles;
+	//! the compressed variants created, from a sibling or by compressing the file.
+	atomic_ulong variants;
+	//! the bytes of memory used by the variants compressed by the server.
+	atomic_ulong variantMemory;
+} contentStats;
+
+//! the counters of the content cache.
+extern contentStats contentCounters;
+
+/**
+ * @brief Function name: contentCacheInit
+ * Creates the content cache and starts the thread watching the cached files for changes (inotify).
+ * Without inotify the files are served, but loaded for every request.
+ *
+ * @param memoryLimit - the number of bytes of memory used for copied files, once it is reached small files are mapped as well.
+ * @return int - 0 on success, -1 if the watching thread could not be started.
+ */
+int contentCacheInit(size_t memoryLimit);
+
+/**
+ * @brief Function name: contentGet
+ * Returns the cached file with the path @param path, loading it into the cache if it is not cached yet.
+ * The caller holds a reference to the entry and must release it with contentRelease.
+ *
+ * @param path - the path of the file, relative to the server root.
+ * @param cached - int* set to 1 if the file was found in the cache, 0 if it had to be loaded, may be NULL.
+ * @return contentEntry* - the entry, NULL if the file does not exist or is not a regular file.
+ */
+contentEntry *contentGet(const char *path, int *cached);
+
+/**
+ * @brief Function name: contentGetVariant
+ * Returns the variant of the file given by @param entry in the content coding @param encoding. The variant is read from
+ * a precompressed sibling (".gz" or ".br", unless it is older than the file) or compressed once on the first request,
+ * and kept with the entry until the file changes. The compressed variants use at most a quarter of the content memory.
+ * The caller holds a reference to the variant and must release it with contentRelease.
+ *
+ * @param entry - contentEntry* to the file, the caller holds a reference to it.
+ * @param encoding - the content coding.
+ * @return contentEntry* - the variant, NULL if the file is not sent in the coding.
+ */
+contentEntry *contentGetVariant(contentEntry *entry, contentEncoding encoding);
+
+/**
+ * @brief Function name: contentRelease
+ * Releases a reference to the entry given by @param entry, freeing it when it was the last one.
+ *
+ * @param entry - contentEntry* to the entry, may be NULL.
+ */
+void contentRelease(contentEntry *entry);
+
+/**
+ * @brief Function name: contentInvalidate
+ * Drops the entry of the file with the path @param path from the cache. Connections still sending the file
+ * keep their reference to the old entry.
+ *
+ * @param path - the path of the file, relative to the server root.
+ */
+void contentInvalidate(const char *path);
+
+/**
+ * @brief Function name: contentFlush
+ * Drops every entry from the cache, used when inotify lost events, a watched directory disappeared or the mime-types were reloaded.
+ */
+void contentFlush(void);
+
+/**
+ * @brief Function name: contentPrintStats
+ * Prints the content cache counters to @param out.
+ *
+ * @param out - FILE* to write the counters to.
+ */
+void contentPrintStats(FILE *out);
+
+#endif
@@ -0,0 +1,390 @@
+/**
+ * @file disk.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Asynchronous file read implementation file.
+ * This file contains the io_uring reader of the workers (set up with the raw system calls) and the reading threads
+ * used in its place when the kernel does not provide io_uring.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "disk.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+//! the counters of the asynchronous reads.
+diskStats diskCounters;
+
+//! the number of workers reading with io_uring.
+static atomic_int ringReaders = 0;
+
+//! the number of workers reading with the reading threads.
+static atomic_int threadReaders = 0;
+
+//! the number of workers whose io_uring buffers are registered.
+static atomic_int fixedReaders = 0;
+
+//! the reads waiting for a reading thread, oldest first.
+static diskRequest *queueHead = NULL;
+
+//! the newest read waiting for a reading thread.
+static diskRequest *queueTail = NULL;
+
+//! protects the queue of the reading threads.
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+
+//! signals the reading threads that a read was queued.
+static pthread_cond_t queueReady = PTHREAD_COND_INITIALIZER;
+
+//! starts the reading threads once.
+static pthread_once_t threadsOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Function name: diskThread
+ * Thread performing the queued reads with pread and handing the results back to the worker of each read.
+ *
+ * @param arg - unused.
+ * @return void* - NULL, the thread runs until the server exits.
+ */
+static void *diskThread(void *arg)
+{
+	(void)arg;
+	while(1){
+		pthread_mutex_lock(&queueLock);
+		while(queueHead == NULL){
+			pthread_cond_wait(&queueReady, &queueLock);
+		}
+		diskRequest *request = queueHead;
+		queueHead = request->next;
+		if(queueHead == NULL){
+			queueTail = NULL;
+		}
+		pthread_mutex_unlock(&queueLock);
+
+		ssize_t result = pread(request->content->fd, request->target, request->length, request->offset);
+		request->result = result < 0 ? -errno : result;
+
+		diskReader *reader = request->reader;
+		pthread_mutex_lock(&reader->lock);
+		reader->completed[reader->completedCount++] = request - reader->requests;
+		pthread_mutex_unlock(&reader->lock);
+		uint64_t one = 1;
+		if(write(reader->wakeFd, &one, sizeof(one)) < 0){
+			// the eventfd only fails if its counter overflows, the worker is woken already
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Function name: startThreads
+ * Starts the reading threads, called once through pthread_once.
+ */
+static void startThreads(void)
+{
+	for(int i = 0; i < DISK_THREADS; i++){
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, diskThread, NULL) == 0){
+			pthread_detach(thread);
+		}
+	}
+}
+
+/**
+ * @brief Function name: ringSetup
+ * Creates the io_uring instance of the reader given by @param reader, maps its queues, registers the buffers and the
+ * eventfd of the worker.
+ *
+ * @param reader - diskReader* to the reader, its buffers are allocated.
+ * @return int - 0 on success, -1 if io_uring is not available.
+ */
+static int ringSetup(diskReader *reader)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int ring = syscall(__NR_io_uring_setup, DISK_BUFFERS, &params);
+	if(ring < 0){
+		return -1;
+	}
+	size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP){
+		sqSize = cqSize = sqSize > cqSize ? sqSize : cqSize;
+	}
+	char *sq = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+	char *cq = sq;
+	if(sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)){
+		cq = mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+	}
+	void *sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+	if(sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED){
+		close(ring); // closing the ring is enough, the mappings only keep it alive until the process exits
+		return -1;
+	}
+	reader->sqHead = (unsigned*)(sq + params.sq_off.head);
+	reader->sqTail = (unsigned*)(sq + params.sq_off.tail);
+	reader->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+	reader->sqArray = (unsigned*)(sq + params.sq_off.array);
+	reader->sqes = sqes;
+	reader->cqHead = (unsigned*)(cq + params.cq_off.head);
+	reader->cqTail = (unsigned*)(cq + params.cq_off.tail);
+	reader->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+	reader->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	// the kernel signals the eventfd of the worker for every completion
+	if(syscall(__NR_io_uring_register, ring, IORING_REGISTER_EVENTFD, &reader->wakeFd, 1) < 0){
+		close(ring);
+		return -1;
+	}
+	// registered buffers are pinned once instead of for every read, without them plain reads are used
+	struct iovec iovecs[DISK_BUFFERS];
+	for(int i = 0; i < DISK_BUFFERS; i++){
+		iovecs[i].iov_base = reader->buffers + (size_t)i * DISK_BUFFER_SIZE;
+		iovecs[i].iov_len = DISK_BUFFER_SIZE;
+	}
+	reader->fixed = syscall(__NR_io_uring_register, ring, IORING_REGISTER_BUFFERS, iovecs, DISK_BUFFERS) == 0;
+	reader->ring = ring;
+	return 0;
+}
+
+/**
+ * @brief Function name: diskReaderInit
+ * Creates the read buffers of a worker and its io_uring instance, or starts the reading threads if io_uring is not available.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param wakeFd - the eventfd of the worker, written when a read completed.
+ * @return int - 0 on success, -1 if no buffers could be allocated (files are then sent from their mapping).
+ */
+int diskReaderInit(diskReader *reader, int wakeFd)
+{
+	reader->ring = -1;
+	reader->fixed = 0;
+	reader->wakeFd = wakeFd;
+	reader->freeCount = 0;
+	reader->completedCount = 0;
+	pthread_mutex_init(&reader->lock, NULL);
+	reader->buffers = aligned_alloc(4096, (size_t)DISK_BUFFERS * DISK_BUFFER_SIZE);
+	if(reader->buffers == NULL){
+		return -1;
+	}
+	for(int i = DISK_BUFFERS - 1; i >= 0; i--){
+		memset(&reader->requests[i], 0, sizeof(diskRequest));
+		reader->requests[i].reader = reader;
+		reader->freeBuffers[reader->freeCount++] = i;
+	}
+	if(ringSetup(reader) == 0){
+		atomic_fetch_add(&ringReaders, 1);
+		if(reader->fixed){
+			atomic_fetch_add(&fixedReaders, 1);
+		}
+		return 0;
+	}
+	pthread_once(&threadsOnce, startThreads);
+	atomic_fetch_add(&threadReaders, 1);
+	return 0;
+}
+
+/**
+ * @brief Function name: diskAcquire
+ * Takes a free buffer of the reader given by @param reader for the connection @param owner.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param owner - the connection holding the buffer, passed to the callback of diskHarvest.
+ * @return int - the index of the buffer, -1 if no buffer is free.
+ */
+int diskAcquire(diskReader *reader, void *owner)
+{
+	if(reader->buffers == NULL){
+		return -1;
+	}
+	if(reader->freeCount == 0){
+		atomic_fetch_add_explicit(&diskCounters.busy, 1, memory_order_relaxed);
+		return -1;
+	}
+	int index = reader->freeBuffers[--reader->freeCount];
+	reader->requests[index].owner = owner;
+	return index;
+}
+
+/**
+ * @brief Function name: diskBuffer
+ * Returns the buffer with the index @param index.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param index - the index of the buffer.
+ * @return char* - the buffer, DISK_BUFFER_SIZE bytes.
+ */
+char *diskBuffer(diskReader *reader, int index)
+{
+	return reader->buffers + (size_t)index * DISK_BUFFER_SIZE;
+}
+
+/**
+ * @brief Function name: diskRead
+ * Starts reading @param length bytes at @param offset of the file given by @param content into the buffer @param index,
+ * @param bufferOffset bytes into it. The completion is delivered by diskHarvest.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param index - the index of the buffer.
+ * @param bufferOffset - where the bytes are placed in the buffer.
+ * @param content - contentEntry* to the (mapped) file, it is referenced until the read completed.
+ * @param offset - the offset in the file.
+ * @param length - the number of bytes to read, at most DISK_BUFFER_SIZE - bufferOffset.
+ * @return int - 0 if the read was started, -1 if it could not be submitted.
+ */
+int diskRead(diskReader *reader, int index, size_t bufferOffset, contentEntry *content, off_t offset, size_t length)
+{
+	diskRequest *request = &reader->requests[index];
+	request->target = diskBuffer(reader, index) + bufferOffset;
+	request->offset = offset;
+	request->length = length;
+	request->next = NULL;
+
+	if(reader->ring >= 0){
+		// every buffer has at most one read in flight and the queue has a slot per buffer, so it is never full
+		unsigned tail = *reader->sqTail;
+		unsigned slot = tail & *reader->sqMask;
+		struct io_uring_sqe *sqe = &reader->sqes[slot];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = reader->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+		sqe->fd = content->fd;
+		sqe->off = offset;
+		sqe->addr = (uint64_t)(uintptr_t)request->target;
+		sqe->len = length;
+		sqe->buf_index = reader->fixed ? index : 0;
+		sqe->user_data = index;
+		reader->sqArray[slot] = slot;
+		atomic_store_explicit((_Atomic unsigned*)reader->sqTail, tail + 1, memory_order_release);
+		if(syscall(__NR_io_uring_enter, reader->ring, 1, 0, 0, NULL, 0) < 0){
+			atomic_store_explicit((_Atomic unsigned*)reader->sqTail, tail, memory_order_release);
+			return -1;
+		}
+	} else {
+		request->content = content; // set before the read is queued, the reading thread uses its fd
+		pthread_mutex_lock(&queueLock);
+		if(queueTail != NULL){
+			queueTail->next = request;
+		} else {
+			queueHead = request;
+		}
+		queueTail = request;
+		pthread_cond_signal(&queueReady);
+		pthread_mutex_unlock(&queueLock);
+	}
+	// the file stays open until the read completed, even if the connection closes meanwhile
+	atomic_fetch_add_explicit(&content->references, 1, memory_order_relaxed);
+	request->content = content;
+	request->inFlight = 1;
+	return 0;
+}
+
+/**
+ * @brief Function name: diskRelease
+ * Returns the buffer @param index to the reader given by @param reader. A buffer still being read into is only
+ * returned once the read completed, its result is then discarded.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param index - the index of the buffer.
+ */
+void diskRelease(diskReader *reader, int index)
+{
+	diskRequest *request = &reader->requests[index];
+	request->owner = NULL;
+	if(!request->inFlight){
+		reader->freeBuffers[reader->freeCount++] = index;
+	}
+}
+
+/**
+ * @brief Function name: diskComplete
+ * Completes the read into the buffer @param index with the result @param result and hands it to @param callback.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param index - the index of the buffer.
+ * @param result - the bytes read, negative errno on failure.
+ * @param callback - called with the owner of the buffer, unless its connection closed during the read.
+ */
+static void diskComplete(diskReader *reader, int index, ssize_t result, diskCallback callback)
+{
+	diskRequest *request = &reader->requests[index];
+	request->inFlight = 0;
+	contentRelease(request->content);
+	request->content = NULL;
+	if(result > 0){
+		atomic_fetch_add_explicit(&diskCounters.reads, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&diskCounters.bytes, result, memory_order_relaxed);
+	}
+	if(request->owner == NULL){
+		reader->freeBuffers[reader->freeCount++] = index; // the connection closed while the read was in flight
+		return;
+	}
+	callback(request->owner, result);
+}
+
+/**
+ * @brief Function name: diskHarvest
+ * Delivers the completed reads of the reader given by @param reader to @param callback, called by the worker whenever
+ * its eventfd was written.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param callback - called with the owner of the buffer and the result of every read whose buffer is still held.
+ */
+void diskHarvest(diskReader *reader, diskCallback callback)
+{
+	if(reader->ring >= 0){
+		while(1){
+			unsigned head = *reader->cqHead;
+			if(head == atomic_load_explicit((_Atomic unsigned*)reader->cqTail, memory_order_acquire)){
+				return;
+			}
+			struct io_uring_cqe *cqe = &reader->cqes[head & *reader->cqMask];
+			int index = (int)cqe->user_data;
+			ssize_t result = cqe->res;
+			// the entry is consumed before the callback, which may submit the next read
+			atomic_store_explicit((_Atomic unsigned*)reader->cqHead, head + 1, memory_order_release);
+			diskComplete(reader, index, result, callback);
+		}
+	}
+	if(reader->buffers == NULL){
+		return;
+	}
+	pthread_mutex_lock(&reader->lock);
+	int count = reader->completedCount;
+	int completed[DISK_BUFFERS];
+	memcpy(completed, reader->completed, count * sizeof(int));
+	reader->completedCount = 0;
+	pthread_mutex_unlock(&reader->lock);
+	for(int i = 0; i < count; i++){
+		diskComplete(reader, completed[i], reader->requests[completed[i]].result, callback);
+	}
+}
+
+/**
+ * @brief Function name: diskPrintStats
+ * Prints how the files are read and the read counters to @param out.
+ *
+ * @param out - FILE* to write the counters to.
+ */
+void diskPrintStats(FILE *out)
+{
+	int rings = atomic_load(&ringReaders), threads = atomic_load(&threadReaders), fixed = atomic_load(&fixedReaders);
+	if(rings == 0 && threads == 0){
+		fprintf(out, "Disk reads: not available, large files are sent from their mapping\n");
+		return;
+	}
+	fprintf(out, "Disk reads: %d workers with io_uring (%d with registered buffers), %d with the reading threads, "
+		"%lu reads, %lu KB, %lu times no buffer was free\n", rings, fixed, threads,
+		atomic_load(&diskCounters.reads), atomic_load(&diskCounters.bytes) / 1024, atomic_load(&diskCounters.busy));
+}
@@ -0,0 +1,190 @@
+#ifndef DISK_H
+#define DISK_H
+
+/**
+ * @file disk.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the asynchronous reads of the large (mapped) files. Sending a mapped file straight
+ * from its mapping stalls the worker on every page fault of a file that is not in the page cache, so these files are read
+ * into buffers of the worker instead: with io_uring (registered buffers) where the kernel supports it, otherwise by a
+ * small pool of reading threads. The worker is woken through its eventfd once a read completed.
+ * See files disk.c and reactor.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "content.h"
+
+//! the number of read buffers of every worker, a connection holds one while it sends a file read from disk.
+#define DISK_BUFFERS 64
+
+//! the size of a read buffer, one full TLS record.
+#define DISK_BUFFER_SIZE 16384
+
+//! the number of reading threads used when io_uring is not available.
+#define DISK_THREADS 2
+
+//! Called by diskHarvest for every completed read, with the owner of the buffer and the bytes read (negative errno on failure).
+typedef void (*diskCallback)(void *owner, ssize_t result);
+
+//! A read of a file into a buffer of a worker, one per buffer.
+typedef struct diskRequest
+{
+	//! the next request in the queue of the reading threads.
+	struct diskRequest *next;
+	//! the reader the buffer belongs to.
+	struct diskReader *reader;
+	//! the connection holding the buffer, NULL while the buffer is free or after its connection closed during a read.
+	void *owner;
+	//! the file read, a reference is held until the read completed.
+	contentEntry *content;
+	//! non-zero while the read is in flight.
+	int inFlight;
+	//! the offset in the file to read from.
+	off_t offset;
+	//! the number of bytes to read.
+	size_t length;
+	//! where the bytes are read to, inside the buffer.
+	char *target;
+	//! the bytes read by a reading thread, negative errno on failure.
+	ssize_t result;
+} diskRequest;
+
+//! The reads of a worker, only used by the worker itself (the reading threads only touch the completions).
+typedef struct diskReader
+{
+	//! the io_uring instance, -1 if the reading threads are used.
+	int ring;
+	//! non-zero if the buffers are registered with io_uring (IORING_OP_READ_FIXED).
+	int fixed;
+	//! the head of the submission queue (shared with the kernel).
+	unsigned *sqHead;
+	//! the tail of the submission queue.
+	unsigned *sqTail;
+	//! the mask of the submission queue.
+	unsigned *sqMask;
+	//! the indices of the submitted entries.
+	unsigned *sqArray;
+	//! the submission queue entries.
+	struct io_uring_sqe *sqes;
+	//! the head of the completion queue.
+	unsigned *cqHead;
+	//! the tail of the completion queue.
+	unsigned *cqTail;
+	//! the mask of the completion queue.
+	unsigned *cqMask;
+	//! the completion queue entries.
+	struct io_uring_cqe *cqes;
+	//! the buffers, DISK_BUFFERS times DISK_BUFFER_SIZE bytes, NULL if asynchronous reads are not available.
+	char *buffers;
+	//! the read of every buffer.
+	diskRequest requests[DISK_BUFFERS];
+	//! the free buffers.
+	int freeBuffers[DISK_BUFFERS];
+	//! the number of free buffers.
+	int freeCount;
+	//! protects the completions of the reading threads.
+	pthread_mutex_t lock;
+	//! the buffers whose read a reading thread completed.
+	int completed[DISK_BUFFERS];
+	//! the number of completed reads.
+	int completedCount;
+	//! the eventfd of the worker, written when a read completed.
+	int wakeFd;
+} diskReader;
+
+//! The counters of the asynchronous reads, read by the server console.
+typedef struct diskStats
+{
+	//! the reads completed.
+	atomic_ulong reads;
+	//! the bytes read.
+	atomic_ulong bytes;
+	//! the times no buffer was free, the file was then sent from its mapping.
+	atomic_ulong busy;
+} diskStats;
+
+//! the counters of the asynchronous reads.
+extern diskStats diskCounters;
+
+/**
+ * @brief Function name: diskReaderInit
+ * Creates the read buffers of a worker and its io_uring instance, or starts the reading threads if io_uring is not available.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param wakeFd - the eventfd of the worker, written when a read completed.
+ * @return int - 0 on success, -1 if no buffers could be allocated (files are then sent from their mapping).
+ */
+int diskReaderInit(diskReader *reader, int wakeFd);
+
+/**
+ * @brief Function name: diskAcquire
+ * Takes a free buffer of the reader given by @param reader for the connection @param owner.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param owner - the connection holding the buffer, passed to the callback of diskHarvest.
+ * @return int - the index of the buffer, -1 if no buffer is free.
+ */
+int diskAcquire(diskReader *reader, void *owner);
+
+/**
+ * @brief Function name: diskBuffer
+ * Returns the buffer with the index @param index.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param index - the index of the buffer.
+ * @return char* - the buffer, DISK_BUFFER_SIZE bytes.
+ */
+char *diskBuffer(diskReader *reader, int index);
+
+/**
+ * @brief Function name: diskRead
+ * Starts reading @param length bytes at @param offset of the file given by @param content into the buffer @param index,
+ * @param bufferOffset bytes into it. The completion is delivered by diskHarvest.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param index - the index of the buffer.
+ * @param bufferOffset - where the bytes are placed in the buffer.
+ * @param content - contentEntry* to the (mapped) file, it is referenced until the read completed.
+ * @param offset - the offset in the file.
+ * @param length - the number of bytes to read, at most DISK_BUFFER_SIZE - bufferOffset.
+ * @return int - 0 if the read was started, -1 if it could not be submitted.
+ */
+int diskRead(diskReader *reader, int index, size_t bufferOffset, contentEntry *content, off_t offset, size_t length);
+
+/**
+ * @brief Function name: diskRelease
+ * Returns the buffer @param index to the reader given by @param reader. A buffer still being read into is only
+ * returned once the read completed, its result is then discarded.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param index - the index of the buffer.
+ */
+void diskRelease(diskReader *reader, int index);
+
+/**
+ * @brief Function name: diskHarvest
+ * Delivers the completed reads of the reader given by @param reader to @param callback, called by the worker whenever
+ * its eventfd was written.
+ *
+ * @param reader - diskReader* to the reader of the worker.
+ * @param callback - called with the owner of the buffer and the result of every read whose buffer is still held.
+ */
+void diskHarvest(diskReader *reader, diskCallback callback);
+
+/**
+ * @brief Function name: diskPrintStats
+ * Prints how the files are read and the read counters to @param out.
+ *
+ * @param out - FILE* to write the counters to.
+ */
+void diskPrintStats(FILE *out);
+
+#endif
@@ -0,0 +1,141 @@
+/**
+ * @file header.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Response header implementation file.
+ * This file contains the table of pre-rendered status lines and the clock thread rendering the Date field.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "header.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+//! renders a status line with its length.
+#define STATUS_LINE(code, text) { code, "HTTP/1.1 " #code " " text "\r\n", sizeof("HTTP/1.1 " #code " " text "\r\n") - 1 }
+
+//! the status lines sent by the server, the last one is used for unknown codes.
+static const statusLine statusLines[] = {
+	STATUS_LINE(200, "OK"),
+	STATUS_LINE(206, "Partial Content"),
+	STATUS_LINE(304, "Not Modified"),
+	STATUS_LINE(400, "Bad Request"),
+	STATUS_LINE(404, "Not Found"),
+	STATUS_LINE(416, "Range Not Satisfiable"),
+	STATUS_LINE(503, "Service Unavailable"),
+	STATUS_LINE(500, "Internal Server Error")
+};
+
+//! the Date field, rendered alternately into both buffers so that a reader never sees a field being rendered.
+static char dateFields[2][DATE_FIELD_LENGTH + 1];
+
+//! the buffer of dateFields holding the current Date field.
+static atomic_int dateIndex = 0;
+
+/**
+ * @brief Function name: httpDate
+ * Renders the time @param when as an HTTP date (HTTP_DATE_LENGTH characters and a NUL) to @param out.
+ *
+ * @param when - the time.
+ * @param out - the buffer receiving the date, at least HTTP_DATE_LENGTH + 1 bytes.
+ */
+void httpDate(time_t when, char *out)
+{
+	static const char days[7][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+	static const char months[12][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+	struct tm tm;
+	gmtime_r(&when, &tm);
+	// the names are not taken from strftime, they must not depend on the locale
+	char date[64];
+	snprintf(date, sizeof(date), "%s, %02d %s %04d %02d:%02d:%02d GMT", days[tm.tm_wday], tm.tm_mday,
+		months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+	memcpy(out, date, HTTP_DATE_LENGTH);
+	out[HTTP_DATE_LENGTH] = '\0';
+}
+
+/**
+ * @brief Function name: dateRender
+ * Renders the Date field of the current time into the buffer not in use and publishes it.
+ */
+static void dateRender(void)
+{
+	int next = 1 - atomic_load_explicit(&dateIndex, memory_order_relaxed);
+	memcpy(dateFields[next], "Date: ", 6);
+	httpDate(time(NULL), dateFields[next] + 6);
+	memcpy(dateFields[next] + 6 + HTTP_DATE_LENGTH, "\r\n", 3);
+	atomic_store_explicit(&dateIndex, next, memory_order_release);
+}
+
+/**
+ * @brief Function name: dateClock
+ * Thread rendering the Date field at the start of every second.
+ *
+ * @param arg - unused.
+ * @return void* - NULL, the thread runs until the server exits.
+ */
+static void *dateClock(void *arg)
+{
+	(void)arg;
+	while(1){
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		struct timespec untilNextSecond = { 0, 1000000000L - now.tv_nsec };
+		nanosleep(&untilNextSecond, NULL);
+		dateRender();
+	}
+	return NULL;
+}
+
+/**
+ * @brief Function name: headerClockStart
+ * Renders the Date field and starts the thread rendering it again at the start of every second.
+ *
+ * @return int - 0 on success, -1 if the thread could not be started.
+ */
+int headerClockStart(void)
+{
+	dateRender();
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, dateClock, NULL) != 0){
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
+/**
+ * @brief Function name: headerStatusLine
+ * Returns the pre-rendered status line of the status code @param code.
+ *
+ * @param code - the status code.
+ * @return const statusLine* - the status line, the line of 500 (Internal Server Error) for an unknown code.
+ */
+const statusLine *headerStatusLine(int code)
+{
+	size_t count = sizeof(statusLines) / sizeof(statusLines[0]);
+	for(size_t i = 0; i < count - 1; i++){
+		if(statusLines[i].code == code){
+			return &statusLines[i];
+		}
+	}
+	return &statusLines[count - 1];
+}
+
+/**
+ * @brief Function name: headerDate
+ * Copies the current Date field (DATE_FIELD_LENGTH bytes, ending with "\r\n") to @param out.
+ *
+ * @param out - the buffer receiving the field, at least DATE_FIELD_LENGTH bytes.
+ * @return size_t - DATE_FIELD_LENGTH.
+ */
+size_t headerDate(char *out)
+{
+	memcpy(out, dateFields[atomic_load_explicit(&dateIndex, memory_order_acquire)], DATE_FIELD_LENGTH);
+	return DATE_FIELD_LENGTH;
+}
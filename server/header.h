@@ -0,0 +1,72 @@
+#ifndef HEADER_H
+#define HEADER_H
+
+/**
+ * @file header.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the pre-rendered parts of the response headers: the status lines and the Date field,
+ * which is rendered once per second by a clock thread instead of for every response.
+ * See files header.c and server.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include <stddef.h>
+#include <time.h>
+
+//! the length of the Date field, "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n".
+#define DATE_FIELD_LENGTH 37
+
+//! the length of an HTTP date, "Sun, 06 Nov 1994 08:49:37 GMT".
+#define HTTP_DATE_LENGTH 29
+
+//! A pre-rendered status line.
+typedef struct statusLine
+{
+	//! the status code.
+	int code;
+	//! the status line, for example "HTTP/1.1 200 OK\r\n".
+	const char *line;
+	//! the length of the status line.
+	size_t length;
+} statusLine;
+
+/**
+ * @brief Function name: headerClockStart
+ * Renders the Date field and starts the thread rendering it again at the start of every second.
+ *
+ * @return int - 0 on success, -1 if the thread could not be started.
+ */
+int headerClockStart(void);
+
+/**
+ * @brief Function name: headerStatusLine
+ * Returns the pre-rendered status line of the status code @param code.
+ *
+ * @param code - the status code.
+ * @return const statusLine* - the status line, the line of 500 (Internal Server Error) for an unknown code.
+ */
+const statusLine *headerStatusLine(int code);
+
+/**
+ * @brief Function name: headerDate
+ * Copies the current Date field (DATE_FIELD_LENGTH bytes, ending with "\r\n") to @param out.
+ *
+ * @param out - the buffer receiving the field, at least DATE_FIELD_LENGTH bytes.
+ * @return size_t - DATE_FIELD_LENGTH.
+ */
+size_t headerDate(char *out);
+
+/**
+ * @brief Function name: httpDate
+ * Renders the time @param when as an HTTP date (HTTP_DATE_LENGTH characters and a NUL) to @param out.
+ *
+ * @param when - the time.
+ * @param out - the buffer receiving the date, at least HTTP_DATE_LENGTH + 1 bytes.
+ */
+void httpDate(time_t when, char *out);
+
+#endif
@@ -0,0 +1,147 @@
+
+/**
+ * @file histogram.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Latency histogram implementation file.
+ * This file contains the recording and the percentile reporting of the lock-free latency histograms.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "histogram.h"
+#include <stdlib.h>
+#include <string.h>
+
+//! the names of the phases, indexed by connectionPhase.
+const char *phaseNames[PHASE_COUNT] = { "accept", "handshake", "request read", "first byte", "last byte" };
+
+/**
+ * @brief Function name: bucketIndex
+ * Returns the bucket of the value @param nanos. Values below 2 * HISTOGRAM_SUB_BUCKETS get a bucket each,
+ * every following power of two is split into HISTOGRAM_SUB_BUCKETS buckets.
+ *
+ * @param nanos - the value.
+ * @return int - the index of the bucket.
+ */
+static int bucketIndex(uint64_t nanos)
+{
+	if(nanos < 2 * HISTOGRAM_SUB_BUCKETS){
+		return (int)nanos;
+	}
+	int shift = (63 - __builtin_clzl(nanos)) - HISTOGRAM_SUB_BUCKET_BITS;
+	int index = (shift + 1) * HISTOGRAM_SUB_BUCKETS + (int)(nanos >> shift) - HISTOGRAM_SUB_BUCKETS;
+	return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * @brief Function name: bucketValue
+ * Returns the highest value that is recorded in the bucket @param index.
+ *
+ * @param index - the index of the bucket.
+ * @return uint64_t - the value.
+ */
+static uint64_t bucketValue(int index)
+{
+	if(index < 2 * HISTOGRAM_SUB_BUCKETS){
+		return index;
+	}
+	int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t sub = index % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+	return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * @brief Function name: histogramRecord
+ * Records the latency @param nanos in the histogram given by @param histogram.
+ * Must only be called by the thread owning the histogram.
+ *
+ * @param histogram - latencyHistogram* to the histogram.
+ * @param nanos - the latency in nanoseconds.
+ */
+void histogramRecord(latencyHistogram *histogram, uint64_t nanos)
+{
+	atomic_fetch_add_explicit(&histogram->counts[bucketIndex(nanos)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&histogram->sum, nanos, memory_order_relaxed);
+	if(nanos > atomic_load_explicit(&histogram->max, memory_order_relaxed)){
+		atomic_store_explicit(&histogram->max, nanos, memory_order_relaxed);
+	}
+	atomic_fetch_add_explicit(&histogram->total, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Function name: printMicros
+ * Prints the value @param nanos in microseconds, or milliseconds for large values.
+ *
+ * @param out - FILE* to print to.
+ * @param label - the label printed in front of the value.
+ * @param nanos - the value in nanoseconds.
+ */
+static void printMicros(FILE *out, const char *label, uint64_t nanos)
+{
+	if(nanos >= 10000000UL){
+		fprintf(out, " %s %.1fms", label, nanos / 1e6);
+	} else {
+		fprintf(out, " %s %.0fus", label, nanos / 1e3);
+	}
+}
+
+/**
+ * @brief Function name: histogramPrint
+ * Adds up the @param count histograms starting at @param histograms, @param stride bytes apart, and prints
+ * the number of values, the mean, p50, p90, p99, p99.9 and the maximum to @param out.
+ *
+ * @param out - FILE* to print to.
+ * @param name - the name printed in front of the values.
+ * @param histograms - latencyHistogram* to the first histogram.
+ * @param count - the number of histograms.
+ * @param stride - the number of bytes between two histograms.
+ */
+void histogramPrint(FILE *out, const char *name, const latencyHistogram *histograms, int count, size_t stride)
+{
+	static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+	static const char *labels[] = { "p50", "p90", "p99", "p99.9" };
+	uint64_t *counts = calloc(HISTOGRAM_BUCKETS, sizeof(uint64_t));
+	if(counts == NULL){
+		return;
+	}
+	uint64_t total = 0, sum = 0, max = 0;
+	for(int i = 0; i < count; i++){
+		const latencyHistogram *histogram = (const latencyHistogram*)((const char*)histograms + i * stride);
+		for(int b = 0; b < HISTOGRAM_BUCKETS; b++){
+			uint64_t bucket = atomic_load_explicit(&histogram->counts[b], memory_order_relaxed);
+			counts[b] += bucket;
+			total += bucket;
+		}
+		sum += atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+		uint64_t histogramMax = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+		if(histogramMax > max){
+			max = histogramMax;
+		}
+	}
+
+	fprintf(out, "%-13s n=%-8lu", name, (unsigned long)total);
+	if(total > 0){
+		printMicros(out, "mean", sum / total);
+		int bucket = 0;
+		uint64_t seen = 0;
+		for(int p = 0; p < 4; p++){
+			uint64_t rank = (uint64_t)(percentiles[p] / 100.0 * total + 0.5);
+			if(rank < 1){
+				rank = 1;
+			}
+			while(bucket < HISTOGRAM_BUCKETS - 1 && seen + counts[bucket] < rank){
+				seen += counts[bucket];
+				bucket++;
+			}
+			uint64_t value = bucketValue(bucket);
+			printMicros(out, labels[p], value < max ? value : max);
+		}
+		printMicros(out, "max", max);
+	}
+	fprintf(out, "\n");
+	free(counts);
+}
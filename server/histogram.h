@@ -0,0 +1,97 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+/**
+ * @file histogram.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the lock-free latency histograms used to time the phases of every connection
+ * (accept, handshake, request read, first byte and last byte of the response).
+ * See files histogram.c and reactor.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+//! the number of sub-buckets per power of two, values are recorded with a precision of 1/32 (about 3%).
+#define HISTOGRAM_SUB_BUCKET_BITS 5
+
+//! the number of sub-buckets per power of two.
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+
+//! the number of buckets, covering values (in nanoseconds) up to 2^40 (about 18 minutes).
+#define HISTOGRAM_BUCKETS ((40 - HISTOGRAM_SUB_BUCKET_BITS) * HISTOGRAM_SUB_BUCKETS)
+
+//! The phases of a connection that are timed.
+typedef enum connectionPhase
+{
+	PHASE_ACCEPT,     //!< from accepting the socket until a worker adopted it.
+	PHASE_HANDSHAKE,  //!< from adopting the socket until the ssl handshake completed.
+	PHASE_REQUEST,    //!< from the completed handshake until the whole request header was read.
+	PHASE_FIRST_BYTE, //!< from the complete request until the first byte of the response was written.
+	PHASE_LAST_BYTE,  //!< from the complete request until the last byte of the response was written.
+	PHASE_COUNT
+} connectionPhase;
+
+/**
+ * @brief A log-linear (HDR style) histogram of latencies in nanoseconds.
+ * Each histogram is written by a single worker without locking, readers add up the histograms of every worker.
+ */
+typedef struct latencyHistogram
+{
+	//! the number of values recorded per bucket.
+	atomic_ulong counts[HISTOGRAM_BUCKETS];
+	//! the number of values recorded.
+	atomic_ulong total;
+	//! the sum of the values recorded.
+	atomic_ulong sum;
+	//! the largest value recorded.
+	atomic_ulong max;
+} latencyHistogram;
+
+//! the names of the phases, indexed by connectionPhase.
+extern const char *phaseNames[PHASE_COUNT];
+
+/**
+ * @brief Function name: monotonicNanos
+ * Returns the current time of the monotonic clock in nanoseconds.
+ *
+ * @return uint64_t - the time in nanoseconds.
+ */
+static inline uint64_t monotonicNanos(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/**
+ * @brief Function name: histogramRecord
+ * Records the latency @param nanos in the histogram given by @param histogram.
+ * Must only be called by the thread owning the histogram.
+ *
+ * @param histogram - latencyHistogram* to the histogram.
+ * @param nanos - the latency in nanoseconds.
+ */
+void histogramRecord(latencyHistogram *histogram, uint64_t nanos);
+
+/**
+ * @brief Function name: histogramPrint
+ * Adds up the @param count histograms starting at @param histograms, @param stride bytes apart, and prints
+ * the number of values, the mean, p50, p90, p99, p99.9 and the maximum to @param out.
+ *
+ * @param out - FILE* to print to.
+ * @param name - the name printed in front of the values.
+ * @param histograms - latencyHistogram* to the first histogram.
+ * @param count - the number of histograms.
+ * @param stride - the number of bytes between two histograms.
+ */
+void histogramPrint(FILE *out, const char *name, const latencyHistogram *histograms, int count, size_t stride);
+
+#endif
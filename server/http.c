@@ -0,0 +1,602 @@
+/**
+ * @file http.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  HTTP request parser implementation file.
+ * This file contains the resumable state machine parsing the request line and header fields of a request.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "http.h"
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+/**
+ * @brief Function name: isTokenChar
+ * Returns whether @param c may appear in a method or a header field name (a "tchar" of RFC 7230).
+ *
+ * @param c - the character.
+ * @return int - 1 if the character is a token character, 0 otherwise.
+ */
+static int isTokenChar(unsigned char c)
+{
+	if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')){
+		return 1;
+	}
+	return c != '\0' && strchr("!#$%&'*+-.^_`|~", c) != NULL;
+}
+
+/**
+ * @brief Function name: httpRequestInit
+ * Prepares the request given by @param request to parse a new request from the start of the buffer.
+ *
+ * @param request - httpRequest* to the request.
+ */
+void httpRequestInit(httpRequest *request)
+{
+	request->state = HTTP_METHOD;
+	request->position = 0;
+	request->tokenStart = 0;
+	request->valueEnd = 0;
+	request->afterLine = HTTP_HEADER_START;
+	request->method.data = request->target.data = request->version.data = NULL;
+	request->method.length = request->target.length = request->version.length = 0;
+	request->minorVersion = 0;
+	request->headerCount = 0;
+	request->length = 0;
+}
+
+/**
+ * @brief Function name: httpParse
+ * Resumes parsing the request given by @param request over the bytes of @param buffer it has not seen yet.
+ * The buffer must hold the bytes parsed before at the same place, more bytes may have been appended since the last call.
+ *
+ * @param request - httpRequest* to the request.
+ * @param buffer - the bytes received from the client.
+ * @param length - the number of bytes in the buffer.
+ * @param limit - the largest request header accepted, HTTP_TOO_LARGE is returned once it is reached.
+ * @return httpParseResult - whether the request is complete, incomplete, malformed or too large.
+ */
+httpParseResult httpParse(httpRequest *request, const char *buffer, size_t length, size_t limit)
+{
+	if(request->state == HTTP_DONE){
+		return HTTP_COMPLETE;
+	}
+	if(request->state == HTTP_ERROR){
+		return HTTP_INVALID;
+	}
+	if(length > limit){
+		length = limit;
+	}
+	size_t i = request->position;
+	for(; i < length; i++){
+		unsigned char c = buffer[i];
+		switch(request->state){
+			case HTTP_METHOD:
+				if(c == ' ' && i > request->tokenStart){
+					request->method.data = buffer + request->tokenStart;
+					request->method.length = i - request->tokenStart;
+					request->tokenStart = i + 1;
+					request->state = HTTP_TARGET;
+				} else if((c == '\r' || c == '\n') && i == request->tokenStart){
+					request->tokenStart = i + 1; // empty lines in front of a request are ignored
+				} else if(!isTokenChar(c)){
+					goto invalid;
+				} else if(i - request->tokenStart >= HTTP_MAX_METHOD){
+					goto tooLarge;
+				}
+				break;
+
+			case HTTP_TARGET:
+				if(c == ' ' && i > request->tokenStart){
+					request->target.data = buffer + request->tokenStart;
+					request->target.length = i - request->tokenStart;
+					request->tokenStart = i + 1;
+					request->state = HTTP_VERSION;
+				} else if(c <= ' ' || c == 0x7f){
+					goto invalid;
+				} else if(i - request->tokenStart >= HTTP_MAX_TARGET){
+					goto tooLarge;
+				}
+				break;
+
+			case HTTP_VERSION:
+				if(c == '\r' || c == '\n'){
+					request->version.data = buffer + request->tokenStart;
+					request->version.length = i - request->tokenStart;
+					if(request->version.length != 8 || strncmp(request->version.data, "HTTP/1.", 7) != 0 ||
+					   request->version.data[7] < '0' || request->version.data[7] > '9'){
+						goto invalid;
+					}
+					request->minorVersion = request->version.data[7] - '0';
+					request->afterLine = HTTP_HEADER_START;
+					request->state = c == '\r' ? HTTP_LINE_END : HTTP_HEADER_START;
+				} else if(i - request->tokenStart >= 8){
+					goto invalid;
+				}
+				break;
+
+			case HTTP_LINE_END:
+				if(c != '\n'){
+					goto invalid;
+				}
+				request->state = request->afterLine;
+				break;
+
+			case HTTP_HEADER_START:
+				if(c == '\r'){
+					request->state = HTTP_END;
+				} else if(c == '\n'){
+					goto complete;
+				} else if(!isTokenChar(c)){
+					goto invalid; // also rejects folded (obsolete) header lines starting with white space
+				} else if(request->headerCount == HTTP_MAX_HEADERS){
+					goto tooLarge;
+				} else {
+					request->tokenStart = i;
+					request->state = HTTP_HEADER_NAME;
+				}
+				break;
+
+			case HTTP_HEADER_NAME:
+				if(c == ':'){
+					httpHeader *header = &request->headers[request->headerCount];
+					header->name.data = buffer + request->tokenStart;
+					header->name.length = i - request->tokenStart;
+					request->state = HTTP_HEADER_SPACE;
+				} else if(!isTokenChar(c)){
+					goto invalid;
+				}
+				break;
+
+			case HTTP_HEADER_SPACE:
+				if(c == ' ' || c == '\t'){
+					break;
+				}
+				request->tokenStart = i;
+				request->valueEnd = i;
+				request->state = HTTP_HEADER_VALUE;
+				// fall through - c is the first character of the value
+
+			case HTTP_HEADER_VALUE:
+				if(c == '\r' || c == '\n'){
+					httpHeader *header = &request->headers[request->headerCount++];
+					header->value.data = buffer + request->tokenStart;
+					header->value.length = request->valueEnd - request->tokenStart;
+					request->afterLine = HTTP_HEADER_START;
+					request->state = c == '\r' ? HTTP_LINE_END : HTTP_HEADER_START;
+				} else if((c < ' ' && c != '\t') || c == 0x7f){
+					goto invalid;
+				} else if(c != ' ' && c != '\t'){
+					request->valueEnd = i + 1;
+				}
+				break;
+
+			case HTTP_END:
+				if(c != '\n'){
+					goto invalid;
+				}
+				goto complete;
+
+			default:
+				goto invalid;
+		}
+	}
+	request->position = i;
+	if(i >= limit){
+		goto tooLarge;
+	}
+	return HTTP_INCOMPLETE;
+
+complete:
+	request->position = request->length = i + 1;
+	request->state = HTTP_DONE;
+	return HTTP_COMPLETE;
+
+invalid:
+	request->position = i;
+	request->state = HTTP_ERROR;
+	return HTTP_INVALID;
+
+tooLarge:
+	request->position = i;
+	request->state = HTTP_ERROR;
+	return HTTP_TOO_LARGE;
+}
+
+/**
+ * @brief Function name: httpFindHeader
+ * Finds the header field with the name @param name (compared case-insensitively) in the request given by @param request.
+ *
+ * @param request - const httpRequest* to the complete request.
+ * @param name - the name of the field.
+ * @return const stringView* - the value of the first field with the name, NULL if the request does not have it.
+ */
+const stringView *httpFindHeader(const httpRequest *request, const char *name)
+{
+	size_t nameLength = strlen(name);
+	for(int i = 0; i < request->headerCount; i++){
+		const httpHeader *header = &request->headers[i];
+		if(header->name.length == nameLength && strncasecmp(header->name.data, name, nameLength) == 0){
+			return &header->value;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Function name: httpKeepAlive
+ * Determines whether the connection stays open after answering the request given by @param request.
+ * HTTP/1.1 connections are persistent unless the client sent "Connection: close",
+ * HTTP/1.0 connections are closed unless the client sent "Connection: keep-alive".
+ *
+ * @param request - const httpRequest* to the complete request.
+ * @return int - 1 if the connection stays open, 0 if it is closed after the response.
+ */
+int httpKeepAlive(const httpRequest *request)
+{
+	int persistent = request->minorVersion >= 1;
+	const stringView *connection = httpFindHeader(request, "Connection");
+	if(connection == NULL){
+		return persistent;
+	}
+	// the value is a comma separated list of options
+	const char *option = connection->data, *end = connection->data + connection->length;
+	while(option < end){
+		while(option < end && (*option == ' ' || *option == '\t' || *option == ',')){
+			option++;
+		}
+		const char *optionEnd = option;
+		while(optionEnd < end && *optionEnd != ',' && *optionEnd != ' ' && *optionEnd != '\t'){
+			optionEnd++;
+		}
+		size_t optionLength = optionEnd - option;
+		if(optionLength == 5 && strncasecmp(option, "close", 5) == 0){
+			return 0;
+		}
+		if(optionLength == 10 && strncasecmp(option, "keep-alive", 10) == 0){
+			persistent = 1;
+		}
+		option = optionEnd;
+	}
+	return persistent;
+}
+
+/**
+ * @brief Function name: hexValue
+ * Returns the value of the hexadecimal digit @param c.
+ *
+ * @param c - the character.
+ * @return int - the value of the digit, -1 if the character is not a hexadecimal digit.
+ */
+static int hexValue(char c)
+{
+	if(c >= '0' && c <= '9'){
+		return c - '0';
+	}
+	if(c >= 'a' && c <= 'f'){
+		return c - 'a' + 10;
+	}
+	if(c >= 'A' && c <= 'F'){
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+/**
+ * @brief Function name: httpTargetPath
+ * Copies the path of the target of the request given by @param request to @param path, without the query string and with
+ * percent-encoded characters decoded. Paths that do not start with '/', contain ".." segments or encode a NUL are rejected.
+ *
+ * @param request - const httpRequest* to the complete request.
+ * @param path - the buffer receiving the NUL terminated path.
+ * @param size - the size of the buffer.
+ * @return int - 0 on success, -1 if the path is invalid or does not fit the buffer.
+ */
+int httpTargetPath(const httpRequest *request, char *path, size_t size)
+{
+	const char *target = request->target.data, *end = target + request->target.length;
+	if(target == NULL || size == 0){
+		return -1;
+	}
+	// absolute form (http://host/path), the host is ignored
+	size_t scheme = request->target.length > 7 && strncasecmp(target, "http://", 7) == 0 ? 7 :
+		request->target.length > 8 && strncasecmp(target, "https://", 8) == 0 ? 8 : 0;
+	if(scheme > 0){
+		target = memchr(target + scheme, '/', end - target - scheme);
+		if(target == NULL){
+			target = "/";
+			end = target + 1;
+		}
+	}
+	if(*target != '/'){
+		return -1;
+	}
+	size_t length = 0;
+	for(; target < end && *target != '?' && *target != '#'; target++){
+		char c = *target;
+		if(c == '%'){
+			int high = end - target > 2 ? hexValue(target[1]) : -1;
+			int low = high >= 0 ? hexValue(target[2]) : -1;
+			if(low < 0 || (high == 0 && low == 0)){
+				return -1;
+			}
+			c = (char)(high * 16 + low);
+			target += 2;
+		}
+		if(length + 1 >= size){
+			return -1;
+		}
+		path[length++] = c;
+	}
+	path[length] = '\0';
+	// a ".." segment would leave the server root
+	for(const char *dots = strstr(path, ".."); dots != NULL; dots = strstr(dots + 1, "..")){
+		if(dots[-1] == '/' && (dots[2] == '/' || dots[2] == '\0')){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Function name: parseDigits
+ * Parses the @param count decimal digits at @param text.
+ *
+ * @param text - the digits.
+ * @param count - the number of digits.
+ * @return int - the value of the digits, -1 if one of the characters is not a digit.
+ */
+static int parseDigits(const char *text, int count)
+{
+	int value = 0;
+	for(int i = 0; i < count; i++){
+		if(text[i] < '0' || text[i] > '9'){
+			return -1;
+		}
+		value = value * 10 + text[i] - '0';
+	}
+	return value;
+}
+
+/**
+ * @brief Function name: httpParseDate
+ * Parses the HTTP date (IMF-fixdate, for example "Sun, 06 Nov 1994 08:49:37 GMT") given by @param value.
+ *
+ * @param value - const stringView* to the date.
+ * @return time_t - the time, -1 if the value is not a valid date.
+ */
+time_t httpParseDate(const stringView *value)
+{
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	const char *date = value->data;
+	// the obsolete RFC 850 and asctime formats are not accepted, the condition is then ignored
+	if(value->length != 29 || date[3] != ',' || date[4] != ' ' || date[7] != ' ' || date[11] != ' ' ||
+	   date[16] != ' ' || date[19] != ':' || date[22] != ':' || strncmp(date + 25, " GMT", 4) != 0){
+		return -1;
+	}
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_mday = parseDigits(date + 5, 2);
+	tm.tm_year = parseDigits(date + 12, 4) - 1900;
+	tm.tm_hour = parseDigits(date + 17, 2);
+	tm.tm_min = parseDigits(date + 20, 2);
+	tm.tm_sec = parseDigits(date + 23, 2);
+	tm.tm_mon = -1;
+	for(int i = 0; i < 12; i++){
+		if(strncmp(date + 8, months + i * 3, 3) == 0){
+			tm.tm_mon = i;
+		}
+	}
+	if(tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_year < 70 || tm.tm_mon < 0 || tm.tm_hour < 0 || tm.tm_hour > 23 ||
+	   tm.tm_min < 0 || tm.tm_min > 59 || tm.tm_sec < 0 || tm.tm_sec > 60){
+		return -1;
+	}
+	return timegm(&tm);
+}
+
+/**
+ * @brief Function name: httpEtagMatches
+ * Determines whether the entity tag @param etag is in the list of entity tags @param list (the value of an If-None-Match
+ * field). The comparison is weak: "W/" prefixes are ignored, the list "*" matches any entity tag.
+ *
+ * @param list - const stringView* to the comma separated list of entity tags.
+ * @param etag - the entity tag, including the quotes.
+ * @return int - 1 if the entity tag is in the list, 0 otherwise.
+ */
+int httpEtagMatches(const stringView *list, const char *etag)
+{
+	size_t etagLength = strlen(etag);
+	const char *tag = list->data, *end = list->data + list->length;
+	if(list->length == 1 && *tag == '*'){
+		return 1;
+	}
+	while(tag < end){
+		while(tag < end && (*tag == ' ' || *tag == '\t' || *tag == ',')){
+			tag++;
+		}
+		if(end - tag >= 2 && tag[0] == 'W' && tag[1] == '/'){
+			tag += 2;
+		}
+		// an entity tag is quoted and may contain commas
+		const char *tagEnd = tag;
+		if(tagEnd < end && *tagEnd == '"'){
+			const char *quote = memchr(tagEnd + 1, '"', end - tagEnd - 1);
+			tagEnd = quote != NULL ? quote + 1 : end;
+		}
+		while(tagEnd < end && *tagEnd != ','){
+			tagEnd++;
+		}
+		size_t tagLength = tagEnd - tag;
+		while(tagLength > 0 && (tag[tagLength - 1] == ' ' || tag[tagLength - 1] == '\t')){
+			tagLength--;
+		}
+		if(tagLength == etagLength && memcmp(tag, etag, etagLength) == 0){
+			return 1;
+		}
+		tag = tagEnd;
+	}
+	return 0;
+}
+
+/**
+ * @brief Function name: parseOffset
+ * Parses the decimal offset at @param text, advancing @param text past its digits.
+ *
+ * @param text - const char** to the digits.
+ * @param end - the end of the text.
+ * @return off_t - the offset, -1 if there are no digits or the offset overflows.
+ */
+static off_t parseOffset(const char **text, const char *end)
+{
+	const char *digit = *text;
+	off_t value = 0;
+	for(; digit < end && *digit >= '0' && *digit <= '9'; digit++){
+		if(value > (INT64_MAX - 9) / 10){
+			return -1;
+		}
+		value = value * 10 + *digit - '0';
+	}
+	if(digit == *text){
+		return -1;
+	}
+	*text = digit;
+	return value;
+}
+
+/**
+ * @brief Function name: httpParseRange
+ * Parses the value of a Range field given by @param value ("bytes=0-499,1000-,-500") for a file of @param size bytes.
+ * Ranges starting after the end of the file are dropped, ranges ending after it are shortened.
+ *
+ * @param value - const stringView* to the value of the field.
+ * @param size - the size of the file.
+ * @param ranges - the array receiving the satisfiable ranges, HTTP_MAX_RANGES entries.
+ * @return int - the number of satisfiable ranges, 0 if none is satisfiable,
+ * -1 if the value is malformed or has more than HTTP_MAX_RANGES ranges (the field is then ignored).
+ */
+int httpParseRange(const stringView *value, off_t size, httpRange *ranges)
+{
+	const char *spec = value->data, *end = value->data + value->length;
+	if(value->length < 6 || strncasecmp(spec, "bytes=", 6) != 0){
+		return -1;
+	}
+	spec += 6;
+	int count = 0, specs = 0;
+	while(spec < end){
+		while(spec < end && (*spec == ' ' || *spec == '\t')){
+			spec++;
+		}
+		if(spec < end && *spec == ','){
+			spec++;
+			continue;
+		}
+		if(spec == end){
+			break;
+		}
+		if(++specs > HTTP_MAX_RANGES){
+			return -1;
+		}
+		off_t first, last;
+		if(*spec == '-'){
+			// suffix range, the last bytes of the file
+			spec++;
+			off_t suffix = parseOffset(&spec, end);
+			if(suffix < 0){
+				return -1;
+			}
+			first = suffix < size ? size - suffix : 0;
+			last = size - 1;
+			if(suffix == 0){
+				first = size; // an empty suffix is not satisfiable
+			}
+		} else {
+			first = parseOffset(&spec, end);
+			if(first < 0 || spec == end || *spec != '-'){
+				return -1;
+			}
+			spec++;
+			if(spec < end && *spec >= '0' && *spec <= '9'){
+				last = parseOffset(&spec, end);
+				if(last < first){
+					return -1;
+				}
+			} else {
+				last = size - 1;
+			}
+			if(last >= size){
+				last = size - 1;
+			}
+		}
+		while(spec < end && (*spec == ' ' || *spec == '\t')){
+			spec++;
+		}
+		if(spec < end && *spec != ','){
+			return -1;
+		}
+		if(first < size){
+			ranges[count].first = first;
+			ranges[count].last = last;
+			count++;
+		}
+	}
+	return specs > 0 ? count : -1;
+}
+
+/**
+ * @brief Function name: httpAcceptsEncoding
+ * Determines whether the client accepts the content coding @param coding, according to the Accept-Encoding field of the
+ * request given by @param request. A coding (or "*") listed with "q=0" is refused.
+ *
+ * @param request - const httpRequest* to the complete request.
+ * @param coding - the content coding, for example "gzip".
+ * @return int - 1 if the coding is accepted, 0 otherwise.
+ */
+int httpAcceptsEncoding(const httpRequest *request, const char *coding)
+{
+	const stringView *accept = httpFindHeader(request, "Accept-Encoding");
+	if(accept == NULL){
+		return 0;
+	}
+	size_t codingLength = strlen(coding);
+	int wildcard = 0;
+	const char *item = accept->data, *end = accept->data + accept->length;
+	while(item < end){
+		while(item < end && (*item == ' ' || *item == '\t' || *item == ',')){
+			item++;
+		}
+		const char *itemEnd = item;
+		while(itemEnd < end && *itemEnd != ','){
+			itemEnd++;
+		}
+		const char *name = item, *nameEnd = item;
+		while(nameEnd < itemEnd && *nameEnd != ';' && *nameEnd != ' ' && *nameEnd != '\t'){
+			nameEnd++;
+		}
+		// "q=0", "q=0.0" ... refuse the coding, any other weight accepts it
+		int refused = 0;
+		const char *weight = memchr(nameEnd, '=', itemEnd - nameEnd);
+		if(weight != NULL && weight > nameEnd && (weight[-1] == 'q' || weight[-1] == 'Q')){
+			refused = 1;
+			for(const char *digit = weight + 1; digit < itemEnd && *digit != ' ' && *digit != '\t'; digit++){
+				if(*digit >= '1' && *digit <= '9'){
+					refused = 0;
+				}
+			}
+		}
+		size_t nameLength = nameEnd - name;
+		if(nameLength == codingLength && strncasecmp(name, coding, codingLength) == 0){
+			return !refused; // the coding itself overrides the wildcard
+		}
+		if(nameLength == 1 && *name == '*'){
+			wildcard = !refused;
+		}
+		item = itemEnd;
+	}
+	return wildcard > 0;
+}
@@ -0,0 +1,213 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+/**
+ * @file http.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the incremental HTTP request parser. The parser is a state machine that is resumed
+ * whenever more bytes of the request arrived, it does not copy or allocate: the method, target, version and headers are
+ * views into the buffer of the connection.
+ * See files http.c and reactor.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+//! the maximum number of header fields accepted in a request.
+#define HTTP_MAX_HEADERS 64
+
+//! the longest request target accepted.
+#define HTTP_MAX_TARGET 2048
+
+//! the longest method accepted.
+#define HTTP_MAX_METHOD 16
+
+//! the maximum number of ranges accepted in a Range header field, requests for more ranges are answered with the whole file.
+#define HTTP_MAX_RANGES 16
+
+//! A view of a string in the buffer of a connection, not NUL terminated.
+typedef struct stringView
+{
+	//! the first character.
+	const char *data;
+	//! the number of characters.
+	size_t length;
+} stringView;
+
+//! A header field of a request.
+typedef struct httpHeader
+{
+	//! the name of the field.
+	stringView name;
+	//! the value of the field, without the surrounding white space.
+	stringView value;
+} httpHeader;
+
+//! A byte range of a file, both offsets inclusive.
+typedef struct httpRange
+{
+	//! the offset of the first byte.
+	off_t first;
+	//! the offset of the last byte.
+	off_t last;
+} httpRange;
+
+//! The states of the request parser.
+typedef enum httpParseState
+{
+	HTTP_METHOD,        //!< reading the method of the request line.
+	HTTP_TARGET,        //!< reading the request target.
+	HTTP_VERSION,       //!< reading the protocol version.
+	HTTP_LINE_END,      //!< a '\r' ended a line, the '\n' is expected.
+	HTTP_HEADER_START,  //!< at the start of a header line or of the empty line ending the request.
+	HTTP_HEADER_NAME,   //!< reading the name of a header field.
+	HTTP_HEADER_SPACE,  //!< skipping the white space in front of a header value.
+	HTTP_HEADER_VALUE,  //!< reading the value of a header field.
+	HTTP_END,           //!< a '\r' started the empty line, the final '\n' is expected.
+	HTTP_DONE,          //!< the request header is complete.
+	HTTP_ERROR          //!< the request is malformed or too large.
+} httpParseState;
+
+//! The results of resuming the parser.
+typedef enum httpParseResult
+{
+	HTTP_INCOMPLETE, //!< every byte received was parsed, the request header is not complete yet.
+	HTTP_COMPLETE,   //!< the request header is complete, bytes following it belong to the next request.
+	HTTP_INVALID,    //!< the request is malformed.
+	HTTP_TOO_LARGE   //!< the request line, a header field or the number of header fields exceeds its limit.
+} httpParseResult;
+
+//! A request being parsed, the views point into the buffer passed to httpParse.
+typedef struct httpRequest
+{
+	//! the state of the parser.
+	httpParseState state;
+	//! the number of bytes of the buffer parsed so far.
+	size_t position;
+	//! the offset of the token being read.
+	size_t tokenStart;
+	//! the offset after the last non white space character of the header value being read.
+	size_t valueEnd;
+	//! the state to continue with after the '\n' of a line ending with "\r\n".
+	httpParseState afterLine;
+	//! the method, for example "GET".
+	stringView method;
+	//! the request target, for example "/index.html".
+	stringView target;
+	//! the protocol version, for example "HTTP/1.1".
+	stringView version;
+	//! the minor protocol version (HTTP/1.x).
+	int minorVersion;
+	//! the header fields.
+	httpHeader headers[HTTP_MAX_HEADERS];
+	//! the number of header fields.
+	int headerCount;
+	//! the length of the complete request header (including the empty line), set once it is complete.
+	size_t length;
+} httpRequest;
+
+/**
+ * @brief Function name: httpRequestInit
+ * Prepares the request given by @param request to parse a new request from the start of the buffer.
+ *
+ * @param request - httpRequest* to the request.
+ */
+void httpRequestInit(httpRequest *request);
+
+/**
+ * @brief Function name: httpParse
+ * Resumes parsing the request given by @param request over the bytes of @param buffer it has not seen yet.
+ * The buffer must hold the bytes parsed before at the same place, more bytes may have been appended since the last call.
+ *
+ * @param request - httpRequest* to the request.
+ * @param buffer - the bytes received from the client.
+ * @param length - the number of bytes in the buffer.
+ * @param limit - the largest request header accepted, HTTP_TOO_LARGE is returned once it is reached.
+ * @return httpParseResult - whether the request is complete, incomplete, malformed or too large.
+ */
+httpParseResult httpParse(httpRequest *request, const char *buffer, size_t length, size_t limit);
+
+/**
+ * @brief Function name: httpFindHeader
+ * Finds the header field with the name @param name (compared case-insensitively) in the request given by @param request.
+ *
+ * @param request - const httpRequest* to the complete request.
+ * @param name - the name of the field.
+ * @return const stringView* - the value of the first field with the name, NULL if the request does not have it.
+ */
+const stringView *httpFindHeader(const httpRequest *request, const char *name);
+
+/**
+ * @brief Function name: httpKeepAlive
+ * Determines whether the connection stays open after answering the request given by @param request.
+ * HTTP/1.1 connections are persistent unless the client sent "Connection: close",
+ * HTTP/1.0 connections are closed unless the client sent "Connection: keep-alive".
+ *
+ * @param request - const httpRequest* to the complete request.
+ * @return int - 1 if the connection stays open, 0 if it is closed after the response.
+ */
+int httpKeepAlive(const httpRequest *request);
+
+/**
+ * @brief Function name: httpTargetPath
+ * Copies the path of the target of the request given by @param request to @param path, without the query string and with
+ * percent-encoded characters decoded. Paths that do not start with '/', contain ".." segments or encode a NUL are rejected.
+ *
+ * @param request - const httpRequest* to the complete request.
+ * @param path - the buffer receiving the NUL terminated path.
+ * @param size - the size of the buffer.
+ * @return int - 0 on success, -1 if the path is invalid or does not fit the buffer.
+ */
+int httpTargetPath(const httpRequest *request, char *path, size_t size);
+
+/**
+ * @brief Function name: httpParseDate
+ * Parses the HTTP date (IMF-fixdate, for example "Sun, 06 Nov 1994 08:49:37 GMT") given by @param value.
+ *
+ * @param value - const stringView* to the date.
+ * @return time_t - the time, -1 if the value is not a valid date.
+ */
+time_t httpParseDate(const stringView *value);
+
+/**
+ * @brief Function name: httpEtagMatches
+ * Determines whether the entity tag @param etag is in the list of entity tags @param list (the value of an If-None-Match
+ * field). The comparison is weak: "W/" prefixes are ignored, the list "*" matches any entity tag.
+ *
+ * @param list - const stringView* to the comma separated list of entity tags.
+ * @param etag - the entity tag, including the quotes.
+ * @return int - 1 if the entity tag is in the list, 0 otherwise.
+ */
+int httpEtagMatches(const stringView *list, const char *etag);
+
+/**
+ * @brief Function name: httpParseRange
+ * Parses the value of a Range field given by @param value ("bytes=0-499,1000-,-500") for a file of @param size bytes.
+ * Ranges starting after the end of the file are dropped, ranges ending after it are shortened.
+ *
+ * @param value - const stringView* to the value of the field.
+ * @param size - the size of the file.
+ * @param ranges - the array receiving the satisfiable ranges, HTTP_MAX_RANGES entries.
+ * @return int - the number of satisfiable ranges, 0 if none is satisfiable,
+ * -1 if the value is malformed or has more than HTTP_MAX_RANGES ranges (the field is then ignored).
+ */
+int httpParseRange(const stringView *value, off_t size, httpRange *ranges);
+
+/**
+ * @brief Function name: httpAcceptsEncoding
+ * Determines whether the client accepts the content coding @param coding, according to the Accept-Encoding field of the
+ * request given by @param request. A coding (or "*") listed with "q=0" is refused.
+ *
+ * @param request - const httpRequest* to the complete request.
+ * @param coding - the content coding, for example "gzip".
+ * @return int - 1 if the coding is accepted, 0 otherwise.
+ */
+int httpAcceptsEncoding(const httpRequest *request, const char *coding);
+
+#endif
@@ -0,0 +1,322 @@
+/**
+ * @file listener.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Listener manager implementation file.
+ * This file contains the binding of the listening sockets (backlog, TCP_DEFER_ACCEPT, TCP_FASTOPEN, SO_REUSEPORT and the
+ * fallback to the next free port) and the accept threads serving them, which open a failed socket again on its address.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "server.h"
+#include <errno.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+//! the listening sockets, options.perAddress consecutive ones per address.
+static listener *sockets = NULL;
+
+//! the number of listening sockets.
+static int socketCount = 0;
+
+//! how the sockets are bound, kept to open a failed socket again.
+static listenOptions bindOptions;
+
+//! set by listenersStop, a failed socket is then no longer opened again.
+static atomic_int stopping = 0;
+
+/**
+ * @brief Function name: formatAddress
+ * Writes the numeric address and port given by @param address to @param buffer, as "host:port" or "[ipv6]:port".
+ *
+ * @param address - const struct sockaddr_storage* to the address.
+ * @param length - the length of the address.
+ * @param buffer - char* to the buffer receiving the address.
+ * @param size - the size of the buffer in bytes.
+ */
+static void formatAddress(const struct sockaddr_storage *address, socklen_t length, char *buffer, size_t size)
+{
+	char host[NI_MAXHOST], port[NI_MAXSERV];
+	if(getnameinfo((const struct sockaddr*)address, length, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) != 0){
+		snprintf(buffer, size, "?");
+		return;
+	}
+	snprintf(buffer, size, address->ss_family == AF_INET6 ? "[%s]:%s" : "%s:%s", host, port);
+}
+
+/**
+ * @brief Function name: bindAddress
+ * Creates a non-blocking TCP socket listening on the address given by @param address, set up as given by bindOptions.
+ * TCP_DEFER_ACCEPT and TCP_FASTOPEN are only asked for, a kernel without them still gets a working socket.
+ *
+ * @param address - const struct sockaddr* to the address to bind to.
+ * @param length - the length of the address.
+ * @return int - the listening socket, -1 if it could not be created or bound (errno tells why).
+ */
+static int bindAddress(const struct sockaddr *address, socklen_t length)
+{
+	int fd = socket(address->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd < 0){
+		return -1;
+	}
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if(bindOptions.perAddress > 1 && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0){
+		logError("SO_REUSEPORT is not supported: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if(bind(fd, address, length) < 0){
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	// the clients of a TLS server speak first, the kernel only wakes the accept thread once the client hello arrived
+	if(bindOptions.deferAccept > 0 &&
+		setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &bindOptions.deferAccept, sizeof(bindOptions.deferAccept)) < 0){
+		logWarning("TCP_DEFER_ACCEPT is not supported: %s", strerror(errno));
+	}
+	if(bindOptions.fastOpen > 0 &&
+		setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &bindOptions.fastOpen, sizeof(bindOptions.fastOpen)) < 0){
+		logWarning("TCP_FASTOPEN is not supported: %s", strerror(errno));
+	}
+	if(listen(fd, bindOptions.backlog) < 0){
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * @brief Function name: parseAddress
+ * Splits @param address, given as "port", "hostname:port" or "[ipv6]:port", into its host and port.
+ * The host is empty (every interface) if only a port, or "*" as host, is given.
+ *
+ * @param address - the address to split.
+ * @param host - char* to the buffer receiving the host, STRING_SIZE bytes.
+ * @param port - const char** set to the port within @param address.
+ * @return int - 0 on success, -1 if the host is too long.
+ */
+static int parseAddress(const char *address, char *host, const char **port)
+{
+	const char *separator = strrchr(address, ':');
+	host[0] = '\0';
+	if(separator == NULL){
+		*port = address;
+		return 0;
+	}
+	const char *start = address, *end = separator;
+	if(*start == '[' && end > start && end[-1] == ']'){
+		start++;
+		end--;
+	}
+	if(end - start >= STRING_SIZE){
+		return -1;
+	}
+	memcpy(host, start, end - start);
+	host[end - start] = '\0';
+	if(strcmp(host, "*") == 0){
+		host[0] = '\0';
+	}
+	*port = separator + 1;
+	return 0;
+}
+
+/**
+ * @brief Function name: bindFallback
+ * Binds the listening socket given by @param self to the address it was given with. Should the port be taken (or not be
+ * permitted), the next LISTEN_FALLBACK_PORTS ports are tried in turn, every attempt is a single bind that fails at once.
+ *
+ * @param self - listener* to the socket, its address is read and its fd and bound address are set.
+ * @return int - 0 on success, -1 if no port could be bound.
+ */
+static int bindFallback(listener *self)
+{
+	char host[STRING_SIZE];
+	const char *port;
+	if(parseAddress(self->address, host, &port) < 0){
+		logError("the address %s is too long", self->address);
+		return -1;
+	}
+	struct addrinfo hints, *result;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	int error = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &result);
+	if(error != 0){
+		logError("could not resolve %s: %s", self->address, gai_strerror(error));
+		return -1;
+	}
+	self->fd = -1;
+	for(int offset = 0; offset <= LISTEN_FALLBACK_PORTS && self->fd < 0; offset++){
+		int retry = 0;
+		for(struct addrinfo *ai = result; ai != NULL; ai = ai->ai_next){
+			memcpy(&self->bound, ai->ai_addr, ai->ai_addrlen);
+			self->boundLength = ai->ai_addrlen;
+			in_port_t *boundPort = self->bound.ss_family == AF_INET6 ? &((struct sockaddr_in6*)&self->bound)->sin6_port :
+				&((struct sockaddr_in*)&self->bound)->sin_port;
+			if(ntohs(*boundPort) + offset > 65535){
+				break;
+			}
+			*boundPort = htons(ntohs(*boundPort) + offset);
+			self->fd = bindAddress((struct sockaddr*)&self->bound, self->boundLength);
+			if(self->fd >= 0){
+				break;
+			}
+			retry |= errno == EADDRINUSE || errno == EACCES;
+		}
+		if(!retry){
+			break; // any other error does not depend on the port
+		}
+	}
+	error = errno;
+	freeaddrinfo(result);
+	if(self->fd < 0){
+		logError("could not listen on %s or the %d ports above it: %s", self->address, LISTEN_FALLBACK_PORTS, strerror(error));
+		return -1;
+	}
+	// the port actually bound, also when port 0 let the kernel choose it
+	self->boundLength = sizeof(self->bound);
+	getsockname(self->fd, (struct sockaddr*)&self->bound, &self->boundLength);
+	return 0;
+}
+
+/**
+ * @brief Function name: listenerRun
+ * Intended use is as a multithreaded function. The accept thread of the listening socket given by @param listenerPtr.
+ * Runs the accept loop (see reactorRun) on the socket until listenersStop is called, should the socket fail it is opened
+ * again on the same address without restarting the server.
+ *
+ * @param listenerPtr - listener* to the listening socket to serve.
+ * @return void* - Returns NULL, since the intended use is as a POSIX threaded function
+ */
+static void *listenerRun(void *listenerPtr)
+{
+	listener *self = (listener*)listenerPtr;
+	if(self->core >= 0){
+		pinThread(self->core);
+	}
+	char name[NI_MAXHOST + NI_MAXSERV + 4];
+	formatAddress(&self->bound, self->boundLength, name, sizeof(name));
+	struct timespec pause = { 0, LISTEN_REOPEN_INTERVAL * 1000000L };
+	while(reactorRun(self->fd, self->worker) < 0 && !atomic_load(&stopping)){
+		logError("the listening socket on %s failed, opening it again", name);
+		close(self->fd);
+		self->fd = -1;
+		while(self->fd < 0 && !atomic_load(&stopping)){
+			nanosleep(&pause, NULL);
+			self->fd = bindAddress((struct sockaddr*)&self->bound, self->boundLength);
+		}
+		if(self->fd < 0){
+			break;
+		}
+		logInfo("listening on %s again", name);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Function name: listenersStart
+ * Binds options->perAddress listening sockets to every address in @param addresses and starts their accept threads.
+ * Should the port of an address be taken, the next LISTEN_FALLBACK_PORTS ports are tried.
+ *
+ * @param addresses - the addresses to listen on, "port", "hostname:port" or "[ipv6]:port".
+ * @param count - the number of addresses.
+ * @param options - const listenOptions* to how the sockets are bound.
+ * @return int - the number of listening sockets, -1 if an address could not be bound.
+ */
+int listenersStart(char **addresses, int count, const listenOptions *options)
+{
+	bindOptions = *options;
+	int perAddress = options->perAddress;
+	sockets = calloc(count * perAddress, sizeof(listener));
+	if(sockets == NULL){
+		return -1;
+	}
+	for(int a = 0; a < count; a++){
+		listener *first = &sockets[a * perAddress];
+		first->address = addresses[a];
+		if(bindFallback(first) < 0){
+			return -1;
+		}
+		char name[NI_MAXHOST + NI_MAXSERV + 4];
+		formatAddress(&first->bound, first->boundLength, name, sizeof(name));
+		logInfo("listening on %s (requested %s)%s", name, first->address, perAddress > 1 ? " with SO_REUSEPORT" : "");
+		// -j: the other sockets share the port, the kernel balances the new connections between them
+		for(int i = 1; i < perAddress; i++){
+			listener *self = &sockets[a * perAddress + i];
+			*self = *first;
+			self->fd = bindAddress((struct sockaddr*)&self->bound, self->boundLength);
+			if(self->fd < 0){
+				logError("could not open socket %d on %s: %s", i + 1, name, strerror(errno));
+				return -1;
+			}
+		}
+		// with -j socket i of every address shares core i with worker i
+		for(int i = 0; i < perAddress; i++){
+			sockets[a * perAddress + i].core = perAddress > 1 ? i : -1;
+			sockets[a * perAddress + i].worker = perAddress > 1 ? i % workerCount : -1;
+		}
+		socketCount += perAddress;
+	}
+	for(int i = 0; i < socketCount; i++){
+		if(pthread_create(&sockets[i].thread, NULL, listenerRun, &sockets[i]) != 0){
+			logError("could not create the accept thread of socket %d", i);
+			return -1;
+		}
+	}
+	return socketCount;
+}
+
+/**
+ * @brief Function name: listenersStop
+ * Stops the accept threads (see reactorStop), waits for them and closes the listening sockets, new clients are refused
+ * from then on while the accepted ones are still served.
+ */
+void listenersStop(void)
+{
+	atomic_store(&stopping, 1);
+	reactorStop();
+	for(int i = 0; i < socketCount; i++){
+		pthread_join(sockets[i].thread, NULL);
+		if(sockets[i].fd >= 0){
+			close(sockets[i].fd);
+		}
+	}
+	free(sockets);
+	sockets = NULL;
+	socketCount = 0;
+}
+
+/**
+ * @brief Function name: listenersPrint
+ * Prints the addresses the server listens on to @param out.
+ *
+ * @param out - FILE* to write the addresses to.
+ */
+void listenersPrint(FILE *out)
+{
+	if(socketCount == 0){
+		fprintf(out, "The server is not listening.\n");
+		return;
+	}
+	int perAddress = bindOptions.perAddress;
+	for(int i = 0; i < socketCount; i += perAddress){
+		char name[NI_MAXHOST + NI_MAXSERV + 4];
+		formatAddress(&sockets[i].bound, sockets[i].boundLength, name, sizeof(name));
+		fprintf(out, "Listening on %s (requested %s", name, sockets[i].address);
+		if(perAddress > 1){
+			fprintf(out, ", %d sockets", perAddress);
+		}
+		fprintf(out, ")\n");
+	}
+}
@@ -0,0 +1,97 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+/**
+ * @file listener.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the listener manager of the server. Every address given with -p is bound to one
+ * listening socket, or to -j sockets sharing the port (SO_REUSEPORT), each served by an accept thread of its own (see
+ * reactorRun). A port that is taken is replaced by one of the next LISTEN_FALLBACK_PORTS ports while binding, a socket
+ * that fails while the server runs is opened again on the same address.
+ * See files listener.c and reactor.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <netdb.h>
+
+//! the most addresses (-p) the server listens on.
+#define MAX_LISTEN_ADDRESSES 8
+
+//! the length of the pending connection queue of a listening socket, the kernel caps it at net.core.somaxconn.
+#define DEFAULT_LISTEN_BACKLOG 4096
+
+//! the seconds the kernel holds a new connection back until the client sends its first bytes (TCP_DEFER_ACCEPT), 0 disables it.
+#define DEFAULT_DEFER_ACCEPT 1
+
+//! the number of ports above a taken port that are tried while binding.
+#define LISTEN_FALLBACK_PORTS 50
+
+//! the number of milliseconds between two attempts to open a failed listening socket again.
+#define LISTEN_REOPEN_INTERVAL 100
+
+//! How the listening sockets are bound.
+typedef struct listenOptions
+{
+	//! the length of the pending connection queue.
+	int backlog;
+	//! the seconds of TCP_DEFER_ACCEPT, 0 to accept connections as soon as the handshake completed.
+	int deferAccept;
+	//! the length of the TCP_FASTOPEN queue, 0 to disable TCP fast open.
+	int fastOpen;
+	//! the number of sockets bound to every address (SO_REUSEPORT with more than one), each with its own core.
+	int perAddress;
+} listenOptions;
+
+//! A listening socket, served by its own accept thread.
+typedef struct listener
+{
+	//! the listening socket, -1 while it is being opened again.
+	int fd;
+	//! the address as given with -p ("port", "hostname:port" or "[ipv6]:port").
+	const char *address;
+	//! the address the socket is bound to, the port may differ from the requested one after a fallback.
+	struct sockaddr_storage bound;
+	//! the length of bound.
+	socklen_t boundLength;
+	//! the cpu core the accept thread is pinned to, -1 if it is not pinned.
+	int core;
+	//! the worker that receives the connections accepted on this socket first, -1 for round-robin.
+	int worker;
+	//! the accept thread of the socket.
+	pthread_t thread;
+} listener;
+
+/**
+ * @brief Function name: listenersStart
+ * Binds options->perAddress listening sockets to every address in @param addresses and starts their accept threads.
+ * Should the port of an address be taken, the next LISTEN_FALLBACK_PORTS ports are tried.
+ *
+ * @param addresses - the addresses to listen on, "port", "hostname:port" or "[ipv6]:port".
+ * @param count - the number of addresses.
+ * @param options - const listenOptions* to how the sockets are bound.
+ * @return int - the number of listening sockets, -1 if an address could not be bound.
+ */
+int listenersStart(char **addresses, int count, const listenOptions *options);
+
+/**
+ * @brief Function name: listenersStop
+ * Stops the accept threads (see reactorStop), waits for them and closes the listening sockets, new clients are refused
+ * from then on while the accepted ones are still served.
+ */
+void listenersStop(void);
+
+/**
+ * @brief Function name: listenersPrint
+ * Prints the addresses the server listens on to @param out.
+ *
+ * @param out - FILE* to write the addresses to.
+ */
+void listenersPrint(FILE *out);
+
+#endif
@@ -0,0 +1,510 @@
+/**
+ * @file log.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Logger implementation file.
+ * This file contains the ring buffers of the logging threads and the thread draining them to the log files.
+ * Every ring has a single producer (its thread) and a single consumer (the draining thread), so neither side locks.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "openssl/err.h"
+
+//! the kind of the records of the access log, the other records carry their level.
+#define LOG_ACCESS LOG_LEVELS
+
+//! the size of the batches written to a log file.
+#define LOG_BATCH_SIZE (64 * 1024)
+
+//! The header of a record in a ring buffer, followed by its text.
+typedef struct logRecord
+{
+	//! the time the record was logged.
+	time_t when;
+	//! the length of the text.
+	uint16_t length;
+	//! the level of the message, LOG_ACCESS for an access log line.
+	uint8_t kind;
+	//! the length of the client address at the start of the text of an access log line.
+	uint8_t hostLength;
+} logRecord;
+
+//! The ring buffer of a logging thread.
+typedef struct logRing
+{
+	//! the ring of the thread that logged before this one.
+	struct logRing *next;
+	//! the position the thread writes the next record to, only written by the thread.
+	_Alignas(64) atomic_size_t head;
+	//! the position the next record is read from, only written by the draining thread.
+	_Alignas(64) atomic_size_t tail;
+	//! the records that did not fit the ring.
+	atomic_ulong dropped;
+	//! the dropped records already reported.
+	unsigned long reported;
+	//! the records.
+	char data[LOG_RING_SIZE];
+} logRing;
+
+//! A batch of lines for a log file.
+typedef struct logBatch
+{
+	//! the file, -1 if it is not written.
+	int fd;
+	//! the number of bytes in the batch.
+	size_t length;
+	//! the lines.
+	char data[LOG_BATCH_SIZE];
+} logBatch;
+
+//! the current level, changed at runtime by logSetLevel.
+atomic_int logCurrentLevel = LOG_INFO;
+
+//! the names of the levels, indexed by logLevel.
+const char *logLevelNames[LOG_LEVELS] = {"error", "warning", "info", "debug"};
+
+//! non-zero if the access log is written.
+int logAccessEnabled = 0;
+
+//! the rings of every thread that logged, the most recent first.
+static _Atomic(logRing*) rings;
+
+//! the ring of the calling thread, created when it logs for the first time.
+static _Thread_local logRing *threadRing;
+
+//! serialises draining, by the logging thread and logFlush.
+static pthread_mutex_t drainLock = PTHREAD_MUTEX_INITIALIZER;
+
+//! the batches of the error log and the access log, only used while holding drainLock.
+static logBatch errorBatch = {1, 0, {0}}, accessBatch = {-1, 0, {0}};
+
+/**
+ * @brief Function name: ringOfThread
+ * Returns the ring buffer of the calling thread, creating and registering it on the first call of the thread.
+ *
+ * @return logRing* - the ring, NULL if it could not be allocated.
+ */
+static logRing *ringOfThread(void)
+{
+	if(threadRing == NULL){
+		logRing *ring = aligned_alloc(64, sizeof(logRing));
+		if(ring == NULL){
+			return NULL;
+		}
+		memset(ring, 0, sizeof(logRing));
+		ring->next = atomic_load(&rings);
+		while(!atomic_compare_exchange_weak(&rings, &ring->next, ring)){
+		}
+		threadRing = ring;
+	}
+	return threadRing;
+}
+
+/**
+ * @brief Function name: ringPut
+ * Copies a record with the text @param text into the ring buffer of the calling thread, or counts it as dropped
+ * if the ring is full.
+ *
+ * @param kind - the level of the message, LOG_ACCESS for an access log line.
+ * @param hostLength - the length of the client address at the start of an access log line.
+ * @param text - the text of the record.
+ * @param length - the length of the text.
+ */
+static void ringPut(int kind, size_t hostLength, const char *text, size_t length)
+{
+	logRing *ring = ringOfThread();
+	if(ring == NULL){
+		return;
+	}
+	logRecord record = {time(NULL), (uint16_t)length, (uint8_t)kind, (uint8_t)hostLength};
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if(sizeof(record) + length > LOG_RING_SIZE - (head - tail)){
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return;
+	}
+	const char *parts[2] = {(const char*)&record, text};
+	size_t lengths[2] = {sizeof(record), length};
+	size_t position = head;
+	for(int i = 0; i < 2; i++){
+		size_t offset = position & (LOG_RING_SIZE - 1);
+		size_t first = lengths[i] < LOG_RING_SIZE - offset ? lengths[i] : LOG_RING_SIZE - offset;
+		memcpy(ring->data + offset, parts[i], first);
+		memcpy(ring->data, parts[i] + first, lengths[i] - first);
+		position += lengths[i];
+	}
+	atomic_store_explicit(&ring->head, position, memory_order_release);
+}
+
+/**
+ * @brief Function name: ringCopy
+ * Copies @param length bytes at the position @param position of the ring given by @param ring to @param out.
+ *
+ * @param ring - logRing* to the ring.
+ * @param position - the position of the bytes.
+ * @param out - the buffer receiving the bytes.
+ * @param length - the number of bytes.
+ */
+static void ringCopy(const logRing *ring, size_t position, void *out, size_t length)
+{
+	size_t offset = position & (LOG_RING_SIZE - 1);
+	size_t first = length < LOG_RING_SIZE - offset ? length : LOG_RING_SIZE - offset;
+	memcpy(out, ring->data + offset, first);
+	memcpy((char*)out + first, ring->data, length - first);
+}
+
+/**
+ * @brief Function name: batchWrite
+ * Writes the lines of the batch given by @param batch to its file and empties it.
+ *
+ * @param batch - logBatch* to the batch.
+ */
+static void batchWrite(logBatch *batch)
+{
+	size_t written = 0;
+	while(batch->fd >= 0 && written < batch->length){
+		ssize_t result = write(batch->fd, batch->data + written, batch->length - written);
+		if(result < 0 && errno == EINTR){
+			continue;
+		}
+		if(result <= 0){
+			break; // a log file that can not be written loses the batch rather than stalling the server
+		}
+		written += result;
+	}
+	batch->length = 0;
+}
+
+/**
+ * @brief Function name: batchRoom
+ * Returns the batch given by @param batch with room for @param length more bytes, writing it out first if needed.
+ *
+ * @param batch - logBatch* to the batch.
+ * @param length - the number of bytes to be added.
+ * @return char* - where the bytes are added.
+ */
+static char *batchRoom(logBatch *batch, size_t length)
+{
+	if(LOG_BATCH_SIZE - batch->length < length){
+		batchWrite(batch);
+	}
+	return batch->data + batch->length;
+}
+
+//! the time stamp of the error log, rendered by renderStamps.
+static char stamp[32];
+
+//! the time stamp of the access log, rendered by renderStamps.
+static char accessStamp[40];
+
+/**
+ * @brief Function name: renderStamps
+ * Renders the time stamps of both logs for the time @param when, once per second.
+ *
+ * @param when - the time of the record being written.
+ */
+static void renderStamps(time_t when)
+{
+	static time_t renderedAt = -1;
+	if(when == renderedAt){
+		return;
+	}
+	struct tm local;
+	localtime_r(&when, &local);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+	strftime(accessStamp, sizeof(accessStamp), "%d/%b/%Y:%H:%M:%S %z", &local);
+	renderedAt = when;
+}
+
+/**
+ * @brief Function name: logDrain
+ * Moves the records of every ring into the batches of the log files and writes them. Must be called holding drainLock.
+ */
+static void logDrain(void)
+{
+	char text[LOG_MESSAGE_SIZE];
+	for(logRing *ring = atomic_load(&rings); ring != NULL; ring = ring->next){
+		size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		while(tail < head){
+			logRecord record;
+			ringCopy(ring, tail, &record, sizeof(record));
+			ringCopy(ring, tail + sizeof(record), text, record.length);
+			tail += sizeof(record) + record.length;
+			renderStamps(record.when);
+			if(record.kind == LOG_ACCESS){
+				char *line = batchRoom(&accessBatch, record.length + sizeof(accessStamp) + 16);
+				accessBatch.length += sprintf(line, "%.*s - - [%s]%.*s\n", record.hostLength, text, accessStamp,
+					record.length - record.hostLength, text + record.hostLength);
+			} else {
+				char *line = batchRoom(&errorBatch, record.length + sizeof(stamp) + 16);
+				errorBatch.length += sprintf(line, "[%s] %s: %.*s\n", stamp, logLevelNames[record.kind], record.length, text);
+			}
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+		unsigned long dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+		if(dropped != ring->reported){
+			renderStamps(time(NULL));
+			char *line = batchRoom(&errorBatch, 128);
+			errorBatch.length += sprintf(line, "[%s] warning: %lu log messages dropped, the log can not keep up\n",
+				stamp, dropped - ring->reported);
+			ring->reported = dropped;
+		}
+	}
+	batchWrite(&errorBatch);
+	batchWrite(&accessBatch);
+}
+
+/**
+ * @brief Function name: logThread
+ * The thread function draining the ring buffers every LOG_FLUSH_INTERVAL milliseconds.
+ *
+ * @param unused - unused.
+ * @return void* - never returns.
+ */
+static void *logThread(void *unused)
+{
+	(void)unused;
+	struct timespec interval = {0, LOG_FLUSH_INTERVAL * 1000000L};
+	while(1){
+		nanosleep(&interval, NULL);
+		pthread_mutex_lock(&drainLock);
+		logDrain();
+		pthread_mutex_unlock(&drainLock);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Function name: logOpen
+ * Opens the file with the path @param path for appending log lines.
+ *
+ * @param path - the path of the file.
+ * @return int - the file descriptor, -1 if the file could not be opened.
+ */
+static int logOpen(const char *path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if(fd < 0){
+		printf("ERROR: could not open the log file %s: %s\n", path, strerror(errno));
+	}
+	return fd;
+}
+
+/**
+ * @brief Function name: logStart
+ * Opens the log files and starts the thread writing them. Messages logged before are kept in the rings until then.
+ *
+ * @param errorPath - the file the messages are appended to, NULL for the standard output.
+ * @param accessPath - the file the access log is appended to, NULL to not write an access log.
+ * @param level - the level of the messages logged.
+ * @return int - 0 on success, -1 if a file could not be opened or the thread not be started.
+ */
+int logStart(const char *errorPath, const char *accessPath, logLevel level)
+{
+	logSetLevel(level);
+	if(errorPath != NULL && (errorBatch.fd = logOpen(errorPath)) < 0){
+		return -1;
+	}
+	if(accessPath != NULL){
+		if((accessBatch.fd = logOpen(accessPath)) < 0){
+			return -1;
+		}
+		logAccessEnabled = 1;
+	}
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, logThread, NULL) != 0){
+		printf("ERROR: could not start the logging thread\n");
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
+/**
+ * @brief Function name: logSetLevel
+ * Changes the level of the messages logged to @param level, at any time and from any thread.
+ *
+ * @param level - the new level.
+ */
+void logSetLevel(logLevel level)
+{
+	atomic_store_explicit(&logCurrentLevel, level, memory_order_relaxed);
+}
+
+/**
+ * @brief Function name: logParseLevel
+ * Returns the level with the name @param name (error, warning, info or debug).
+ *
+ * @param name - the name of the level.
+ * @return int - the level, -1 if the name is unknown.
+ */
+int logParseLevel(const char *name)
+{
+	for(int level = 0; level < LOG_LEVELS; level++){
+		if(strcasecmp(name, logLevelNames[level]) == 0){
+			return level;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Function name: logWrite
+ * Formats the message and copies it into the ring buffer of the calling thread, use the logMessage macros instead.
+ *
+ * @param level - the level of the message.
+ * @param format - the printf format of the message.
+ */
+void logWrite(logLevel level, const char *format, ...)
+{
+	char text[LOG_MESSAGE_SIZE];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	if(length < 0){
+		return;
+	}
+	ringPut(level, 0, text, (size_t)length < sizeof(text) ? (size_t)length : sizeof(text) - 1);
+}
+
+/**
+ * @brief Function name: logOpenSslError
+ * Logs one error line of OpenSSL, the callback of ERR_print_errors_cb.
+ *
+ * @param line - the error line.
+ * @param length - the length of the line, including its line break.
+ * @param levelPtr - logLevel* to the level of the message.
+ * @return int - 1 to continue with the next error.
+ */
+static int logOpenSslError(const char *line, size_t length, void *levelPtr)
+{
+	if(length > 0 && line[length - 1] == '\n'){
+		length--;
+	}
+	logWrite(*(logLevel*)levelPtr, "%.*s", (int)length, line);
+	return 1;
+}
+
+/**
+ * @brief Function name: logOpenSslErrors
+ * Logs the errors queued by OpenSSL in the calling thread at the level @param level and clears them.
+ *
+ * @param level - the level of the messages.
+ */
+void logOpenSslErrors(logLevel level)
+{
+	if(!logEnabled(level)){
+		ERR_clear_error();
+		return;
+	}
+	ERR_print_errors_cb(logOpenSslError, &level);
+}
+
+/**
+ * @brief Function name: appendField
+ * Appends the field given by @param field to @param buffer as a quoted string of the access log, with quotes, backslashes
+ * and control characters escaped. A missing field is logged as "-".
+ *
+ * @param buffer - char* to the access log line.
+ * @param size - the size of the buffer.
+ * @param length - the length of the line so far, the field is appended after it.
+ * @param field - const stringView* to the field, NULL if it is missing.
+ * @return size_t - the length of the line with the field.
+ */
+static size_t appendField(char *buffer, size_t size, size_t length, const stringView *field)
+{
+	if(length + 4 >= size){
+		return length;
+	}
+	if(field == NULL || field->length == 0){
+		buffer[length++] = '-';
+		return length;
+	}
+	for(size_t i = 0; i < field->length && length + 4 < size; i++){
+		unsigned char c = (unsigned char)field->data[i];
+		if(c == '"' || c == '\\'){
+			buffer[length++] = '\\';
+			buffer[length++] = c;
+		} else if(c < 0x20 || c == 0x7f){
+			length += snprintf(buffer + length, size - length, "\\x%02x", c);
+		} else {
+			buffer[length++] = c;
+		}
+	}
+	return length;
+}
+
+/**
+ * @brief Function name: logAccess
+ * Logs the request given by @param request, answered with @param statusCode and @param bytes bytes, to the access log in
+ * the combined log format. Does nothing if no access log is written.
+ * The client address leads the record, the draining thread adds the time stamp after it.
+ *
+ * @param host - the address of the client.
+ * @param request - const httpRequest* to the request, its fields are logged as "-" if it could not be parsed.
+ * @param statusCode - the status code of the response.
+ * @param bytes - the number of bytes of the response.
+ */
+void logAccess(const char *host, const httpRequest *request, int statusCode, size_t bytes)
+{
+	if(!logAccessEnabled){
+		return;
+	}
+	char line[LOG_MESSAGE_SIZE];
+	size_t size = sizeof(line) - 64; // the status, size and quotes always fit
+	int parsed = request->state == HTTP_DONE;
+	size_t hostLength = snprintf(line, 64, "%s", host != NULL && host[0] != '\0' ? host : "-");
+	if(hostLength > 63){
+		hostLength = 63;
+	}
+	size_t length = hostLength;
+	line[length++] = ' ';
+	line[length++] = '"';
+	if(parsed){
+		length = appendField(line, size, length, &request->method);
+		line[length++] = ' ';
+		length = appendField(line, size, length, &request->target);
+		line[length++] = ' ';
+		length = appendField(line, size, length, &request->version);
+	} else {
+		line[length++] = '-';
+	}
+	length += snprintf(line + length, sizeof(line) - length, "\" %d ", statusCode);
+	length += bytes > 0 ? snprintf(line + length, sizeof(line) - length, "%zu \"", bytes) :
+		snprintf(line + length, sizeof(line) - length, "- \"");
+	length = appendField(line, size, length, parsed ? httpFindHeader(request, "Referer") : NULL);
+	line[length++] = '"';
+	line[length++] = ' ';
+	line[length++] = '"';
+	length = appendField(line, size, length, parsed ? httpFindHeader(request, "User-Agent") : NULL);
+	line[length++] = '"';
+	ringPut(LOG_ACCESS, hostLength, line, length);
+}
+
+/**
+ * @brief Function name: logFlush
+ * Writes every message logged so far, called before the server exits.
+ */
+void logFlush(void)
+{
+	pthread_mutex_lock(&drainLock);
+	logDrain();
+	pthread_mutex_unlock(&drainLock);
+}
@@ -0,0 +1,142 @@
+#ifndef LOG_H
+#define LOG_H
+
+/**
+ * @file log.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the logger of the server. A thread logging a message only formats it and copies it
+ * into a ring buffer of its own, without locking or a system call; a background thread drains the rings of every thread
+ * every LOG_FLUSH_INTERVAL milliseconds and writes the messages to the error log and the access log (combined log format)
+ * in batches. A message below the current level costs a single comparison.
+ * See files log.c, reactor.c and server.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <time.h>
+#include "http.h"
+
+//! the size of the ring buffer of every logging thread, a power of two. Messages that do not fit are dropped and counted.
+#define LOG_RING_SIZE (64 * 1024)
+
+//! the longest message (or access log line) logged, longer ones are cut.
+#define LOG_MESSAGE_SIZE 1024
+
+//! the number of milliseconds between two drains of the ring buffers.
+#define LOG_FLUSH_INTERVAL 100
+
+//! The levels of the messages, a message is logged if its level is at most the current level.
+typedef enum logLevel
+{
+	LOG_ERROR,   //!< the server (or a part of it) can not continue.
+	LOG_WARNING, //!< the server continues with less functionality.
+	LOG_INFO,    //!< events worth knowing about, including failed requests and handshakes.
+	LOG_DEBUG,   //!< the progress of every connection and request.
+	LOG_LEVELS
+} logLevel;
+
+//! the current level, changed at runtime by logSetLevel.
+extern atomic_int logCurrentLevel;
+
+//! the names of the levels, indexed by logLevel.
+extern const char *logLevelNames[LOG_LEVELS];
+
+//! non-zero if the access log is written.
+extern int logAccessEnabled;
+
+/**
+ * @brief Function name: logEnabled
+ * Returns whether messages of the level @param level are logged.
+ *
+ * @param level - the level of the message.
+ * @return int - non-zero if messages of the level are logged.
+ */
+static inline int logEnabled(logLevel level)
+{
+	return (int)level <= atomic_load_explicit(&logCurrentLevel, memory_order_relaxed);
+}
+
+//! Logs a message of the level given by @param level, its arguments are not even evaluated if the level is disabled.
+#define logMessage(level, ...) do { if(logEnabled(level)) logWrite(level, __VA_ARGS__); } while(0)
+
+//! Logs an error message.
+#define logError(...) logMessage(LOG_ERROR, __VA_ARGS__)
+
+//! Logs a warning.
+#define logWarning(...) logMessage(LOG_WARNING, __VA_ARGS__)
+
+//! Logs an informational message.
+#define logInfo(...) logMessage(LOG_INFO, __VA_ARGS__)
+
+//! Logs a debug message.
+#define logDebug(...) logMessage(LOG_DEBUG, __VA_ARGS__)
+
+/**
+ * @brief Function name: logStart
+ * Opens the log files and starts the thread writing them. Messages logged before are kept in the rings until then.
+ *
+ * @param errorPath - the file the messages are appended to, NULL for the standard output.
+ * @param accessPath - the file the access log is appended to, NULL to not write an access log.
+ * @param level - the level of the messages logged.
+ * @return int - 0 on success, -1 if a file could not be opened or the thread not be started.
+ */
+int logStart(const char *errorPath, const char *accessPath, logLevel level);
+
+/**
+ * @brief Function name: logSetLevel
+ * Changes the level of the messages logged to @param level, at any time and from any thread.
+ *
+ * @param level - the new level.
+ */
+void logSetLevel(logLevel level);
+
+/**
+ * @brief Function name: logParseLevel
+ * Returns the level with the name @param name (error, warning, info or debug).
+ *
+ * @param name - the name of the level.
+ * @return int - the level, -1 if the name is unknown.
+ */
+int logParseLevel(const char *name);
+
+/**
+ * @brief Function name: logWrite
+ * Formats the message and copies it into the ring buffer of the calling thread, use the logMessage macros instead.
+ *
+ * @param level - the level of the message.
+ * @param format - the printf format of the message.
+ */
+void logWrite(logLevel level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Function name: logOpenSslErrors
+ * Logs the errors queued by OpenSSL in the calling thread at the level @param level and clears them.
+ *
+ * @param level - the level of the messages.
+ */
+void logOpenSslErrors(logLevel level);
+
+/**
+ * @brief Function name: logAccess
+ * Logs the request given by @param request, answered with @param statusCode and @param bytes bytes, to the access log in
+ * the combined log format. Does nothing if no access log is written.
+ *
+ * @param host - the address of the client.
+ * @param request - const httpRequest* to the request, its fields are logged as "-" if it could not be parsed.
+ * @param statusCode - the status code of the response.
+ * @param bytes - the number of bytes of the response.
+ */
+void logAccess(const char *host, const httpRequest *request, int statusCode, size_t bytes);
+
+/**
+ * @brief Function name: logFlush
+ * Writes every message logged so far, called before the server exits.
+ */
+void logFlush(void);
+
+#endif
@@ -0,0 +1,165 @@
+/**
+ * @file memory.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Memory pool implementation file.
+ * This file contains the slab pools of the workers and the arenas of the connections.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "memory.h"
+#include <stdlib.h>
+
+/**
+ * @brief Function name: slabInit
+ * Prepares the slab pool given by @param pool, no memory is allocated until the first object is taken.
+ *
+ * @param pool - slabPool* to the pool.
+ * @param objectSize - the size of the objects.
+ * @param perChunk - the number of objects allocated at once when the pool is empty.
+ * @param limit - the largest number of objects handed out at the same time, 0 for no limit.
+ */
+void slabInit(slabPool *pool, size_t objectSize, size_t perChunk, size_t limit)
+{
+	pool->objectSize = (objectSize + MEMORY_ALIGNMENT - 1) / MEMORY_ALIGNMENT * MEMORY_ALIGNMENT;
+	pool->perChunk = perChunk > 0 ? perChunk : 1;
+	pool->limit = limit;
+	pool->freeList = NULL;
+	pool->chunks = NULL;
+	pool->capacity = 0;
+	pool->inUse = 0;
+}
+
+/**
+ * @brief Function name: slabGrow
+ * Allocates a chunk of objects for the slab pool given by @param pool and adds them to its free list.
+ * The chunk starts with its header, padded to MEMORY_ALIGNMENT so that every object stays aligned.
+ *
+ * @param pool - slabPool* to the pool.
+ * @return int - 0 on success, -1 if no memory is left.
+ */
+static int slabGrow(slabPool *pool)
+{
+	size_t count = pool->perChunk;
+	if(pool->limit > 0 && pool->capacity + count > pool->limit){
+		count = pool->limit - pool->capacity;
+	}
+	slabChunk *chunk = aligned_alloc(MEMORY_ALIGNMENT, MEMORY_ALIGNMENT + count * pool->objectSize);
+	if(chunk == NULL){
+		return -1;
+	}
+	chunk->next = pool->chunks;
+	pool->chunks = chunk;
+	char *objects = (char*)chunk + MEMORY_ALIGNMENT;
+	for(size_t i = count; i > 0; i--){
+		slabObject *object = (slabObject*)(objects + (i - 1) * pool->objectSize);
+		object->next = pool->freeList;
+		pool->freeList = object;
+	}
+	pool->capacity += count;
+	return 0;
+}
+
+/**
+ * @brief Function name: slabAlloc
+ * Takes an object from the slab pool given by @param pool, allocating a new chunk only if no object is free.
+ * The contents of the object are undefined.
+ *
+ * @param pool - slabPool* to the pool.
+ * @return void* - the object, NULL if the limit of the pool is reached or no memory is left.
+ */
+void *slabAlloc(slabPool *pool)
+{
+	if(pool->freeList == NULL){
+		if(pool->limit > 0 && pool->capacity >= pool->limit){
+			return NULL;
+		}
+		if(slabGrow(pool) < 0){
+			return NULL;
+		}
+	}
+	slabObject *object = pool->freeList;
+	pool->freeList = object->next;
+	pool->inUse++;
+	return object;
+}
+
+/**
+ * @brief Function name: slabFree
+ * Returns the object given by @param object to the slab pool given by @param pool.
+ *
+ * @param pool - slabPool* to the pool the object was taken from.
+ * @param object - the object, may be NULL.
+ */
+void slabFree(slabPool *pool, void *object)
+{
+	if(object == NULL){
+		return;
+	}
+	slabObject *freed = (slabObject*)object;
+	freed->next = pool->freeList;
+	pool->freeList = freed;
+	pool->inUse--;
+}
+
+/**
+ * @brief Function name: slabPrintStats
+ * Prints the objects in use and allocated of the slab pool given by @param pool to @param out.
+ *
+ * @param out - FILE* to write the counters to.
+ * @param name - the name of the pool.
+ * @param pool - slabPool* to the pool.
+ */
+void slabPrintStats(FILE *out, const char *name, const slabPool *pool)
+{
+	fprintf(out, "%s: %zu in use, %zu allocated (%zu KB)\n", name, pool->inUse, pool->capacity,
+		pool->capacity * pool->objectSize / 1024);
+}
+
+/**
+ * @brief Function name: arenaInit
+ * Prepares the arena given by @param memory to hand out the @param size bytes of @param memory.
+ *
+ * @param scratch - arena* to the arena.
+ * @param memory - the memory of the arena, aligned to MEMORY_ALIGNMENT.
+ * @param size - the size of the memory.
+ */
+void arenaInit(arena *scratch, void *memory, size_t size)
+{
+	scratch->base = memory;
+	scratch->size = size;
+	scratch->used = 0;
+}
+
+/**
+ * @brief Function name: arenaAlloc
+ * Hands out @param size bytes of the arena given by @param scratch, valid until the arena is reset.
+ *
+ * @param scratch - arena* to the arena.
+ * @param size - the number of bytes.
+ * @return void* - the memory, aligned to 16 bytes, NULL if the arena is exhausted.
+ */
+void *arenaAlloc(arena *scratch, size_t size)
+{
+	size_t start = (scratch->used + 15) & ~(size_t)15;
+	if(start > scratch->size || size > scratch->size - start){
+		return NULL;
+	}
+	scratch->used = start + size;
+	return scratch->base + start;
+}
+
+/**
+ * @brief Function name: arenaReset
+ * Releases everything handed out by the arena given by @param scratch at once.
+ *
+ * @param scratch - arena* to the arena.
+ */
+void arenaReset(arena *scratch)
+{
+	scratch->used = 0;
+}
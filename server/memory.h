@@ -0,0 +1,137 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+/**
+ * @file memory.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the memory pools of the workers: slab pools handing out objects of one size
+ * (connections and write buffers) from chunks that are kept and reused, and the arena of every connection holding
+ * the memory of the current request, reset when the next request starts. Once the pools are warm, requests are
+ * served without heap allocations.
+ * See files memory.c and reactor.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+
+//! the alignment of the objects of a slab pool and of the allocations from an arena.
+#define MEMORY_ALIGNMENT 64
+
+//! A free object of a slab pool, linked into the free list.
+typedef struct slabObject
+{
+	//! the next free object.
+	struct slabObject *next;
+} slabObject;
+
+//! A chunk of objects allocated by a slab pool, kept until the server exits.
+typedef struct slabChunk
+{
+	//! the chunk allocated before this one.
+	struct slabChunk *next;
+} slabChunk;
+
+//! A pool of objects of one size, only used by the worker owning it.
+typedef struct slabPool
+{
+	//! the size of an object, a multiple of MEMORY_ALIGNMENT.
+	size_t objectSize;
+	//! the number of objects allocated per chunk.
+	size_t perChunk;
+	//! the largest number of objects handed out at the same time, 0 for no limit.
+	size_t limit;
+	//! the free objects.
+	slabObject *freeList;
+	//! the chunks allocated.
+	slabChunk *chunks;
+	//! the number of objects in the chunks.
+	size_t capacity;
+	//! the number of objects handed out.
+	size_t inUse;
+} slabPool;
+
+//! A bump allocator over a fixed block of memory, reset at once.
+typedef struct arena
+{
+	//! the memory of the arena.
+	char *base;
+	//! the size of the memory.
+	size_t size;
+	//! the number of bytes handed out since the last reset.
+	size_t used;
+} arena;
+
+/**
+ * @brief Function name: slabInit
+ * Prepares the slab pool given by @param pool, no memory is allocated until the first object is taken.
+ *
+ * @param pool - slabPool* to the pool.
+ * @param objectSize - the size of the objects.
+ * @param perChunk - the number of objects allocated at once when the pool is empty.
+ * @param limit - the largest number of objects handed out at the same time, 0 for no limit.
+ */
+void slabInit(slabPool *pool, size_t objectSize, size_t perChunk, size_t limit);
+
+/**
+ * @brief Function name: slabAlloc
+ * Takes an object from the slab pool given by @param pool, allocating a new chunk only if no object is free.
+ * The contents of the object are undefined.
+ *
+ * @param pool - slabPool* to the pool.
+ * @return void* - the object, NULL if the limit of the pool is reached or no memory is left.
+ */
+void *slabAlloc(slabPool *pool);
+
+/**
+ * @brief Function name: slabFree
+ * Returns the object given by @param object to the slab pool given by @param pool.
+ *
+ * @param pool - slabPool* to the pool the object was taken from.
+ * @param object - the object, may be NULL.
+ */
+void slabFree(slabPool *pool, void *object);
+
+/**
+ * @brief Function name: slabPrintStats
+ * Prints the objects in use and allocated of the slab pool given by @param pool to @param out.
+ *
+ * @param out - FILE* to write the counters to.
+ * @param name - the name of the pool.
+ * @param pool - slabPool* to the pool.
+ */
+void slabPrintStats(FILE *out, const char *name, const slabPool *pool);
+
+/**
+ * @brief Function name: arenaInit
+ * Prepares the arena given by @param memory to hand out the @param size bytes of @param memory.
+ *
+ * @param scratch - arena* to the arena.
+ * @param memory - the memory of the arena, aligned to MEMORY_ALIGNMENT.
+ * @param size - the size of the memory.
+ */
+void arenaInit(arena *scratch, void *memory, size_t size);
+
+/**
+ * @brief Function name: arenaAlloc
+ * Hands out @param size bytes of the arena given by @param scratch, valid until the arena is reset.
+ *
+ * @param scratch - arena* to the arena.
+ * @param size - the number of bytes.
+ * @return void* - the memory, aligned to 16 bytes, NULL if the arena is exhausted.
+ */
+void *arenaAlloc(arena *scratch, size_t size);
+
+/**
+ * @brief Function name: arenaReset
+ * Releases everything handed out by the arena given by @param scratch at once.
+ *
+ * @param scratch - arena* to the arena.
+ */
+void arenaReset(arena *scratch);
+
+#endif
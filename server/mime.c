@@ -0,0 +1,347 @@
+/**
+ * @file mime.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Mime-type table implementation file.
+ * This file contains the parsing of the mime-types file and the construction and lookup of the perfect hash table.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "mime.h"
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+//! the table used by getMimeType, NULL until a table was loaded.
+static _Atomic(mimeTable*) currentTable = NULL;
+
+//! the table replaced by the last reload, freed by the next one so that lookups still using it can finish.
+static mimeTable *retiredTable = NULL;
+
+//! the number of displacements tried per bucket before the table is rebuilt with a new seed.
+#define MAX_DISPLACEMENT 65536
+
+/**
+ * @brief Function name: mimeHash
+ * Hashes the lower case extension given by @param extension (FNV-1a) starting from @param seed.
+ *
+ * @param extension - the extension.
+ * @param seed - the seed of the table.
+ * @return uint64_t - the hash of the extension.
+ */
+static uint64_t mimeHash(const char *extension, uint64_t seed)
+{
+	uint64_t hash = 14695981039346656037UL ^ seed;
+	for(const unsigned char *c = (const unsigned char*)extension; *c != '\0'; c++){
+		hash ^= *c;
+		hash *= 1099511628211UL;
+	}
+	// mix the high bits into the low bits, the slot and the bucket are taken from different bits
+	hash ^= hash >> 29;
+	hash *= 0xbf58476d1ce4e5b9UL;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+/**
+ * @brief Function name: mimeSlot
+ * Returns the slot of the extension with the hash @param hash in a bucket with the displacement @param displacement.
+ *
+ * @param hash - the hash of the extension.
+ * @param displacement - the displacement of the bucket of the extension.
+ * @param mask - the number of slots minus one.
+ * @return size_t - the index of the slot.
+ */
+static size_t mimeSlot(uint64_t hash, uint32_t displacement, size_t mask)
+{
+	uint64_t first = hash >> 32;
+	uint64_t step = (hash >> 16) | 1;
+	return (size_t)((first + displacement * step) & mask);
+}
+
+/**
+ * @brief Function name: mimeTableFree
+ * Frees the table given by @param table.
+ *
+ * @param table - mimeTable* to the table, may be NULL.
+ */
+static void mimeTableFree(mimeTable *table)
+{
+	if(table != NULL){
+		free(table->slots);
+		free(table->displacements);
+		free(table->text);
+		free(table);
+	}
+}
+
+/**
+ * @brief Function name: mimeTableBuild
+ * Places the @param count extensions of @param entries in the table given by @param table, choosing the displacement
+ * of every bucket so that no two extensions share a slot. The buckets holding the most extensions are placed first.
+ *
+ * @param table - mimeTable* to the table, its slots, mask, displacements and buckets are set.
+ * @param entries - the extensions and their types.
+ * @param count - the number of extensions.
+ * @return int - 0 on success, -1 if no perfect table was found with the seed of the table.
+ */
+static int mimeTableBuild(mimeTable *table, const mimeEntry *entries, size_t count)
+{
+	uint64_t *hashes = malloc(count * sizeof(uint64_t));
+	size_t *order = malloc(count * sizeof(size_t));
+	size_t *bucketSizes = calloc(table->buckets, sizeof(size_t));
+	int result = hashes != NULL && order != NULL && bucketSizes != NULL ? 0 : -1;
+	for(size_t i = 0; result == 0 && i < count; i++){
+		hashes[i] = mimeHash(entries[i].extension, table->seed);
+		bucketSizes[hashes[i] % table->buckets]++;
+		order[i] = i;
+	}
+	// sort the extensions by the size of their bucket (largest first), keeping a bucket together
+	for(size_t i = 1; result == 0 && i < count; i++){
+		size_t current = order[i];
+		size_t currentBucket = hashes[current] % table->buckets;
+		size_t j = i;
+		while(j > 0){
+			size_t previousBucket = hashes[order[j - 1]] % table->buckets;
+			if(bucketSizes[previousBucket] > bucketSizes[currentBucket] ||
+			   (bucketSizes[previousBucket] == bucketSizes[currentBucket] && previousBucket <= currentBucket)){
+				break;
+			}
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = current;
+	}
+
+	for(size_t start = 0; result == 0 && start < count; ){
+		size_t bucket = hashes[order[start]] % table->buckets;
+		size_t end = start;
+		while(end < count && hashes[order[end]] % table->buckets == bucket){
+			end++;
+		}
+		uint32_t displacement = 0;
+		for(; displacement < MAX_DISPLACEMENT; displacement++){
+			size_t placed = start;
+			for(; placed < end; placed++){
+				size_t slot = mimeSlot(hashes[order[placed]], displacement, table->mask);
+				if(table->slots[slot].extension != NULL){
+					break;
+				}
+				table->slots[slot] = entries[order[placed]];
+			}
+			if(placed == end){
+				break;
+			}
+			// undo the extensions of the bucket placed with this displacement
+			for(size_t undo = start; undo < placed; undo++){
+				table->slots[mimeSlot(hashes[order[undo]], displacement, table->mask)].extension = NULL;
+			}
+		}
+		if(displacement == MAX_DISPLACEMENT){
+			result = -1;
+		}
+		table->displacements[bucket] = displacement;
+		start = end;
+	}
+	free(hashes);
+	free(order);
+	free(bucketSizes);
+	return result;
+}
+
+/**
+ * @brief Function name: mimeTableLoad
+ * Reads the mime-types file given by @param path (one ".extension type" pair per line) and replaces the current table
+ * with the new one. The first entry of an extension listed more than once is used.
+ *
+ * @param path - the path of the mime-types file.
+ * @return int - the number of extensions loaded, -1 if the file could not be read (the current table is kept).
+ */
+int mimeTableLoad(const char *path)
+{
+	FILE *mimeFile = fopen(path, "r");
+	if(mimeFile == NULL){
+		return -1;
+	}
+	mimeTable *table = calloc(1, sizeof(mimeTable));
+	size_t capacity = 1024, length = 0;
+	if(table != NULL){
+		table->text = malloc(capacity);
+	}
+	while(table != NULL && table->text != NULL){
+		if(length + 1 == capacity){
+			char *grown = realloc(table->text, capacity * 2);
+			if(grown == NULL){
+				break;
+			}
+			table->text = grown;
+			capacity *= 2;
+		}
+		size_t bytesread = fread(table->text + length, 1, capacity - 1 - length, mimeFile);
+		if(bytesread == 0){
+			break;
+		}
+		length += bytesread;
+	}
+	fclose(mimeFile);
+	if(table == NULL || table->text == NULL){
+		mimeTableFree(table);
+		return -1;
+	}
+	table->text[length] = '\0';
+
+	// every line with an extension (starting with '.') is used, other lines such as the count on the first line are skipped
+	size_t lines = 1;
+	for(size_t i = 0; i < length; i++){
+		lines += table->text[i] == '\n';
+	}
+	mimeEntry *entries = malloc(lines * sizeof(mimeEntry));
+	size_t count = 0;
+	char *savePtr = NULL;
+	for(char *line = strtok_r(table->text, "\r\n", &savePtr); entries != NULL && line != NULL; line = strtok_r(NULL, "\r\n", &savePtr)){
+		char *extension = line + strspn(line, " \t");
+		if(*extension != '.'){
+			continue;
+		}
+		char *type = extension + strcspn(extension, " \t");
+		if(*type == '\0'){
+			continue;
+		}
+		*type++ = '\0';
+		type += strspn(type, " \t\"");
+		type[strcspn(type, " \t\"")] = '\0';
+		if(*type == '\0' || strlen(extension) >= MAX_EXTENSION_LENGTH){
+			continue;
+		}
+		for(char *c = extension; *c != '\0'; c++){
+			*c = tolower((unsigned char)*c);
+		}
+		int duplicate = 0;
+		for(size_t i = 0; i < count && !duplicate; i++){
+			duplicate = strcmp(entries[i].extension, extension) == 0;
+		}
+		if(!duplicate){
+			entries[count].extension = extension;
+			entries[count].type = type;
+			count++;
+		}
+	}
+	if(entries == NULL){
+		mimeTableFree(table);
+		return -1;
+	}
+
+	size_t slots = 2;
+	while(slots < count + count / 4){
+		slots <<= 1;
+	}
+	table->count = count;
+	int built = -1;
+	for(int attempt = 0; built < 0 && attempt < 64; attempt++){
+		if(attempt > 0 && attempt % 8 == 0){
+			slots <<= 1; // a sparser table if no seed worked
+		}
+		free(table->slots);
+		free(table->displacements);
+		table->mask = slots - 1;
+		table->buckets = count / 4 + 1;
+		table->seed = 0x9e3779b97f4a7c15UL * (attempt + 1);
+		table->slots = calloc(slots, sizeof(mimeEntry));
+		table->displacements = calloc(table->buckets, sizeof(uint32_t));
+		if(table->slots == NULL || table->displacements == NULL){
+			break;
+		}
+		built = mimeTableBuild(table, entries, count);
+	}
+	free(entries);
+	if(built < 0){
+		mimeTableFree(table);
+		return -1;
+	}
+
+	mimeTable *previous = atomic_exchange(&currentTable, table);
+	mimeTableFree(retiredTable);
+	retiredTable = previous;
+	return (int)count;
+}
+
+/**
+ * @brief Function name: getMimeType
+ * This function is used to determine the mime-type of the file passed in as a paramter.
+ * It extracts the file extension of the filename passed in as @param name and looks it up in the table read from the
+ * mime-types.tsv file, without allocating memory.
+ *
+ * If the appropriate mime-type is found, it is returned, if not, the application/octet-stream mime-type is returned
+ * to indicate to the client that the mime-type for the file is unknown.
+ *
+ * If a user wishes to add a mime-type + file extension combination to improve compatiblity, they may do so by editing the mime-types.tsv file
+ * found in the root directory of the server and sending SIGHUP to the server to reload it.
+ *
+ * @param name - char* pointing to a C-Style string containing the path to file to be sent to client.
+ * @return const char* - the mime-type to use for the file requested, valid at least until the table is reloaded twice.
+ */
+const char *getMimeType(const char *name)
+{
+	mimeTable *table = atomic_load_explicit(&currentTable, memory_order_acquire);
+	const char *ext = strrchr(name, '.');
+	if(table == NULL || ext == NULL || table->count == 0){
+		return DEFAULT_MIME_TYPE;
+	}
+	char extension[MAX_EXTENSION_LENGTH];
+	size_t length = 0;
+	for(; ext[length] != '\0'; length++){
+		if(length == MAX_EXTENSION_LENGTH - 1){
+			return DEFAULT_MIME_TYPE;
+		}
+		extension[length] = tolower((unsigned char)ext[length]);
+	}
+	extension[length] = '\0';
+
+	uint64_t hash = mimeHash(extension, table->seed);
+	const mimeEntry *slot = &table->slots[mimeSlot(hash, table->displacements[hash % table->buckets], table->mask)];
+	if(slot->extension != NULL && strcmp(slot->extension, extension) == 0){
+		return slot->type;
+	}
+	return DEFAULT_MIME_TYPE;
+}
+
+/**
+ * @brief Function name: mimeCompressible
+ * Determines whether files of the mime-type @param type are worth compressing. Images, audio, video, archives and
+ * documents such as pdf are compressed by their format already, and unknown (application/octet-stream) files are
+ * usually binary, compressing them again costs cpu time without making them smaller.
+ *
+ * @param type - the mime-type, as returned by getMimeType.
+ * @return int - 1 if the files should be compressed, 0 otherwise.
+ */
+int mimeCompressible(const char *type)
+{
+	static const char *compressedPrefixes[] = { "image/", "audio/", "video/", "font/woff" };
+	static const char *compressedTypes[] = {
+		DEFAULT_MIME_TYPE, "application/pdf", "application/zip", "application/gzip", "application/x-gzip",
+		"application/x-compressed", "application/x-zip-compressed", "application/x-bzip", "application/x-bzip2",
+		"application/x-7z-compressed", "application/x-rar-compressed", "application/x-xz", "application/x-tar",
+		"application/x-shockwave-flash", "application/vnd.ms-cab-compressed"
+	};
+	if(strcasecmp(type, "image/svg+xml") == 0){
+		return 1; // the only text based image format
+	}
+	for(size_t i = 0; i < sizeof(compressedPrefixes) / sizeof(compressedPrefixes[0]); i++){
+		if(strncasecmp(type, compressedPrefixes[i], strlen(compressedPrefixes[i])) == 0){
+			return 0;
+		}
+	}
+	for(size_t i = 0; i < sizeof(compressedTypes) / sizeof(compressedTypes[0]); i++){
+		if(strcasecmp(type, compressedTypes[i]) == 0){
+			return 0;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,95 @@
+#ifndef MIME_H
+#define MIME_H
+
+/**
+ * @file mime.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the table of mime-types, read once from mime-types.tsv into a perfect hash table
+ * so that the mime-type of a file is found with a single probe and without allocating. The table is reloaded on SIGHUP.
+ * See files mime.c and server.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+//! the mime-type of files whose extension is unknown.
+#define DEFAULT_MIME_TYPE "application/octet-stream"
+
+//! the longest file extension (including the '.') that is looked up.
+#define MAX_EXTENSION_LENGTH 32
+
+//! A slot of the mime-type table.
+typedef struct mimeEntry
+{
+	//! the file extension in lower case, including the '.', NULL for an empty slot.
+	const char *extension;
+	//! the mime-type of the extension.
+	const char *type;
+} mimeEntry;
+
+/**
+ * @brief A perfect hash table of the mime-types (hash and displace). The extension is hashed once, the first hash picks a
+ * bucket whose displacement, chosen when the table was built, moves every extension of the bucket to a slot of its own.
+ */
+typedef struct mimeTable
+{
+	//! the slots, the number of slots is a power of two.
+	mimeEntry *slots;
+	//! the number of slots minus one.
+	size_t mask;
+	//! the displacement of every bucket.
+	uint32_t *displacements;
+	//! the number of buckets.
+	size_t buckets;
+	//! the seed of the hash, changed until a perfect table is found.
+	uint64_t seed;
+	//! the number of extensions in the table.
+	size_t count;
+	//! the text of the file, the extensions and types point into it.
+	char *text;
+} mimeTable;
+
+/**
+ * @brief Function name: mimeTableLoad
+ * Reads the mime-types file given by @param path (one ".extension type" pair per line) and replaces the current table
+ * with the new one. The first entry of an extension listed more than once is used.
+ *
+ * @param path - the path of the mime-types file.
+ * @return int - the number of extensions loaded, -1 if the file could not be read (the current table is kept).
+ */
+int mimeTableLoad(const char *path);
+
+/**
+ * @brief Function name: getMimeType
+ * This function is used to determine the mime-type of the file passed in as a paramter.
+ * It extracts the file extension of the filename passed in as @param name and looks it up in the table read from the
+ * mime-types.tsv file, without allocating memory.
+ *
+ * If the appropriate mime-type is found, it is returned, if not, the application/octet-stream mime-type is returned
+ * to indicate to the client that the mime-type for the file is unknown.
+ *
+ * If a user wishes to add a mime-type + file extension combination to improve compatiblity, they may do so by editing the mime-types.tsv file
+ * found in the root directory of the server and sending SIGHUP to the server to reload it.
+ *
+ * @param name - char* pointing to a C-Style string containing the path to file to be sent to client.
+ * @return const char* - the mime-type to use for the file requested, valid at least until the table is reloaded twice.
+ */
+const char *getMimeType(const char *name);
+
+/**
+ * @brief Function name: mimeCompressible
+ * Determines whether files of the mime-type @param type are worth compressing. Images, audio, video, archives and
+ * documents such as pdf are compressed by their format already, and unknown (application/octet-stream) files are
+ * usually binary, compressing them again costs cpu time without making them smaller.
+ *
+ * @param type - the mime-type, as returned by getMimeType.
+ * @return int - 1 if the files should be compressed, 0 otherwise.
+ */
+int mimeCompressible(const char *type);
+
+#endif
@@ -0,0 +1,349 @@
+
+/**
+ * @file pool.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Worker pool implementation file.
+ * This file contains the lock-free connection queues and the pool of worker threads that adopt the
+ * accepted connections, including the stealing of queued connections by idle workers.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "server.h"
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+//! the workers of the pool.
+worker *workers = NULL;
+
+//! the number of workers in the pool.
+int workerCount = 0;
+
+//! the number of connections a single worker serves at the same time.
+int workerConnections = DEFAULT_WORKER_CONNECTIONS;
+
+//! the number of ssl contexts the workers use, one per listening socket.
+int poolContextCount = 0;
+
+//! set once the pool drains, the workers then finish their open responses and close their connections.
+atomic_int poolDraining = 0;
+
+//! the time (monotonicNanos) the draining workers close the connections that have not finished yet.
+uint64_t poolDrainDeadline = 0;
+
+//! the current ssl contexts, worker i takes poolContexts[i % poolContextCount].
+static SSL_CTX **poolContexts = NULL;
+
+//! incremented whenever the contexts are replaced, a worker with an older generation takes the new context.
+static atomic_ulong contextGeneration = 0;
+
+//! held while the contexts are replaced or a worker takes a reference to one of them.
+static pthread_mutex_t contextLock = PTHREAD_MUTEX_INITIALIZER;
+
+//! the worker that receives the next accepted connection (round-robin), only used by the single accept thread without -j.
+static unsigned int nextWorker = 0;
+
+/**
+ * @brief Function name: queueInit
+ * Allocates the slots of the queue given by @param queue. The number of slots is @param size rounded up to a power of two.
+ *
+ * @param queue - connectionQueue* to the queue to initialise.
+ * @param size - the minimum number of sockets the queue must hold.
+ * @return int - 0 on success, -1 if the slots could not be allocated.
+ */
+int queueInit(connectionQueue *queue, size_t size)
+{
+	size_t slots = 2;
+	while(slots < size){
+		slots <<= 1;
+	}
+	queue->cells = malloc(slots * sizeof(queueCell));
+	if(queue->cells == NULL){
+		return -1;
+	}
+	for(size_t i = 0; i < slots; i++){
+		atomic_init(&queue->cells[i].sequence, i);
+		queue->cells[i].client.fd = -1;
+	}
+	queue->mask = slots - 1;
+	atomic_init(&queue->enqueuePos, 0);
+	atomic_init(&queue->dequeuePos, 0);
+	return 0;
+}
+
+/**
+ * @brief Function name: queuePush
+ * Adds the accepted socket @param client to the queue given by @param queue without locking.
+ *
+ * @param queue - connectionQueue* to the queue.
+ * @param client - the accepted socket.
+ * @return int - 1 if the socket was queued, 0 if the queue is full.
+ */
+int queuePush(connectionQueue *queue, acceptedClient client)
+{
+	size_t pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+	queueCell *cell;
+	while(1){
+		cell = &queue->cells[pos & queue->mask];
+		size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+		if(diff == 0){
+			// the slot is free, claim it
+			if(atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)){
+				break;
+			}
+		} else if(diff < 0){
+			return 0; // the slot still holds a socket from the previous lap, the queue is full
+		} else {
+			pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+		}
+	}
+	cell->client = client;
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+	return 1;
+}
+
+/**
+ * @brief Function name: queuePop
+ * Removes the oldest socket from the queue given by @param queue without locking.
+ * Used both by the owning worker and by workers stealing from it.
+ *
+ * @param queue - connectionQueue* to the queue.
+ * @param client - acceptedClient* set to the socket removed from the queue.
+ * @return int - 1 if a socket was removed, 0 if the queue is empty.
+ */
+int queuePop(connectionQueue *queue, acceptedClient *client)
+{
+	size_t pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+	queueCell *cell;
+	while(1){
+		cell = &queue->cells[pos & queue->mask];
+		size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+		if(diff == 0){
+			// the slot is filled, claim it
+			if(atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)){
+				break;
+			}
+		} else if(diff < 0){
+			return 0; // nothing has been pushed to the slot yet, the queue is empty
+		} else {
+			pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+		}
+	}
+	*client = cell->client;
+	atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+	return 1;
+}
+
+/**
+ * @brief Function name: queueLength
+ * Returns the (approximate) number of sockets in the queue given by @param queue.
+ *
+ * @param queue - connectionQueue* to the queue.
+ * @return size_t - the number of queued sockets.
+ */
+size_t queueLength(connectionQueue *queue)
+{
+	size_t head = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+	return tail > head ? tail - head : 0;
+}
+
+/**
+ * @brief Function name: poolWake
+ * Wakes the worker given by @param target from epoll_wait.
+ *
+ * @param target - worker* to the worker to wake.
+ */
+void poolWake(worker *target)
+{
+	uint64_t one = 1;
+	if(write(target->wakeFd, &one, sizeof(one)) < 0){
+		// the counter is already non-zero, the worker will wake anyway
+	}
+}
+
+/**
+ * @brief Function name: poolStart
+ * Creates the worker pool and starts every worker thread (see workerRun).
+ * Worker i uses the ssl context contexts[i % contextCount], with more than one context every worker is
+ * pinned to the cpu core with its index so that it shares the core with the accept thread of its listener.
+ * The pool takes over the references to the contexts.
+ *
+ * @param count - the number of workers, 0 to use one worker per online cpu core.
+ * @param queueSize - the number of accepted connections each worker queue can hold.
+ * @param maxConnections - the number of connections each worker serves at the same time.
+ * @param contexts - the ssl contexts used by the workers.
+ * @param contextCount - the number of contexts.
+ * @return int - 0 on success, -1 if the pool could not be created.
+ */
+int poolStart(int count, size_t queueSize, int maxConnections, SSL_CTX **contexts, int contextCount)
+{
+	if(count <= 0){
+		count = sysconf(_SC_NPROCESSORS_ONLN);
+		if(count <= 0){
+			count = 1;
+		}
+	}
+	workers = calloc(count, sizeof(worker));
+	poolContexts = malloc(contextCount * sizeof(SSL_CTX*));
+	if(workers == NULL || poolContexts == NULL){
+		return -1;
+	}
+	memcpy(poolContexts, contexts, contextCount * sizeof(SSL_CTX*));
+	poolContextCount = contextCount;
+	workerConnections = maxConnections;
+	for(int i = 0; i < count; i++){
+		worker *self = &workers[i];
+		self->id = i;
+		self->context = contexts[i % contextCount];
+		SSL_CTX_up_ref(self->context);
+		self->pinned = contextCount > 1;
+		self->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		self->epollFd = epoll_create1(EPOLL_CLOEXEC);
+		if(self->wakeFd < 0 || self->epollFd < 0 || queueInit(&self->queue, queueSize) < 0){
+			perror("ERROR: could not create the worker pool");
+			return -1;
+		}
+		atomic_init(&self->idle, 0);
+	}
+	// the count is published before any worker can steal from the others
+	workerCount = count;
+	for(int i = 0; i < count; i++){
+		if(pthread_create(&workers[i].thread, NULL, workerRun, &workers[i]) != 0){
+			printf("ERROR: could not create worker thread %d\n", i);
+			return -1;
+		}
+	}
+	printf("Started %d worker threads\n", count);
+	return 0;
+}
+
+/**
+ * @brief Function name: poolSwapContexts
+ * Replaces the ssl contexts of the pool by the @param contexts (poolContextCount of them), for example after the certificate
+ * was reloaded. The pool takes over the references to the new contexts and drops those to the previous ones. Every worker
+ * takes the new context before it adopts its next connection (see poolRefreshContext), the open connections keep using the
+ * context they were created with.
+ *
+ * @param contexts - the new ssl contexts.
+ */
+void poolSwapContexts(SSL_CTX **contexts)
+{
+	pthread_mutex_lock(&contextLock);
+	for(int i = 0; i < poolContextCount; i++){
+		SSL_CTX_free(poolContexts[i]); // freed once the last worker and connection using it let go
+		poolContexts[i] = contexts[i];
+	}
+	atomic_fetch_add_explicit(&contextGeneration, 1, memory_order_relaxed);
+	pthread_mutex_unlock(&contextLock);
+}
+
+/**
+ * @brief Function name: poolRefreshContext
+ * Takes the current ssl context of the pool for the worker given by @param self if it was replaced since the worker took its
+ * context. Only the worker itself calls this, it costs a single comparison while the contexts are unchanged.
+ *
+ * @param self - worker* to the worker.
+ */
+void poolRefreshContext(worker *self)
+{
+	if(atomic_load_explicit(&contextGeneration, memory_order_relaxed) == self->contextGeneration){
+		return;
+	}
+	// the lock keeps the context from being freed between reading it and taking the reference
+	pthread_mutex_lock(&contextLock);
+	SSL_CTX *context = poolContexts[self->id % poolContextCount];
+	SSL_CTX_up_ref(context);
+	self->contextGeneration = atomic_load_explicit(&contextGeneration, memory_order_relaxed);
+	pthread_mutex_unlock(&contextLock);
+	SSL_CTX_free(self->context);
+	self->context = context;
+}
+
+/**
+ * @brief Function name: poolDrain
+ * Lets the workers finish the responses they are writing and waits for them to exit. Idle connections are closed at once,
+ * the others after their current response; those still open after @param timeout seconds are closed.
+ * The accepting of new clients must be stopped first (see reactorStop).
+ *
+ * @param timeout - the number of seconds the open responses are given to finish.
+ */
+void poolDrain(int timeout)
+{
+	poolDrainDeadline = monotonicNanos() + (uint64_t)timeout * 1000000000UL;
+	atomic_store_explicit(&poolDraining, 1, memory_order_release);
+	for(int i = 0; i < workerCount; i++){
+		poolWake(&workers[i]);
+	}
+	for(int i = 0; i < workerCount; i++){
+		pthread_join(workers[i].thread, NULL);
+	}
+}
+
+/**
+ * @brief Function name: poolSubmit
+ * Hands the accepted socket @param client to the pool. The workers are tried in turn, starting at @param preferredWorker
+ * or, if it is -1, after the worker that received the previous connection (round-robin), until one has room in its queue.
+ * The chosen worker is woken, should its queue already hold connections it has not adopted yet an idle
+ * worker is woken as well so that it can steal them.
+ *
+ * @param client - the accepted socket.
+ * @param preferredWorker - the index of the worker to try first, -1 for round-robin.
+ * @return int - 1 if the socket was queued, 0 if every worker queue is full.
+ */
+int poolSubmit(acceptedClient client, int preferredWorker)
+{
+	unsigned int first = preferredWorker >= 0 ? (unsigned int)preferredWorker : nextWorker;
+	for(int i = 0; i < workerCount; i++){
+		worker *target = &workers[(first + i) % workerCount];
+		if(!queuePush(&target->queue, client)){
+			continue;
+		}
+		if(preferredWorker < 0){
+			nextWorker = target->id + 1;
+		}
+		poolWake(target);
+		if(queueLength(&target->queue) > 1){
+			// the target is behind, let an idle worker steal from it
+			for(int j = 1; j < workerCount; j++){
+				worker *thief = &workers[(target->id + j) % workerCount];
+				if(atomic_load_explicit(&thief->idle, memory_order_relaxed)){
+					poolWake(thief);
+					break;
+				}
+			}
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Function name: poolTake
+ * Returns the next accepted socket the worker given by @param self should adopt. Its own queue is used first,
+ * when it is empty the queues of the other workers are stolen from.
+ *
+ * @param self - worker* to the worker looking for work.
+ * @param client - acceptedClient* set to the socket to adopt.
+ * @return int - 1 if a socket was found, 0 if every queue is empty.
+ */
+int poolTake(worker *self, acceptedClient *client)
+{
+	if(queuePop(&self->queue, client)){
+		return 1;
+	}
+	for(int i = 1; i < workerCount; i++){
+		worker *victim = &workers[(self->id + i) % workerCount];
+		if(queuePop(&victim->queue, client)){
+			return 1;
+		}
+	}
+	return 0;
+}
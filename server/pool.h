@@ -0,0 +1,246 @@
+#ifndef POOL_H
+#define POOL_H
+
+/**
+ * @file pool.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the worker pool and the lock-free connection queues used to hand accepted
+ * clients from the accepting thread to the worker threads that serve them.
+ * See files pool.c and reactor.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "openssl/ssl.h"
+#include "histogram.h"
+#include "disk.h"
+#include "memory.h"
+#include "stats.h"
+
+//! the default number of accepted connections each worker queue can hold.
+#define DEFAULT_QUEUE_SIZE 1024
+
+//! the default number of connections a single worker serves at the same time.
+#define DEFAULT_WORKER_CONNECTIONS 16384
+
+//! the default number of seconds the open connections are given to finish their responses when the server stops.
+#define DEFAULT_DRAIN_TIMEOUT 10
+
+//! An accepted socket waiting to be adopted by a worker.
+typedef struct acceptedClient
+{
+	//! the accepted socket.
+	int fd;
+	//! the time (monotonicNanos) the socket was accepted.
+	uint64_t acceptedAt;
+} acceptedClient;
+
+//! A slot of a connection queue, the sequence number tells producers and consumers whether the slot is free or filled.
+typedef struct queueCell
+{
+	//! the position of the queue this slot can be used for next.
+	atomic_size_t sequence;
+	//! the accepted socket stored in the slot.
+	acceptedClient client;
+} queueCell;
+
+/**
+ * @brief A bounded, lock-free, multi-producer multi-consumer queue of accepted sockets.
+ * The accepting thread pushes to it, the owning worker pops from it and idle workers steal from it.
+ */
+typedef struct connectionQueue
+{
+	//! the slots of the queue, the number of slots is a power of two.
+	queueCell *cells;
+	//! the number of slots minus one.
+	size_t mask;
+	//! the next position to push to.
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t enqueuePos;
+	//! the next position to pop from.
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t dequeuePos;
+} connectionQueue;
+
+struct connection;
+
+//! A worker thread running its own event loop over the connections it adopted.
+typedef struct worker
+{
+	//! the index of the worker in the pool.
+	int id;
+	//! the thread running the worker.
+	pthread_t thread;
+	//! non-zero if the worker is pinned to the cpu core with its index.
+	int pinned;
+	//! the ssl context used for the new connections of the worker, the worker holds a reference to it.
+	SSL_CTX *context;
+	//! the generation of the pool contexts the context was taken from (see poolSwapContexts).
+	unsigned long contextGeneration;
+	//! the epoll instance of the worker's event loop.
+	int epollFd;
+	//! eventfd written to wake the worker when a connection was queued for it.
+	int wakeFd;
+	//! set while the worker is waiting for events with no work to do.
+	atomic_int idle;
+	//! the number of connections the worker is serving, only changed by the worker itself.
+	int active;
+	//! the connection of the worker that has been idle the longest, closed first when it times out.
+	struct connection *idleHead;
+	//! the connection of the worker that was active last.
+	struct connection *idleTail;
+	//! the accepted connections waiting to be adopted by this worker (or stolen by another).
+	connectionQueue queue;
+	//! the counters of the worker, read by the server console and the stats endpoint.
+	workerStats stats;
+	//! the connections of the worker, at most workerConnections.
+	slabPool connections;
+	//! the write buffers of the connections of the worker that are writing a response.
+	slabPool writeBuffers;
+	//! the asynchronous reads of the large files sent by the worker.
+	diskReader disk;
+	//! the latencies of the phases of the connections served by the worker, indexed by connectionPhase.
+	latencyHistogram phases[PHASE_COUNT];
+} worker;
+
+//! the workers of the pool.
+extern worker *workers;
+
+//! the number of workers in the pool.
+extern int workerCount;
+
+//! the number of connections a single worker serves at the same time.
+extern int workerConnections;
+
+//! the number of ssl contexts the workers use, one per listening socket.
+extern int poolContextCount;
+
+//! set once the pool drains, the workers then finish their open responses and close their connections.
+extern atomic_int poolDraining;
+
+//! the time (monotonicNanos) the draining workers close the connections that have not finished yet.
+extern uint64_t poolDrainDeadline;
+
+/**
+ * @brief Function name: queueInit
+ * Allocates the slots of the queue given by @param queue. The number of slots is @param size rounded up to a power of two.
+ *
+ * @param queue - connectionQueue* to the queue to initialise.
+ * @param size - the minimum number of sockets the queue must hold.
+ * @return int - 0 on success, -1 if the slots could not be allocated.
+ */
+int queueInit(connectionQueue *queue, size_t size);
+
+/**
+ * @brief Function name: queuePush
+ * Adds the accepted socket @param client to the queue given by @param queue without locking.
+ *
+ * @param queue - connectionQueue* to the queue.
+ * @param client - the accepted socket.
+ * @return int - 1 if the socket was queued, 0 if the queue is full.
+ */
+int queuePush(connectionQueue *queue, acceptedClient client);
+
+/**
+ * @brief Function name: queuePop
+ * Removes the oldest socket from the queue given by @param queue without locking.
+ * Used both by the owning worker and by workers stealing from it.
+ *
+ * @param queue - connectionQueue* to the queue.
+ * @param client - acceptedClient* set to the socket removed from the queue.
+ * @return int - 1 if a socket was removed, 0 if the queue is empty.
+ */
+int queuePop(connectionQueue *queue, acceptedClient *client);
+
+/**
+ * @brief Function name: queueLength
+ * Returns the (approximate) number of sockets in the queue given by @param queue.
+ *
+ * @param queue - connectionQueue* to the queue.
+ * @return size_t - the number of queued sockets.
+ */
+size_t queueLength(connectionQueue *queue);
+
+/**
+ * @brief Function name: poolStart
+ * Creates the worker pool and starts every worker thread (see workerRun).
+ * Worker i uses the ssl context contexts[i % contextCount], with more than one context every worker is
+ * pinned to the cpu core with its index so that it shares the core with the accept thread of its listener.
+ * The pool takes over the references to the contexts.
+ *
+ * @param count - the number of workers, 0 to use one worker per online cpu core.
+ * @param queueSize - the number of accepted connections each worker queue can hold.
+ * @param maxConnections - the number of connections each worker serves at the same time.
+ * @param contexts - the ssl contexts used by the workers.
+ * @param contextCount - the number of contexts.
+ * @return int - 0 on success, -1 if the pool could not be created.
+ */
+int poolStart(int count, size_t queueSize, int maxConnections, SSL_CTX **contexts, int contextCount);
+
+/**
+ * @brief Function name: poolSubmit
+ * Hands the accepted socket @param client to the pool. The workers are tried in turn, starting at @param preferredWorker
+ * or, if it is -1, after the worker that received the previous connection (round-robin), until one has room in its queue.
+ * The chosen worker is woken, should its queue already hold connections it has not adopted yet an idle
+ * worker is woken as well so that it can steal them.
+ *
+ * @param client - the accepted socket.
+ * @param preferredWorker - the index of the worker to try first, -1 for round-robin.
+ * @return int - 1 if the socket was queued, 0 if every worker queue is full.
+ */
+int poolSubmit(acceptedClient client, int preferredWorker);
+
+/**
+ * @brief Function name: poolTake
+ * Returns the next accepted socket the worker given by @param self should adopt. Its own queue is used first,
+ * when it is empty the queues of the other workers are stolen from.
+ *
+ * @param self - worker* to the worker looking for work.
+ * @param client - acceptedClient* set to the socket to adopt.
+ * @return int - 1 if a socket was found, 0 if every queue is empty.
+ */
+int poolTake(worker *self, acceptedClient *client);
+
+/**
+ * @brief Function name: poolSwapContexts
+ * Replaces the ssl contexts of the pool by the @param contexts (poolContextCount of them), for example after the certificate
+ * was reloaded. The pool takes over the references to the new contexts and drops those to the previous ones. Every worker
+ * takes the new context before it adopts its next connection (see poolRefreshContext), the open connections keep using the
+ * context they were created with.
+ *
+ * @param contexts - the new ssl contexts.
+ */
+void poolSwapContexts(SSL_CTX **contexts);
+
+/**
+ * @brief Function name: poolRefreshContext
+ * Takes the current ssl context of the pool for the worker given by @param self if it was replaced since the worker took its
+ * context. Only the worker itself calls this, it costs a single comparison while the contexts are unchanged.
+ *
+ * @param self - worker* to the worker.
+ */
+void poolRefreshContext(worker *self);
+
+/**
+ * @brief Function name: poolDrain
+ * Lets the workers finish the responses they are writing and waits for them to exit. Idle connections are closed at once,
+ * the others after their current response; those still open after @param timeout seconds are closed.
+ * The accepting of new clients must be stopped first (see reactorStop).
+ *
+ * @param timeout - the number of seconds the open responses are given to finish.
+ */
+void poolDrain(int timeout);
+
+/**
+ * @brief Function name: poolWake
+ * Wakes the worker given by @param target from epoll_wait.
+ *
+ * @param target - worker* to the worker to wake.
+ */
+void poolWake(worker *target);
+
+#endif
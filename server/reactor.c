@@ -0,0 +1,977 @@
+
+/**
+ * @file reactor.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Event loop implementation file.
+ * This file contains the epoll event loop that accepts clients and drives the ssl handshake,
+ * request and response of every connection without blocking.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <limits.h>
+
+//! the number of seconds a connection may be idle before it is closed.
+int keepAliveTimeout = DEFAULT_KEEPALIVE_TIMEOUT;
+
+//! the number of requests served on one persistent connection before it is closed.
+int maxRequests = DEFAULT_MAX_REQUESTS;
+
+//! the number of connections whose responses were encrypted by the kernel (kTLS).
+atomic_ulong kernelTlsConnections = 0;
+
+//! the payload of the first records of a response, 0 to always write records of MAX_RECORD_SIZE.
+int initialRecordSize = DEFAULT_INITIAL_RECORD_SIZE;
+
+//! the eventfd made readable by reactorStop, it is in the epoll set of every accept loop and never read.
+static int stopFd = -1;
+
+//! creates stopFd once, before the first accept loop or stop.
+static pthread_once_t stopOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Function name: countWrites
+ * BIO callback of the socket of a connection, counts the write system calls made for the worker passed as the callback argument.
+ *
+ * @param bio - BIO* to the socket bio.
+ * @param oper - the operation, the call after a write has BIO_CB_WRITE | BIO_CB_RETURN set.
+ * @param argp - unused.
+ * @param len - unused.
+ * @param argi - unused.
+ * @param argl - unused.
+ * @param ret - the result of the operation, returned unchanged.
+ * @param processed - unused.
+ * @return long - @param ret.
+ */
+static long countWrites(BIO *bio, int oper, const char *argp, size_t len, int argi, long argl, int ret, size_t *processed)
+{
+	(void)argp; (void)len; (void)argi; (void)argl; (void)processed;
+	if(oper == (BIO_CB_WRITE | BIO_CB_RETURN)){
+		worker *self = (worker*)BIO_get_callback_arg(bio);
+		statsAdd(&self->stats.writeCalls, 1);
+	}
+	return ret;
+}
+
+/**
+ * @brief Function name: idleUnlink
+ * Removes the connection given by @param conn from the idle list of its worker.
+ *
+ * @param conn - connection* to the connection.
+ */
+static void idleUnlink(connection *conn)
+{
+	worker *self = conn->owner;
+	if(conn->idlePrev != NULL){
+		conn->idlePrev->idleNext = conn->idleNext;
+	} else {
+		self->idleHead = conn->idleNext;
+	}
+	if(conn->idleNext != NULL){
+		conn->idleNext->idlePrev = conn->idlePrev;
+	} else {
+		self->idleTail = conn->idlePrev;
+	}
+	conn->idlePrev = conn->idleNext = NULL;
+}
+
+/**
+ * @brief Function name: connectionTouch
+ * Marks the connection given by @param conn as active now by moving it to the end of the idle list of its worker.
+ * Since every connection has the same timeout, the list stays ordered by the time the connections time out.
+ *
+ * @param conn - connection* to the connection.
+ */
+static void connectionTouch(connection *conn)
+{
+	worker *self = conn->owner;
+	conn->lastActive = monotonicNanos();
+	if(self->idleTail == conn){
+		return;
+	}
+	if(conn->idlePrev != NULL || self->idleHead == conn){
+		idleUnlink(conn);
+	}
+	conn->idlePrev = self->idleTail;
+	if(self->idleTail != NULL){
+		self->idleTail->idleNext = conn;
+	} else {
+		self->idleHead = conn;
+	}
+	self->idleTail = conn;
+}
+
+/**
+ * @brief Function name: connectionClose
+ * Shuts down the ssl session, closes the socket, releases the file being sent and returns the connection and its write
+ * buffer to the pools of the worker.
+ * Closing the socket removes it from the epoll set.
+ *
+ * @param conn - connection* to the connection to close.
+ */
+static void connectionClose(connection *conn)
+{
+	if(conn->state == CONN_CLOSING){
+		SSL_shutdown(conn->ssl); // send close_notify, the reply of the client is not waited for
+	}
+	SSL_free(conn->ssl);
+	close(conn->fd);
+	idleUnlink(conn);
+	conn->owner->active--;
+	atomic_store_explicit(&conn->owner->stats.active, conn->owner->active, memory_order_relaxed);
+	if(conn->diskIndex >= 0){
+		diskRelease(&conn->owner->disk, conn->diskIndex); // a read in flight keeps the buffer until it completes
+	}
+	contentRelease(conn->content);
+	slabFree(&conn->owner->writeBuffers, conn->writeBuffer);
+	slabFree(&conn->owner->connections, conn);
+}
+
+/**
+ * @brief Function name: connectionHost
+ * Stores the address of the client of @param conn in its host field for the access log, "-" if it is unknown.
+ *
+ * @param conn - connection* to the new connection.
+ */
+static void connectionHost(connection *conn)
+{
+	struct sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	const char *host = NULL;
+	if(getpeername(conn->fd, (struct sockaddr*)&address, &length) == 0){
+		if(address.ss_family == AF_INET){
+			host = inet_ntop(AF_INET, &((struct sockaddr_in*)&address)->sin_addr, conn->host, sizeof(conn->host));
+		} else if(address.ss_family == AF_INET6){
+			host = inet_ntop(AF_INET6, &((struct sockaddr_in6*)&address)->sin6_addr, conn->host, sizeof(conn->host));
+		}
+	}
+	if(host == NULL){
+		strcpy(conn->host, "-");
+	}
+}
+
+/**
+ * @brief Function name: connectionOpen
+ * Takes the connection structure from the pool of the worker, creates the ssl object for a newly accepted client and adds the
+ * socket to the epoll set. The socket is registered once for both read and write readiness in
+ * edge-triggered mode, so no further epoll_ctl calls are needed while the connection is alive.
+ *
+ * @param self - the worker adopting the connection.
+ * @param client - the non-blocking socket of the accepted client.
+ * @return connection* - the new connection, NULL if it could not be set up (the socket is closed).
+ */
+static connection *connectionOpen(worker *self, acceptedClient client)
+{
+	int fd = client.fd;
+	connection *conn = slabAlloc(&self->connections);
+	if(conn == NULL){
+		close(fd);
+		return NULL;
+	}
+	memset(conn, 0, offsetof(connection, scratchMemory)); // the read buffer and arena are only read after being written
+	arenaInit(&conn->scratch, conn->scratchMemory, sizeof(conn->scratchMemory));
+	conn->fd = fd;
+	conn->owner = self;
+	conn->diskIndex = -1;
+	httpRequestInit(&conn->request);
+	conn->phaseStart = monotonicNanos();
+	histogramRecord(&self->phases[PHASE_ACCEPT], conn->phaseStart - client.acceptedAt);
+	connectionTouch(conn);
+	conn->state = CONN_HANDSHAKE;
+	if(logAccessEnabled){
+		connectionHost(conn);
+	}
+	conn->ssl = SSL_new(self->context);
+	if(conn->ssl == NULL || SSL_set_fd(conn->ssl, fd) != 1){
+		logOpenSslErrors(LOG_ERROR);
+		SSL_free(conn->ssl);
+		close(fd);
+		slabFree(&self->connections, conn);
+		return NULL;
+	}
+	BIO *socketBio = SSL_get_wbio(conn->ssl);
+	BIO_set_callback_arg(socketBio, (char*)self);
+	BIO_set_callback_ex(socketBio, countWrites);
+	SSL_set_accept_state(conn->ssl);
+	self->active++;
+	statsAdd(&self->stats.connections, 1);
+	atomic_store_explicit(&self->stats.active, self->active, memory_order_relaxed);
+
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = conn;
+	if(epoll_ctl(self->epollFd, EPOLL_CTL_ADD, fd, &event) < 0){
+		logError("could not add client to epoll: %s", strerror(errno));
+		connectionClose(conn);
+		return NULL;
+	}
+	return conn;
+}
+
+/**
+ * @brief Function name: reactorPrintStats
+ * Prints the number of responses of every worker and the TLS records, write system calls and bytes per response to @param out,
+ * followed by the connections and write buffers taken from the pools of the workers.
+ *
+ * @param out - FILE* to write the counters to.
+ */
+void reactorPrintStats(FILE *out)
+{
+	workerStats total;
+	statsCollect(&total);
+	unsigned long responses = total.responses, records = total.records, writeCalls = total.writeCalls, bytes = total.responseBytes;
+	fprintf(out, "Responses: %lu", responses);
+	if(responses > 0){
+		fprintf(out, ", %.1f TLS records, %.1f write system calls and %.0f bytes per response",
+			(double)records / responses, (double)writeCalls / responses, (double)bytes / responses);
+	}
+	fprintf(out, "\n");
+	// the pools are owned by the workers, their counters are only read here
+	slabPool connections = {0}, writeBuffers = {0};
+	for(int i = 0; i < workerCount; i++){
+		connections.objectSize = workers[i].connections.objectSize;
+		connections.inUse += workers[i].connections.inUse;
+		connections.capacity += workers[i].connections.capacity;
+		writeBuffers.objectSize = workers[i].writeBuffers.objectSize;
+		writeBuffers.inUse += workers[i].writeBuffers.inUse;
+		writeBuffers.capacity += workers[i].writeBuffers.capacity;
+	}
+	slabPrintStats(out, "Pooled connections", &connections);
+	slabPrintStats(out, "Pooled write buffers", &writeBuffers);
+}
+
+/**
+ * @brief Function name: connectionReadFile
+ * Starts reading the next bytes of the mapped file sent on the connection given by @param conn into a read buffer of the
+ * worker, behind the response header if responseStart placed it there. The worker continues with other connections,
+ * the completion (see diskCompleted) resumes this one.
+ *
+ * @param conn - connection* to the connection sending a mapped file.
+ * @return int - 0 if the read was started, -1 if no buffer is free or the read failed (the file is then sent from its mapping).
+ */
+static int connectionReadFile(connection *conn)
+{
+	diskReader *disk = &conn->owner->disk;
+	if(conn->diskIndex < 0){
+		conn->diskIndex = diskAcquire(disk, conn);
+		if(conn->diskIndex < 0){
+			return -1;
+		}
+	}
+	if(!conn->diskAppend){
+		conn->diskStart = conn->diskEnd = 0;
+	}
+	size_t length = DISK_BUFFER_SIZE - conn->diskEnd;
+	if((off_t)length > conn->fileRemaining){
+		length = conn->fileRemaining;
+	}
+	if(diskRead(disk, conn->diskIndex, conn->diskEnd, conn->content, conn->fileOffset, length) < 0){
+		conn->diskAppend = 0;
+		return -1;
+	}
+	conn->diskReading = 1;
+	return 0;
+}
+
+/**
+ * @brief Function name: connectionFlush
+ * Writes the pending response of the connection given by @param conn to the client.
+ * The header in the write buffer is written first, thereafter the cached file straight from its memory, or a mapped
+ * file read asynchronously into a buffer of the worker (see connectionReadFile), or with SSL_sendfile from the open file
+ * of a mapped entry when the kernel encrypts the connection.
+ *
+ * @param conn - connection* to the connection with a pending response.
+ * @return int - 1 if the whole response was written, 0 if the socket would block and -1 on an error.
+ */
+int connectionFlush(connection *conn)
+{
+	while(1){
+		const char *pending;
+		size_t pendingLength;
+		int fromDisk = 0;
+		if(conn->writeOffset < conn->writeLength){
+			pending = conn->writeBuffer + conn->writeOffset;
+			pendingLength = conn->writeLength - conn->writeOffset;
+			if(pendingLength > conn->recordSize){
+				pendingLength = conn->recordSize;
+			}
+		} else if(conn->diskReading){
+			return 0; // the completion of the read resumes the connection
+		} else if(conn->diskStart < conn->diskEnd && !conn->diskAppend){
+			// bytes read from disk into the buffer of the worker, written a record at a time
+			pending = diskBuffer(&conn->owner->disk, conn->diskIndex) + conn->diskStart;
+			pendingLength = conn->diskEnd - conn->diskStart;
+			if(pendingLength > conn->recordSize){
+				pendingLength = conn->recordSize;
+			}
+			fromDisk = 1;
+		} else if(conn->fileRemaining <= 0){
+			if(conn->diskIndex >= 0){
+				diskRelease(&conn->owner->disk, conn->diskIndex);
+				conn->diskIndex = -1;
+				conn->diskStart = conn->diskEnd = 0;
+			}
+			if(!rangeNextPart(conn)){
+				return 1;
+			}
+			continue;
+		} else if(conn->kernelTls && conn->content->fd >= 0){
+			// the kernel encrypts the file as it sends it, without copying it through user space
+			ossl_ssize_t sent = SSL_sendfile(conn->ssl, conn->content->fd, conn->fileOffset, conn->fileRemaining, 0);
+			statsAdd(&conn->owner->stats.writeCalls, 1);
+			if(sent > 0){
+				if(!conn->firstByteSent){
+					conn->firstByteSent = 1;
+					histogramRecord(&conn->owner->phases[PHASE_FIRST_BYTE], monotonicNanos() - conn->requestAt);
+				}
+				conn->fileOffset += sent;
+				conn->fileRemaining -= sent;
+				continue;
+			}
+			if(SSL_get_error(conn->ssl, (int)sent) == SSL_ERROR_WANT_WRITE){
+				return 0;
+			}
+			// the kernel refused to send the file, fall back to writing it from memory
+			logWarning("SSL_sendfile failed, falling back to buffered writes");
+			ERR_clear_error();
+			conn->kernelTls = 0;
+			continue;
+		} else if(conn->content->fd >= 0 && (connectionReadFile(conn) == 0 || conn->diskStart < conn->diskEnd)){
+			// a mapped file is read without blocking on the disk, a header left in the buffer by a failed read is written alone
+			if(conn->diskReading){
+				return 0;
+			}
+			continue;
+		} else {
+			// written from the cached copy, one record per call. A retry after SSL_ERROR_WANT_WRITE passes the same
+			// bytes again, the record size only grows while a response is written so the retry is never shorter
+			pending = conn->content->data + conn->fileOffset;
+			pendingLength = conn->fileRemaining < (off_t)conn->recordSize ? (size_t)conn->fileRemaining : conn->recordSize;
+		}
+
+		int written = SSL_write(conn->ssl, pending, pendingLength);
+		if(written > 0){
+			statsAdd(&conn->owner->stats.records, 1);
+			conn->lastWriteAt = monotonicNanos();
+			if(conn->recordSize < MAX_RECORD_SIZE){
+				conn->smallRecordBytes += written;
+				if(conn->smallRecordBytes >= RECORD_BOOST_BYTES){
+					conn->recordSize = MAX_RECORD_SIZE; // the congestion window has opened, use full records
+				}
+			}
+			if(!conn->firstByteSent){
+				conn->firstByteSent = 1;
+				histogramRecord(&conn->owner->phases[PHASE_FIRST_BYTE], monotonicNanos() - conn->requestAt);
+			}
+			if(conn->writeOffset < conn->writeLength){
+				conn->writeOffset += written;
+			} else if(fromDisk){
+				conn->diskStart += written;
+			} else {
+				conn->fileOffset += written;
+				conn->fileRemaining -= written;
+			}
+			continue;
+		}
+		switch(SSL_get_error(conn->ssl, written)){
+			case SSL_ERROR_WANT_WRITE:
+			case SSL_ERROR_WANT_READ:
+				return 0;
+			default:
+				return -1;
+		}
+	}
+}
+
+/**
+ * @brief Function name: requestComplete
+ * Resumes parsing the request of the connection given by @param conn over the bytes received since the last call.
+ * Once the request header is complete requestLength is set to its length, bytes following it belong to the next,
+ * pipelined request. A malformed or too large request is complete as well, its request state is HTTP_ERROR.
+ *
+ * @param conn - connection* to the connection.
+ * @return int - 1 if the request header is complete (or can not be parsed), 0 if more bytes are needed.
+ */
+static int requestComplete(connection *conn)
+{
+	httpParseResult result = httpParse(&conn->request, conn->readBuffer, conn->readLength, REQUEST_BUFFER_SIZE - 1);
+	if(result == HTTP_INCOMPLETE){
+		return 0;
+	}
+	if(result == HTTP_COMPLETE){
+		conn->requestLength = conn->request.length;
+	} else {
+		logInfo("%s request from client", result == HTTP_TOO_LARGE ? "too large" : "malformed");
+		conn->requestLength = conn->readLength; // nothing after it can be trusted
+	}
+	return 1;
+}
+
+/**
+ * @brief Function name: connectionRead
+ * Reads the request from the client until its header is complete, or the socket would block. The request is parsed
+ * as it arrives, so it may be split over any number of reads and ssl records. A request that was pipelined behind
+ * the previous one may already be in the buffer, in which case nothing is read.
+ *
+ * @param conn - connection* to the connection in the CONN_READING state.
+ * @return int - 1 if a complete request is in the buffer, 0 if the socket would block and -1 if the
+ * client closed the connection or an error occurred.
+ */
+static int connectionRead(connection *conn)
+{
+	if(conn->readLength > 0 && requestComplete(conn)){
+		return 1;
+	}
+	while(1){
+		int received = SSL_read(conn->ssl, conn->readBuffer + conn->readLength, REQUEST_BUFFER_SIZE - 1 - conn->readLength);
+		if(received > 0){
+			conn->readLength += received;
+			if(requestComplete(conn)){
+				return 1;
+			}
+			continue;
+		}
+		switch(SSL_get_error(conn->ssl, received)){
+			case SSL_ERROR_WANT_READ:
+			case SSL_ERROR_WANT_WRITE:
+				return 0;
+			default:
+				return -1;
+		}
+	}
+}
+
+/**
+ * @brief Function name: requestFinished
+ * Removes the request that has just been answered from the read buffer of the connection given by @param conn,
+ * moving any pipelined request that follows it to the front, and prepares the connection for the next request: its
+ * write buffer goes back to the pool of the worker and its arena is reset.
+ *
+ * @param conn - connection* to the connection.
+ */
+static void requestFinished(connection *conn)
+{
+	size_t remaining = conn->readLength - conn->requestLength;
+	memmove(conn->readBuffer, conn->readBuffer + conn->requestLength, remaining);
+	conn->readLength = remaining;
+	conn->requestLength = 0;
+	httpRequestInit(&conn->request);
+	conn->writeLength = 0;
+	conn->writeOffset = 0;
+	conn->firstByteSent = 0;
+	conn->rangeCount = 0;
+	contentRelease(conn->content);
+	conn->content = NULL;
+	slabFree(&conn->owner->writeBuffers, conn->writeBuffer); // an idle connection holds no write buffer
+	conn->writeBuffer = NULL;
+	arenaReset(&conn->scratch);
+	conn->path = NULL;
+	conn->phaseStart = monotonicNanos();
+}
+
+/**
+ * @brief Function name: responseStart
+ * Prepares the response set up by sendResponse for writing. The record size starts small again if the connection
+ * was idle, and the first part of the file is copied behind the header so that the header and the start of the
+ * body leave in one TLS record (and one system call).
+ *
+ * @param conn - connection* to the connection with a prepared response.
+ */
+static void responseStart(connection *conn)
+{
+	uint64_t now = monotonicNanos();
+	if(initialRecordSize <= 0){
+		conn->recordSize = MAX_RECORD_SIZE;
+	} else if(conn->lastWriteAt == 0 || now - conn->lastWriteAt > (uint64_t)RECORD_IDLE_RESET * 1000000UL){
+		conn->recordSize = initialRecordSize < MAX_RECORD_SIZE ? (size_t)initialRecordSize : MAX_RECORD_SIZE;
+		conn->smallRecordBytes = 0;
+	}
+	if(conn->content == NULL || conn->fileRemaining <= 0 || conn->writeLength >= conn->recordSize){
+		return;
+	}
+	if(conn->content->fd >= 0 && !conn->kernelTls){
+		// a mapped file is read from disk behind the header, instead of touching (and faulting in) its mapping here
+		if(conn->diskIndex < 0){
+			conn->diskIndex = diskAcquire(&conn->owner->disk, conn);
+		}
+		if(conn->diskIndex >= 0){
+			memcpy(diskBuffer(&conn->owner->disk, conn->diskIndex), conn->writeBuffer, conn->writeLength);
+			conn->diskStart = 0;
+			conn->diskEnd = conn->writeLength;
+			conn->diskAppend = 1;
+			conn->writeLength = 0;
+			return;
+		}
+	}
+	size_t room = conn->recordSize - conn->writeLength;
+	if(room > WRITE_BUFFER_SIZE - conn->writeLength){
+		room = WRITE_BUFFER_SIZE - conn->writeLength;
+	}
+	if((off_t)room > conn->fileRemaining){
+		room = conn->fileRemaining;
+	}
+	memcpy(conn->writeBuffer + conn->writeLength, conn->content->data + conn->fileOffset, room);
+	conn->writeLength += room;
+	conn->fileOffset += room;
+	conn->fileRemaining -= room;
+}
+
+/**
+ * @brief Function name: connectionDrive
+ * Advances the connection given by @param conn through its states for as long as the socket allows.
+ * Handshake -> reading the request -> writing the response -> reading the next request (keep-alive) or closing.
+ * The function returns as soon as an ssl operation would block, the next epoll event on the socket
+ * resumes the connection in the state it was left in.
+ *
+ * @param conn - connection* to the connection that received an epoll event.
+ */
+static void connectionDrive(connection *conn)
+{
+	int result;
+	connectionTouch(conn);
+	while(1){
+		switch(conn->state){
+			case CONN_HANDSHAKE:
+				result = SSL_accept(conn->ssl);
+				if(result == 1){
+					logDebug("client ssl handshake success");
+					statsAdd(SSL_session_reused(conn->ssl) ? &conn->owner->stats.resumed : &conn->owner->stats.handshakes, 1);
+					// with SSL_OP_ENABLE_KTLS the record layer is handed to the kernel if it supports the cipher
+					conn->kernelTls = BIO_get_ktls_send(SSL_get_wbio(conn->ssl));
+					if(conn->kernelTls){
+						atomic_fetch_add_explicit(&kernelTlsConnections, 1, memory_order_relaxed);
+					}
+					uint64_t handshakeAt = monotonicNanos();
+					histogramRecord(&conn->owner->phases[PHASE_HANDSHAKE], handshakeAt - conn->phaseStart);
+					conn->phaseStart = handshakeAt;
+					conn->state = CONN_READING;
+					break;
+				}
+				switch(SSL_get_error(conn->ssl, result)){
+					case SSL_ERROR_WANT_READ:
+					case SSL_ERROR_WANT_WRITE:
+						return;
+					default:
+						logInfo("error in SSL handshake");
+						logOpenSslErrors(LOG_DEBUG);
+						connectionClose(conn);
+						return;
+				}
+
+			case CONN_READING:
+				result = connectionRead(conn);
+				if(result == 0){
+					return;
+				}
+				if(result < 0){
+					logOpenSslErrors(LOG_DEBUG);
+					connectionClose(conn);
+					return;
+				}
+				conn->requestAt = monotonicNanos();
+				histogramRecord(&conn->owner->phases[PHASE_REQUEST], conn->requestAt - conn->phaseStart);
+				logDebug("parsing request from client");
+				conn->requests++;
+				// a request that could not be parsed can not be followed by another one
+				int parsed = conn->request.state == HTTP_DONE;
+				conn->keepAlive = parsed && conn->requests < maxRequests && httpKeepAlive(&conn->request) &&
+					!atomic_load_explicit(&poolDraining, memory_order_relaxed); // a draining server closes after the response
+				char *path = parsed ? arenaAlloc(&conn->scratch, HTTP_MAX_TARGET + 1) : NULL;
+				conn->path = path != NULL && httpTargetPath(&conn->request, path, HTTP_MAX_TARGET + 1) == 0 ? path : NULL; // the requested resource
+				sendResponse(conn, conn->path); // prepare the response to the client
+				if(conn->writeLength == 0){
+					connectionClose(conn); // nothing could be sent
+					return;
+				}
+				responseStart(conn);
+				conn->state = CONN_WRITING;
+				break;
+
+			case CONN_WRITING:
+				result = connectionFlush(conn);
+				if(result == 0){
+					return;
+				}
+				if(result < 0){
+					logDebug("write failed");
+					connectionClose(conn);
+					return;
+				}
+				histogramRecord(&conn->owner->phases[PHASE_LAST_BYTE], monotonicNanos() - conn->requestAt);
+				statsAdd(&conn->owner->stats.responses, 1);
+				statsAdd(&conn->owner->stats.responseBytes, conn->responseLength);
+				statsCountStatus(&conn->owner->stats, conn->statusCode);
+				logAccess(conn->host, &conn->request, conn->statusCode, conn->responseLength);
+				if(!conn->keepAlive){
+					conn->state = CONN_CLOSING;
+					break;
+				}
+				// keep the connection open, a pipelined request may already be waiting in the buffer
+				requestFinished(conn);
+				conn->state = CONN_READING;
+				break;
+
+			case CONN_CLOSING:
+				connectionClose(conn);
+				return;
+		}
+	}
+}
+
+/**
+ * @brief Function name: diskCompleted
+ * Called by diskHarvest when a read of the connection given by @param owner completed, continues writing the response.
+ *
+ * @param owner - connection* to the connection that started the read.
+ * @param result - the bytes read, negative errno on failure.
+ */
+static void diskCompleted(void *owner, ssize_t result)
+{
+	connection *conn = (connection*)owner;
+	conn->diskReading = 0;
+	if(result <= 0){
+		logError("reading %s failed: %s", conn->content->path, result < 0 ? strerror(-result) : "end of file");
+		connectionClose(conn);
+		return;
+	}
+	conn->diskAppend = 0;
+	conn->diskEnd += result;
+	conn->fileOffset += result;
+	conn->fileRemaining -= result;
+	connectionDrive(conn);
+}
+
+/**
+ * @brief Function name: adoptConnections
+ * Adopts the connections queued for the worker given by @param self, or stolen from the other workers,
+ * while it serves less than workerConnections connections.
+ *
+ * @param self - worker* to the worker adopting connections.
+ */
+static void adoptConnections(worker *self)
+{
+	while(self->active < workerConnections){
+		acceptedClient client;
+		if(!poolTake(self, &client)){
+			return;
+		}
+		connection *conn = connectionOpen(self, client);
+		if(conn != NULL){
+			connectionDrive(conn); // the client hello is often already waiting
+		}
+	}
+}
+
+/**
+ * @brief Function name: closeIdleConnections
+ * Closes the connections of the worker given by @param self that made no progress for keepAliveTimeout seconds,
+ * for example persistent connections waiting for their next request or clients that stopped sending.
+ *
+ * @param self - worker* to the worker.
+ */
+static void closeIdleConnections(worker *self)
+{
+	uint64_t now = monotonicNanos();
+	uint64_t timeout = (uint64_t)keepAliveTimeout * 1000000000UL;
+	while(self->idleHead != NULL && now - self->idleHead->lastActive >= timeout){
+		connection *conn = self->idleHead;
+		if(conn->state == CONN_READING && conn->requests > 0){
+			conn->state = CONN_CLOSING; // an idle persistent connection, close it cleanly
+		}
+		connectionClose(conn);
+	}
+}
+
+/**
+ * @brief Function name: drainConnections
+ * Closes the connections of the draining worker given by @param self that wait for a request, those writing a response are
+ * closed after it (they are no longer kept alive). Once the drain deadline passed every connection is closed.
+ *
+ * @param self - worker* to the draining worker.
+ * @return int - non-zero once the worker has no connections left and none is queued for it.
+ */
+static int drainConnections(worker *self)
+{
+	int expired = monotonicNanos() >= poolDrainDeadline;
+	int closed = 0;
+	connection *next;
+	for(connection *conn = self->idleHead; conn != NULL; conn = next){
+		next = conn->idleNext;
+		if(conn->state == CONN_READING && conn->readLength == 0){
+			conn->state = CONN_CLOSING; // waiting for a request that is not coming yet, close it cleanly
+			connectionClose(conn);
+		} else if(expired){
+			connectionClose(conn);
+			closed++;
+		}
+	}
+	if(closed > 0){
+		logWarning("worker %d closed %d connections at the drain deadline", self->id, closed);
+	}
+	return self->active == 0 && queueLength(&self->queue) == 0;
+}
+
+/**
+ * @brief Function name: workerRun
+ * The thread function of a worker. Runs the edge-triggered epoll event loop of the worker given by @param workerPtr.
+ * Connections queued for the worker (or stolen from other workers when its own queue is empty) are adopted while the worker
+ * serves less than workerConnections connections, every adopted connection is driven through the handshake, request and
+ * response states by the readiness events of its socket.
+ *
+ * @param workerPtr - worker* to the worker to run.
+ * @return void* - Returns NULL, since the intended use is as a POSIX threaded function
+ */
+void *workerRun(void *workerPtr)
+{
+	worker *self = (worker*)workerPtr;
+	if(self->pinned){
+		pinThread(self->id);
+	}
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLET;
+	event.data.ptr = NULL; // the wake eventfd (new connections and completed reads) is the only source without a connection
+	if(epoll_ctl(self->epollFd, EPOLL_CTL_ADD, self->wakeFd, &event) < 0){
+		logError("could not add the wake eventfd to epoll: %s", strerror(errno));
+		return NULL;
+	}
+
+	// the pools are bounded by the connections a worker serves, their memory is reused rather than freed
+	slabInit(&self->connections, sizeof(connection), CONNECTION_SLAB_CHUNK, workerConnections);
+	slabInit(&self->writeBuffers, WRITE_BUFFER_SIZE, CONNECTION_SLAB_CHUNK, workerConnections);
+
+	// without buffers the large files are sent from their mapping
+	if(diskReaderInit(&self->disk, self->wakeFd) < 0){
+		logWarning("no read buffers for worker %d, files are read synchronously", self->id);
+	}
+
+	struct epoll_event events[MAX_EVENTS];
+	while(1){
+		poolRefreshContext(self); // a reloaded certificate is used from the next connection on
+		adoptConnections(self);
+		int draining = atomic_load_explicit(&poolDraining, memory_order_acquire);
+		if(draining && drainConnections(self)){
+			break;
+		}
+		closeIdleConnections(self);
+		atomic_store_explicit(&self->idle, 1, memory_order_relaxed);
+		// wake up once a second while connections are open to close the idle ones, more often to meet the drain deadline
+		int timeout = draining ? DRAIN_POLL_INTERVAL : self->idleHead != NULL ? 1000 : -1;
+		int count = epoll_wait(self->epollFd, events, MAX_EVENTS, timeout);
+		atomic_store_explicit(&self->idle, 0, memory_order_relaxed);
+		if(count < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			logError("epoll_wait failed: %s", strerror(errno));
+			return NULL;
+		}
+		int woken = 0;
+		for(int i = 0; i < count; i++){
+			if(events[i].data.ptr == NULL){
+				uint64_t wakes;
+				if(read(self->wakeFd, &wakes, sizeof(wakes)) < 0){
+					// already drained
+				}
+				woken = 1;
+				continue;
+			}
+			connectionDrive((connection*)events[i].data.ptr);
+		}
+		// the eventfd is also written for completed reads, they are harvested after the batch since a completion may close
+		// a connection that still has an event further down in it
+		if(woken){
+			diskHarvest(&self->disk, diskCompleted);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Function name: submitClient
+ * Hands the accepted socket @param client to the worker pool. Should every worker queue be full, the accepting
+ * thread waits for a worker to adopt a queued connection, so further clients wait in the listen backlog of
+ * the kernel instead of overloading the workers.
+ *
+ * @param client - the accepted socket.
+ * @param preferredWorker - the index of the worker to try first, -1 for round-robin.
+ */
+static void submitClient(acceptedClient client, int preferredWorker)
+{
+	if(poolSubmit(client, preferredWorker)){
+		return;
+	}
+	logWarning("every worker queue is full, accepting is paused");
+	struct timespec pause = { 0, 1000000 }; // 1 ms
+	do {
+		nanosleep(&pause, NULL);
+	} while(!poolSubmit(client, preferredWorker));
+	logInfo("accepting resumed");
+}
+
+/**
+ * @brief Function name: acceptClients
+ * Accepts every client waiting on the listening socket. Since the listening socket is edge-triggered,
+ * accept is called until it would block.
+ * Errors caused by a single client (aborted connections, network errors pending on the new connection) are skipped.
+ * Running out of file descriptors or memory is not fatal either, the clients stay in the listen backlog until
+ * the accept loop tries again (errno tells why it stopped).
+ *
+ * @param listenFd - the listening socket.
+ * @param preferredWorker - the index of the worker to hand the clients to first, -1 for round-robin.
+ * @return int - 0 once every waiting client was accepted, 1 if accepting must be retried later and -1 if the socket failed.
+ */
+static int acceptClients(int listenFd, int preferredWorker)
+{
+	while(1){
+		int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0){
+			switch(errno){
+				case EAGAIN:
+					return 0;
+				case EINTR:
+				case ECONNABORTED:
+				case EPROTO:
+				case EPERM:
+				case ENETDOWN:
+				case ENOPROTOOPT:
+				case EHOSTDOWN:
+				case ENONET:
+				case EHOSTUNREACH:
+				case ENETUNREACH:
+					continue;
+				case EMFILE:
+				case ENFILE:
+				case ENOBUFS:
+				case ENOMEM:
+					return 1;
+				default:
+					return -1;
+			}
+		}
+		int noDelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+		logDebug("client connection accepted");
+		acceptedClient client = { fd, monotonicNanos() };
+		submitClient(client, preferredWorker);
+	}
+}
+
+/**
+ * @brief Function name: stopFdCreate
+ * Creates the eventfd that stops the accept loops, called once through stopOnce.
+ */
+static void stopFdCreate(void)
+{
+	stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(stopFd < 0){
+		logError("could not create the stop eventfd: %s", strerror(errno));
+	}
+}
+
+/**
+ * @brief Function name: reactorRun
+ * Runs the edge-triggered epoll accept loop on the non-blocking listening socket given by @param listenFd.
+ * New clients are accepted until the socket would block and every accepted client is handed to the worker pool
+ * (see poolSubmit). Should every worker queue be full, accepting pauses until a worker has adopted a queued
+ * connection, further clients wait in the listen backlog of the kernel instead of being dropped. The same holds while the
+ * process is out of file descriptors or memory, accepting is then retried every ACCEPT_RETRY_INTERVAL milliseconds.
+ *
+ * The function returns once reactorStop was called, or if the listening socket fails with an error that can not be recovered from.
+ * The listening socket is left open.
+ *
+ * @param listenFd - the listening socket (already bound) on which clients are accepted.
+ * @param preferredWorker - the index of the worker to hand the clients to first, -1 for round-robin.
+ * @return int - 0 if the accepting was stopped, -1 if the listening socket failed.
+ */
+int reactorRun(int listenFd, int preferredWorker)
+{
+	int epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if(epollFd < 0){
+		logError("could not create the epoll instance: %s", strerror(errno));
+		return -1;
+	}
+	fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLET;
+	event.data.ptr = NULL;
+	if(epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event) < 0){
+		logError("could not add the listening socket to epoll: %s", strerror(errno));
+		close(epollFd);
+		return -1;
+	}
+	// level-triggered and never read, so that a single stop wakes every accept loop
+	pthread_once(&stopOnce, stopFdCreate);
+	event.events = EPOLLIN;
+	event.data.ptr = &stopFd;
+	if(stopFd >= 0 && epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &event) < 0){
+		logWarning("could not add the stop eventfd to epoll: %s", strerror(errno));
+	}
+
+	struct epoll_event events[1];
+	int exhausted = 0; // out of descriptors or memory, accepting is retried without waiting for a new client
+	while(1){
+		int count = epoll_wait(epollFd, events, 1, exhausted ? ACCEPT_RETRY_INTERVAL : -1);
+		if(count < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			logError("epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+		if(count > 0 && events[0].data.ptr == &stopFd){
+			close(epollFd);
+			return 0;
+		}
+		if(count == 0 && !exhausted){
+			continue;
+		}
+		int result = acceptClients(listenFd, preferredWorker);
+		if(result < 0){
+			logError("could not accept socket: %s", strerror(errno));
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, listenFd, NULL);
+			close(epollFd);
+			return -1;
+		}
+		if(result != exhausted){
+			// logged once per episode rather than for every retry
+			if(result){
+				logError("could not accept socket: %s, retrying every %d ms", strerror(errno), ACCEPT_RETRY_INTERVAL);
+			} else {
+				logInfo("accepting clients again");
+			}
+			exhausted = result;
+		}
+	}
+	close(epollFd);
+	return -1;
+}
+
+/**
+ * @brief Function name: reactorStop
+ * Stops the accept loops of every listening socket (see reactorRun), clients already accepted are still served.
+ */
+void reactorStop(void)
+{
+	pthread_once(&stopOnce, stopFdCreate);
+	uint64_t one = 1;
+	if(stopFd < 0 || write(stopFd, &one, sizeof(one)) < 0){
+		logError("could not stop accepting clients");
+	}
+}
@@ -0,0 +1,230 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+/**
+ * @file reactor.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the connection structure and the function prototypes of the epoll event loop
+ * that drives every client connection of the ssl server.
+ * See files reactor.c and server.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include "openssl/ssl.h"
+#include "openssl/err.h"
+#include <sys/types.h>
+#include <netinet/in.h>
+#include "pool.h"
+#include "content.h"
+#include "http.h"
+#include "memory.h"
+
+//! the largest request header that is accepted from a client.
+#define REQUEST_BUFFER_SIZE 8192
+
+//! the size of the buffer used to write a response header to the client, the file is written from the content cache.
+#define WRITE_BUFFER_SIZE 16384
+
+//! the number of connections (and write buffers) a worker allocates at once when its pools are empty.
+#define CONNECTION_SLAB_CHUNK 32
+
+//! the memory of the arena of a connection, holding what belongs to the current request (the requested path, response fields).
+#define CONNECTION_ARENA_SIZE 4096
+
+//! the maximum number of events handled per call to epoll_wait.
+#define MAX_EVENTS 256
+
+//! the default number of seconds a connection may be idle (keep-alive or a slow client) before it is closed.
+#define DEFAULT_KEEPALIVE_TIMEOUT 5
+
+//! the default number of requests served on one persistent connection.
+#define DEFAULT_MAX_REQUESTS 100
+
+//! the number of milliseconds between two attempts to accept clients while the process is out of file descriptors or memory.
+#define ACCEPT_RETRY_INTERVAL 10
+
+//! the number of milliseconds between two checks of the drain deadline while the workers drain.
+#define DRAIN_POLL_INTERVAL 100
+
+//! the number of seconds a connection may be idle before it is closed.
+extern int keepAliveTimeout;
+
+//! the number of requests served on one persistent connection before it is closed.
+extern int maxRequests;
+
+//! the largest payload of a TLS record.
+#define MAX_RECORD_SIZE 16384
+
+//! the default payload of the first records of a response, about one TCP segment so that the client can decrypt each packet as it arrives.
+#define DEFAULT_INITIAL_RECORD_SIZE 1400
+
+//! the number of bytes sent in small records before they grow to MAX_RECORD_SIZE, about the initial TCP congestion window.
+#define RECORD_BOOST_BYTES (16 * 1024)
+
+//! the number of milliseconds a connection has not written after which its records start small again (the congestion window shrinks).
+#define RECORD_IDLE_RESET 1000
+
+//! the payload of the first records of a response, 0 to always write records of MAX_RECORD_SIZE.
+extern int initialRecordSize;
+
+//! the number of connections whose responses were encrypted by the kernel (kTLS).
+extern atomic_ulong kernelTlsConnections;
+
+//! The states a client connection moves through in the event loop.
+typedef enum connectionState
+{
+	CONN_HANDSHAKE, //!< the ssl handshake (SSL_accept) has not completed yet.
+	CONN_READING,   //!< waiting for the complete request header from the client.
+	CONN_WRITING,   //!< the response header and file are being written to the client.
+	CONN_CLOSING    //!< the last response has been sent, the connection is shut down and freed.
+} connectionState;
+
+/**
+ * @brief A single client connection owned by the event loop.
+ * The socket is non-blocking, every ssl operation on it either completes or reports that
+ * it would block, in which case the connection waits for the next epoll event and resumes
+ * in the same state.
+ */
+typedef struct connection
+{
+	//! the non-blocking socket connected to the client.
+	int fd;
+	//! the worker whose event loop serves the connection.
+	worker *owner;
+	//! the ssl object wrapping the socket.
+	SSL *ssl;
+	//! the current state of the connection.
+	connectionState state;
+	//! the request bytes received from the client so far (NUL terminated), pipelined requests follow the current one.
+	char readBuffer[REQUEST_BUFFER_SIZE];
+	//! the number of bytes in readBuffer.
+	size_t readLength;
+	//! the length of the current request header (including the empty line ending it), 0 while it is incomplete.
+	size_t requestLength;
+	//! the current request, parsed incrementally as its bytes arrive.
+	httpRequest request;
+	//! the number of requests received on the connection.
+	int requests;
+	//! non-zero if the connection stays open after the current response.
+	int keepAlive;
+	//! the time (monotonicNanos) of the last progress on the connection, used for the idle timeout.
+	uint64_t lastActive;
+	//! the previous connection in the idle list of the worker (least recently active first).
+	struct connection *idlePrev;
+	//! the next connection in the idle list of the worker.
+	struct connection *idleNext;
+	//! the memory of the current request, reset once it was answered.
+	arena scratch;
+	//! the decoded path of the current request (in the arena), NULL if the request could not be parsed.
+	char *path;
+	//! the pending response bytes, taken from the write buffers of the worker only while a response is being written.
+	char *writeBuffer;
+	//! the number of valid bytes in writeBuffer.
+	size_t writeLength;
+	//! the number of bytes of writeBuffer already written to the client.
+	size_t writeOffset;
+	//! the cached file being sent to the client (a reference is held until it was sent), NULL if there is none.
+	contentEntry *content;
+	//! the number of bytes of the file still to be sent.
+	off_t fileRemaining;
+	//! the offset in the file of the next byte to send.
+	off_t fileOffset;
+	//! the ranges of a multipart/byteranges response, each sent as a part of its own.
+	httpRange ranges[HTTP_MAX_RANGES];
+	//! the number of ranges of a multipart/byteranges response, 0 for any other response.
+	int rangeCount;
+	//! the range whose part is sent next, rangeCount once the closing boundary is due.
+	int rangeIndex;
+	//! the read buffer of the worker holding file bytes read asynchronously (see disk.h), -1 if none is held.
+	int diskIndex;
+	//! the offset of the first byte of the read buffer not written yet.
+	size_t diskStart;
+	//! the number of valid bytes in the read buffer.
+	size_t diskEnd;
+	//! non-zero while a read into the buffer is in flight, the completion resumes the connection.
+	int diskReading;
+	//! non-zero while the buffer holds the response header, the first bytes of the file are read behind it.
+	int diskAppend;
+	//! non-zero if the kernel encrypts what is sent (kTLS), the file is then sent with SSL_sendfile.
+	int kernelTls;
+	//! the time (monotonicNanos) the current phase of the connection started.
+	uint64_t phaseStart;
+	//! the time (monotonicNanos) the complete request was received.
+	uint64_t requestAt;
+	//! non-zero once the first byte of the response has been written.
+	int firstByteSent;
+	//! the status code of the response being written, set by sendFile.
+	int statusCode;
+	//! the length of the response being written (header and body), set by sendFile.
+	size_t responseLength;
+	//! the largest payload written per TLS record (SSL_write), grows from initialRecordSize to MAX_RECORD_SIZE.
+	size_t recordSize;
+	//! the bytes written in records smaller than MAX_RECORD_SIZE since the connection was last idle.
+	size_t smallRecordBytes;
+	//! the time (monotonicNanos) of the last successful write.
+	uint64_t lastWriteAt;
+	//! the address of the client, only filled in if an access log is written.
+	char host[INET6_ADDRSTRLEN];
+	//! the memory of the arena.
+	_Alignas(MEMORY_ALIGNMENT) char scratchMemory[CONNECTION_ARENA_SIZE];
+} connection;
+
+/**
+ * @brief Function name: reactorRun
+ * Runs the edge-triggered epoll accept loop on the non-blocking listening socket given by @param listenFd.
+ * New clients are accepted until the socket would block and every accepted client is handed to the worker pool
+ * (see poolSubmit). Should every worker queue be full, accepting pauses until a worker has adopted a queued
+ * connection, further clients wait in the listen backlog of the kernel instead of being dropped. The same holds while the
+ * process is out of file descriptors or memory, accepting is then retried every ACCEPT_RETRY_INTERVAL milliseconds.
+ *
+ * The function returns once reactorStop was called, or if the listening socket fails with an error that can not be recovered from.
+ * The listening socket is left open.
+ *
+ * @param listenFd - the listening socket (already bound) on which clients are accepted.
+ * @param preferredWorker - the index of the worker to hand the clients to first, -1 for round-robin.
+ * @return int - 0 if the accepting was stopped, -1 if the listening socket failed.
+ */
+int reactorRun(int listenFd, int preferredWorker);
+
+/**
+ * @brief Function name: reactorStop
+ * Stops the accept loops of every listening socket (see reactorRun), clients already accepted are still served.
+ */
+void reactorStop(void);
+
+/**
+ * @brief Function name: workerRun
+ * The thread function of a worker. Runs the edge-triggered epoll event loop of the worker given by @param workerPtr.
+ * Connections queued for the worker (or stolen from other workers when its own queue is empty) are adopted while the worker
+ * serves less than workerConnections connections, every adopted connection is driven through the handshake, request and
+ * response states by the readiness events of its socket.
+ *
+ * @param workerPtr - worker* to the worker to run.
+ * @return void* - Returns NULL, since the intended use is as a POSIX threaded function
+ */
+void *workerRun(void *workerPtr);
+
+/**
+ * @brief Function name: reactorPrintStats
+ * Prints the number of responses of every worker and the TLS records, write system calls and bytes per response to @param out.
+ *
+ * @param out - FILE* to write the counters to.
+ */
+void reactorPrintStats(FILE *out);
+
+/**
+ * @brief Function name: connectionFlush
+ * Writes the pending response of the connection given by @param conn to the client.
+ * The header in the write buffer is written first, thereafter the cached file straight from its memory
+ * (or mapping), or with SSL_sendfile from the open file of a mapped entry when the kernel encrypts the connection.
+ *
+ * @param conn - connection* to the connection with a pending response.
+ * @return int - 1 if the whole response was written, 0 if the socket would block and -1 on an error.
+ */
+int connectionFlush(connection *conn);
+
+#endif
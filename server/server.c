@@ -13,11 +13,20 @@
  */
 #include "server.h"
 
-//! used to output the current port on which the server is listening.
-char connectedPort[STRING_SIZE] = "empty";
+//! the PEM certificate file the ssl contexts are created from, read again on SIGHUP.
+char *certificateFile = NULL;
 
-//! used to output the current hostname on which the server is listening.
-char connectedHost[STRING_SIZE] = "empty";
+//! the PEM key file the ssl contexts are created from, read again on SIGHUP.
+char *keyFile = NULL;
+
+//! the PEM passkey of the key file, kept to load the key again on SIGHUP without querying it.
+static char keyPassword[PEM_BUFSIZE];
+
+//! the length of keyPassword, -1 until the passkey was queried.
+static int keyPasswordLength = -1;
+
+//! non-zero to let the kernel encrypt the responses (kTLS) where it supports it.
+int kernelTls = 0;
 
 /**
  * @brief Function name: printHelp
@@ -29,179 +38,218 @@ void printHelp()
 	printf("A simple secure HTTPS webserver \n");
 	printf("\nUsage ./serverMain.out <optional paramters> <optional arguments> \nIf no arguments are specified the default parameter values are used.\n\n");
 	printf("-h \t \t \t Prints out the help menu \n");
-	printf("-p \t \t \t To specify the port to use.            \t Default: 4001\n");
+	printf("-p \t \t \t To specify the port (or hostname:port) to listen on, may be given up to %d times \t Default: 4001\n", MAX_LISTEN_ADDRESSES);
+	printf("-b \t \t \t To specify the backlog of pending connections of the listening sockets \t Default: %d\n", DEFAULT_LISTEN_BACKLOG);
+	printf("-D \t \t \t To specify the seconds TCP_DEFER_ACCEPT waits for the client hello (0 disables it) \t Default: %d\n", DEFAULT_DEFER_ACCEPT);
+	printf("-F \t \t \t To enable TCP fast open with a queue of the given length \t Default: disabled\n");
 	printf("-k \t \t \t To specify the key file to use         \t Default: webServ.key\n");
-	printf("-c \t \t \t To specify the certificate file to use \t Default: webServCert.crt\n\n");
+	printf("-c \t \t \t To specify the certificate file to use \t Default: webServCert.crt\n");
+	printf("-w \t \t \t To specify the number of worker threads \t Default: one per cpu core\n");
+	printf("-q \t \t \t To specify the queue size of each worker \t Default: %d\n", DEFAULT_QUEUE_SIZE);
+	printf("-m \t \t \t To specify the connections per worker  \t Default: %d\n", DEFAULT_WORKER_CONNECTIONS);
+	printf("-j \t \t \t To open N listening sockets (SO_REUSEPORT), each with its own core \t Default: 1\n");
+	printf("-s \t \t \t To specify the session cache size (0 disables it) \t Default: %d\n", DEFAULT_SESSION_CACHE_SIZE);
+	printf("-t \t \t \t To specify the session and ticket key lifetime in seconds \t Default: %d\n", DEFAULT_SESSION_TIMEOUT);
+	printf("-T \t \t \t To disable session tickets (sessions are only resumed from the cache)\n");
+	printf("-K \t \t \t To specify the idle (keep-alive) timeout in seconds \t Default: %d\n", DEFAULT_KEEPALIVE_TIMEOUT);
+	printf("-R \t \t \t To specify the requests per persistent connection \t Default: %d\n", DEFAULT_MAX_REQUESTS);
+	printf("-z \t \t \t To send files with kernel TLS (SSL_sendfile) where the kernel supports it\n");
+	printf("-C \t \t \t To specify the megabytes of memory used to cache small files \t Default: %d\n", DEFAULT_CONTENT_MEMORY);
+	printf("-r \t \t \t To specify the size of the first TLS records of a response (0: always %d) \t Default: %d\n", MAX_RECORD_SIZE, DEFAULT_INITIAL_RECORD_SIZE);
+	printf("-l \t \t \t To specify the file the messages are logged to \t Default: the standard output\n");
+	printf("-a \t \t \t To specify the access log file (combined log format) \t Default: none\n");
+	printf("-v \t \t \t To specify the log level: error, warning, info or debug \t Default: info\n");
+	printf("-d \t \t \t To specify the seconds the open connections are given to finish when the server closes \t Default: %d\n\n", DEFAULT_DRAIN_TIMEOUT);
 	
 }
 
 /**
- * @brief Function name: findPort
- * 	Used as a helper function to find a open port for the server to bind to. 
- * 	This function uses the port 4000 as a base port and adds the contents of @param counter to 4000. 
- *  Returns the string representation of the proposed port. 
- * 	Note: Does not check whether the "counter" variable is beyond a certain threshold - implementation specific. 
- * 	Does error checking to determine if the contents of @param counter is an integer. If it is not "-1" is returned to signify a problem. 
- * 
- * @param counter - Type: Integer. Contents of which are added to 4000 to specify a proposed port. 
- * @return char* - The string representation of the proposed port. 
- */
-char* findPort(int counter)
-{
-    	char *myString = malloc(20*sizeof(char));
-    	sprintf(myString, "%d", counter + 4000);
-    	return myString;
- }
-
-/**
- * @brief Function name: theServer.
- * Intended use is as a multithreaded function. Used to thread the server listening on a port. 
- * Should the server not be able to bind the specifed port, it will spawn a new thread to the smartServer() function in order to 
- * find a reasonable open port and this function will end. 
- * Should the server have the ability to bind to the specified port, it will bind to it and run and inifinite loop listening for socket connections
- * on that port. Once a client attempts to make a connection, the function will spawn a new thread for that client - running the aClient() function 
- * allowing for multiple clients to be handled simultaneously, each within its own thread. 
+ * @brief Function name: signalServer
+ * Intended use is as a multithreaded function. Every other thread blocks SIGHUP, this thread waits for it (sigwait) 
+ * and reloads the mime-types file and the certificate and key (see reloadCertificates), so the reload runs as a normal 
+ * thread rather than in a signal handler. 
+ * The content cache is flushed afterwards since its entries carry the mime-type they were loaded with. 
  * 
- * @param bioPtr - BIO* pointing to a BIO object with the ssl and tcp wrapping already implemented to enable a listening socket
+ * @param unused - not used. 
  * @return void* - Returns NULL, since the intended use is as a POSIX threaded function
  */
-void *theServer(void *bioPtr)
+void *signalServer(void *unused)
 {
-	BIO_set_nbio_accept((BIO*)bioPtr,0);
-    fflush(stdout);
+	(void)unused;
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGHUP);
 	while(1){
-		fflush(stdout);
-		if (BIO_do_accept((BIO*)bioPtr) <= 0) {
-			printf("ERROR: could not accept socket\n");
-			fflush(stdout);
-			BIO_free((BIO*)bioPtr);
-			pthread_t threadID;
-        	pthread_create(&threadID, NULL,smartServer,NULL);
-            return NULL;			
-		}
-		// Set the hostname and port
-		if(BIO_get_accept_name((BIO*)bioPtr) != NULL){
-			strcpy(connectedHost, BIO_get_accept_name((BIO*)bioPtr));
+		int received;
+		if(sigwait(&signals, &received) != 0 || received != SIGHUP){
+			continue;
 		}
-
-		if(BIO_get_accept_port((BIO*)bioPtr) != NULL){
-			strcpy(connectedPort, BIO_get_accept_port((BIO*)bioPtr));
+		if(reloadCertificates() == 0){
+			logInfo("SIGHUP: reloaded the certificate %s and key %s", certificateFile, keyFile);
 		}
-		
-		BIO* tempBio = BIO_pop((BIO*)bioPtr);
-		if(tempBio == NULL){
-			continue;
+		int count = mimeTableLoad(MIMETYPE);
+		if(count < 0){
+			logWarning("could not reload %s, the previous mime-types are kept", MIMETYPE);
+		} else {
+			logInfo("SIGHUP: reloaded %d mime-types from %s", count, MIMETYPE);
+			contentFlush();
 		}
-        pthread_t threadID;
-        pthread_create(&threadID, NULL,aClient,tempBio);
-		printf("Client thread created\n");	
-	}	
+	}
 	return NULL;
 }
 
 /**
- * @brief Function name: aClient
- * This a function intended to be used in a multithreaded manner. 
- * This function handles a connection between the secure ssl server and the client. 
- * 
- * This function is spawned when a client connects to the server. 
- * The function first performs the ssl handhake to ensure that the connection between the server and the client is secure. 
- * If the handshake fails for whatever reason, the connection is terminated and the function returns. 
- * Thereafter the client request is read into a buffer.
- * If the client request could not be read or the connection has been disconnected, the function terminates the connection (if connected) and returns. 
- * Once the client request is successfully read, the request is processed and the response is sent or written to the requested client. 
- * Thereafter the connection to the client is terminated and the function returns. 
+ * @brief Function name: pinThread
+ * Pins the calling thread to the cpu core @param core (modulo the number of online cores). 
  * 
- * This function is called in a new thread each time a new client request is received, since each new request is a new connection. 
- * The server does not store any information about a client after the connection is terminated and each connection is treated as the first initial connection.
- * 
- * @param socket - BIO* pointing to a bio object that is connected to the client. The socket on which the current connection is done. 
- * @return void* - Returns NULL, since the intended use is as a POSIX compliant threaded function
+ * @param core - the index of the core. 
  */
-void *aClient(void* socket)
+void pinThread(int core)
 {
-	printf("\nClient request received\n");
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if(cores <= 0){
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core % cores, &set);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0){
+		logWarning("could not pin thread to core %ld", core % cores);
+	}
+}
 
-	//Socket has become invalid for an undefined reason
-	if((BIO*)socket == NULL)
+/**
+ * @brief Function name: keyPasswordCallback
+ * The PEM passkey callback of the ssl contexts. The passkey is queried on the terminal when the key is first loaded and
+ * kept, so that the key can be loaded again (see reloadCertificates) without querying it.
+ *
+ * @param buffer - char* to the buffer receiving the passkey.
+ * @param size - the size of the buffer in bytes.
+ * @param rwflag - 0 since the key is only read.
+ * @param userdata - not used.
+ * @return int - the length of the passkey, -1 if it could not be queried.
+ */
+static int keyPasswordCallback(char *buffer, int size, int rwflag, void *userdata)
+{
+	if(keyPasswordLength < 0){
+		int length = PEM_def_callback(buffer, size, rwflag, userdata);
+		if(length > 0 && length <= (int)sizeof(keyPassword)){
+			memcpy(keyPassword, buffer, length);
+			keyPasswordLength = length;
+		}
+		return length;
+	}
+	if(keyPasswordLength > size){
+		return -1;
+	}
+	memcpy(buffer, keyPassword, keyPasswordLength);
+	return keyPasswordLength;
+}
+
+/**
+ * @brief Function name: createContext
+ * Creates the ssl context used to serve clients from the certificate file @param certificate and the key file @param key.
+ * The PEM passkey is queried if the key is encrypted. 
+ * The context is set up for the non-blocking connections of the event loop and uses the shared session cache (see sessionCacheAttach). 
+ * 
+ * @param certificate - char* to the path of the PEM certificate file. 
+ * @param key - char* to the path of the PEM key file. 
+ * @return SSL_CTX* - the new context, NULL if it could not be created or the files could not be loaded. 
+ */
+SSL_CTX *createContext(char *certificate, char *key)
+{
+	SSL_CTX* ctx = SSL_CTX_new(SSLv23_server_method());
+	if (ctx == NULL) 
 	{
+		logError("failed to create the SSL context");
 		return NULL;
 	}
 
-	// do ssl handshake with the client 
-	 if (BIO_do_handshake((BIO*)socket) <= 0) {
-		fprintf(stderr, "Error in SSL handshake\n");		
-		BIO_free_all((BIO*)socket);
+	if ( !SSL_CTX_use_certificate_file(ctx,certificate, SSL_FILETYPE_PEM) ) 
+	{
+		logError("failed to load certificate file %s", certificate);
+		logOpenSslErrors(LOG_ERROR);
+		SSL_CTX_free(ctx);
 		return NULL;
- 	}
-	usleep(1000); //ensure that the ssl handshake occurs and processes correctly. 
-	 
-	printf("Client ssl handshake success\n");
-
-	int readBuffer_size = 1024;	
-	char * readBuffer = malloc(sizeof(char)*1024);
+	}
 
-	if((BIO*)socket == NULL)
+	SSL_CTX_set_default_passwd_cb(ctx, keyPasswordCallback);
+	if ( !SSL_CTX_use_PrivateKey_file(ctx,key, SSL_FILETYPE_PEM) ) 
 	{
+		logError("failed to load key file %s", key);
+		logOpenSslErrors(LOG_ERROR);
+		SSL_CTX_free(ctx);
 		return NULL;
 	}
-	
-	// read information received from the client 
-	int read_result = BIO_read((BIO*)socket,readBuffer,readBuffer_size);
 
-	printf("Read result from client is: %d\n", read_result);
-	
-	//Could not read from client 
-	if (read_result  <= 0) {
-		ERR_print_errors_fp(stdout);
-		BIO_free((BIO*)socket);
-		free(readBuffer);
-		return NULL;
-		
-	} else {
-		printf("Parsing request from client\n");		
-		char * reqResource = parseRequest(readBuffer); // the requested resource
-		sendResponse((BIO*)socket, reqResource); // send the response to the client 
+	// the event loop drives every ssl connection on a non-blocking socket, a write that would block
+	// is retried later from the same buffer
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	if(kernelTls){
+		// files are then sent with SSL_sendfile, connections the kernel can not take over use buffered writes
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
 	}
-	// close the connection
-	BIO_free((BIO*)socket);
-	free(readBuffer);
-	return NULL;
+	sessionCacheAttach(ctx);
+	return ctx;
 }
 
 /**
- * @brief Function name: parseRequest
- * This function processing the request received from the client. 
- * Since the ssl server only supports "GET" http requests, it scans the 
- * request received given in @param temp, for the directory of the file requested. 
- * 
- * The requested file is then returned. If a requested file could not be found in the request header,
- * due to HTTP protcol version mismatches or any other unknown reason, NULL is returned.  
+ * @brief Function name: reloadCertificates
+ * Creates new ssl contexts (one per listening socket) from certificateFile and keyFile and hands them to the workers (see
+ * poolSwapContexts), new connections use them while the open ones keep the context they were created with. The PEM passkey
+ * given at startup is used for the key. Should the files not load, the previous contexts are kept.
+ *
+ * @return int - 0 on success, -1 if the contexts could not be created.
+ */
+int reloadCertificates(void)
+{
+	SSL_CTX *contexts[poolContextCount];
+	contexts[0] = createContext(certificateFile, keyFile);
+	if(contexts[0] == NULL){
+		logWarning("could not reload the certificate %s and key %s, the previous ones are kept", certificateFile, keyFile);
+		return -1;
+	}
+	for(int i = 1; i < poolContextCount; i++){
+		contexts[i] = cloneContext(contexts[0]);
+		if(contexts[i] == NULL){
+			while(i-- > 0){
+				SSL_CTX_free(contexts[i]);
+			}
+			return -1;
+		}
+	}
+	poolSwapContexts(contexts);
+	return 0;
+}
+
+/**
+ * @brief Function name: cloneContext
+ * Creates a new ssl context with the certificate and key of the context given by @param source, 
+ * without reading the files or querying the PEM passkey again. 
  * 
- * @param temp - char* poinuting to a C-String containing the request received from the client.  
- * @return char* - the requested file from the request header. NULL if a file path could not be found in the 
- * request header. 
+ * @param source - SSL_CTX* to the context to copy the certificate and key from. 
+ * @return SSL_CTX* - the new context, NULL if it could not be created. 
  */
-char* parseRequest(char* temp)
+SSL_CTX *cloneContext(SSL_CTX *source)
 {
-	printf("Original request header is :_%s_\n", temp);
-	char* token_string ;
-	token_string = strdup(temp);
-	const char s[3] = " \n";
-	char *token ;	
-	token = strtok(token_string, s); //tokenize the request header 
-	printf("First token is :_%s_\n", token);
-	token = strtok(NULL, s); //get second one
-	printf("Second token is:_%s_\n", token);
-	
-	if( token != NULL )
-	{	
-		char *returnTemp = strdup(&token[0]);
-		free(token_string);
-		return returnTemp;
+	SSL_CTX* ctx = SSL_CTX_new(SSLv23_server_method());
+	if (ctx == NULL) 
+	{
+		logError("failed to create the SSL context");
+		return NULL;
 	}
-	free(token_string);
-	return NULL;
+	if ( !SSL_CTX_use_certificate(ctx, SSL_CTX_get0_certificate(source)) ||
+		 !SSL_CTX_use_PrivateKey(ctx, SSL_CTX_get0_privatekey(source)) ) 
+	{
+		logError("failed to copy the certificate and key");
+		logOpenSslErrors(LOG_ERROR);
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+	SSL_CTX_set_mode(ctx, SSL_CTX_get_mode(source));
+	SSL_CTX_set_options(ctx, SSL_CTX_get_options(source));
+	sessionCacheAttach(ctx);
+	return ctx;
 }
 
 /**
@@ -219,275 +267,345 @@ char* parseRequest(char* temp)
  * 
  * If the requested resource could be found the server root directrory or sub directroy, it is sent to the client. 
  * The main purpose of this function is to determine which response is sent to the clinet. 
- * It calls the sendFile function to send/write the appropriate file to the BIO socket. 
+ * It calls the sendFile function to prepare the appropriate file to be written to the connection. 
  * 
- * @param socket - BIO* pointing to the BIO object on which the client is paired/connected. 
+ * @param conn - connection* pointing to the connection on which the client is paired/connected. 
  * @param resource - char* pointing to a c-string object conting the path to the requested resoure received from the clinet. NULL if the client 
  * sent a malformed request. 
  */
-void sendResponse(BIO* socket, char *resource)
+void sendResponse(connection* conn, char *resource)
 {
 	if(resource == NULL)
 	{
-		printf("ERROR: unable parse request - sending error page.\n");
+		logInfo("unable to parse request - sending error page");
 		resource = "/error.html";
-		sendFile(socket,resource+1,"404");
+		sendFile(conn,resource+1,404);
   		return;
 	} 
 
 	if(strcmp(resource+(strlen(resource)-1),"/") == 0 && strlen(resource)>1)
 	{		
-		printf("ERROR: unable parse request - sending error page.\n");
+		logInfo("directory %s requested - sending error page", resource);
 		resource = "/error.html";
-		sendFile(socket,resource+1,"404");
+		sendFile(conn,resource+1,404);
   		return;
 	}
 	if(strstr("/",resource) != NULL){
 		resource = "/index.html";
 	}
-	FILE* fp = NULL;
-    
-	if(strstr("/",resource) != NULL){
-		resource = "/index.html";
+
+	logDebug("resource is _%s_", resource);
+
+	if(strcmp(resource, STATS_PATH) == 0) {
+		sendStats(conn);
+		return;
 	}
 
-	printf("RESOURCE IS _%s_\n", resource);	   
-    
-	fp = fopen(resource+1,"r");
-    
-	if(fp == NULL) {
-   		printf("ERROR: unable to open file %s.\n",resource);
+	// the content cache answers whether the file exists, no file system call is made for a cached file
+	if(sendFile(conn,resource+1,200) < 0) {
+   		logInfo("unable to open file %s", resource);
 		resource = "/error.html";
-		sendFile(socket,resource+1,"404");
-  		return;
-   } else{
-		fclose(fp);
-		sendFile(socket,resource+1,"200"); //rename to send file
+		sendFile(conn,resource+1,404);
    }
 }
 
 /**
  * @brief Function name: constructHeader
  * This function constrcuts the response header sent to a client from the ssl server. 
- * Based off of the @param statusCode it constructs the appropiate response, the length of the response 
- * as well as the mimeType of the response file sent back to the client. 
+ * The header is assembled from pre-rendered pieces without formatting anything: the status line of @param statusCode
+ * (see headerStatusLine), the Date field rendered once per second (see headerDate), the header fields prepared by the
+ * content cache for the file sent (its mime-type, length, ETag and Last-Modified) and the Connection field.
  * Constructs the header according to the HTTP version 1.1 standard. 
  * 
- * returns the response header to be sent to the client. 
+ * The header is written to @param buffer, its length is returned.
  * 
- * @param statusCode - char* to a C-String object containing the response status code to be sent to the client. 
- * @param length - unsigned long containing the length in bytes of the amount of data to be sent to client
- * @param mimeType - char* to a C-String object contsaing the apprtiate mime-type of the data to be sent as a response to the client request. 
- * @return char* - the constructed response header. 
+ * @param buffer - char* to the buffer receiving the header.
+ * @param size - the size of the buffer in bytes.
+ * @param statusCode - int containing the response status code to be sent to the client. 
+ * @param entry - contentEntry* to the cached file sent as the response, NULL for a response that is not a file (only fields are sent).
+ * @param fields - header fields replacing the Content-Type and Content-Length fields of the entry (206 and 416 responses),
+ * NULL to send those of the entry. A 304 response only carries the ETag and Last-Modified fields of the entry.
+ * @param fieldsLength - the length of fields.
+ * @param keepAlive - non-zero if the connection stays open for another request after the response.
+ * @return size_t - the length of the constructed response header, 0 if it does not fit the buffer.
  */
-char *constructHeader(char * statusCode, unsigned long length, char* mimeType)
+size_t constructHeader(char *buffer, size_t size, int statusCode, contentEntry *entry, const char *fields, size_t fieldsLength, int keepAlive)
 {
-	printf("The length is :%ld\n", length);
-	FILE *stream;
-	char *buf;
-	size_t len;
-	stream = open_memstream(&buf, &len);
-	// write what you want with fprintf() into the stream
-	
-	fprintf(stream, "HTTP/1.1 ");
-	fprintf(stream, "%s", statusCode);
-	printf("STATUS CODE:____%s____\n", statusCode);
-	if(strcmp(statusCode,"200") == 0){
-		fprintf(stream, " OK");
-	} else{ 
-		fprintf(stream, " Not Found");
+	static const char keepAliveField[] = "Connection: keep-alive\r\n\r\n";
+	static const char closeField[] = "Connection: close\r\n\r\n";
+	const statusLine *status = headerStatusLine(statusCode);
+	const char *connectionField = keepAlive ? keepAliveField : closeField;
+	size_t connectionLength = keepAlive ? sizeof(keepAliveField) - 1 : sizeof(closeField) - 1;
+	// a 304 response only carries the validators, fields replace the Content-Type and Content-Length of the entry
+	const char *entryFields = entry != NULL ? entry->headerFields : NULL;
+	size_t entryLength = entry != NULL ? entry->headerLength : 0;
+	if(entry == NULL){
+		// only the fields are sent
+	} else if(fields != NULL || statusCode == 304){
+		entryFields += entry->validatorOffset;
+		entryLength -= entry->validatorOffset;
+	} else {
+		fieldsLength = 0;
+	}
+	if(status->length + DATE_FIELD_LENGTH + fieldsLength + entryLength + connectionLength > size){
+		return 0;
+	}
+	size_t length = 0;
+	memcpy(buffer, status->line, status->length);
+	length += status->length;
+	length += headerDate(buffer + length);
+	if(fieldsLength > 0){
+		memcpy(buffer + length, fields, fieldsLength);
+		length += fieldsLength;
+	}
+	if(entryLength > 0){
+		memcpy(buffer + length, entryFields, entryLength);
+		length += entryLength;
 	}
-	fprintf(stream, "\r\nContent-Type: ");
-	fprintf(stream,"%s",mimeType);
-	fprintf(stream,"\r\n\r\n");
-	fflush (stream);
-	// close the stream, the buffer is allocated and the size is set !
-	fclose(stream);
-	printf("header is \n%s\n", buf);
-	return buf;
+	memcpy(buffer + length, connectionField, connectionLength);
+	return length + connectionLength;
 }
 
 /**
- * @brief Function name: sendFile
- * This function sends or writes the appripate file to the BIO object/socket connected to the client. 
- * The function attempts to open the file with the path given by @param fileName and writes the file in "chunks" of
- * 2048 bytes. The contents of the opened file is read into a buffer and the contents of the buffer are written to the socket 
- * until the end of the file has been reached. The file is read at a rate of 2048 bytes per write. Once the entire contents of the file
- * has been written the BIO object is flushed to ensure all data is sent and the function returns. 
- * 
- * This function first constructs the appropriate response header, sends the response header, thereafter sending or writing the 
- * requested file. 
- * 
- * If the file could not be opened, due to it not existing in the root directory or sub-directory of the ssl server program, the 
- * function returns without writing anything to the client. 
- * 
- * @param socket - BIO* to a BIO object connecting the client to the ssl server. 
- * @param fileName - char* pointing to a C-String containing the requested file
- * @param statusCode - char* pointing to a C-String containing the appropiate status code to send to the client within the response header. 
+ * @brief Function name: conditionalStatus
+ * Evaluates the conditional and range header fields of the request of @param conn against the file given by @param entry
+ * (RFC 7232 and 7233). If-None-Match takes precedence over If-Modified-Since, a Range field is ignored when the
+ * If-Range field does not match the current version of the file.
+ * The satisfiable ranges are stored in the ranges of the connection.
+ *
+ * @param conn - connection* to the connection of the client.
+ * @param entry - contentEntry* to the requested file.
+ * @param rangeCount - int* receiving the number of satisfiable ranges.
+ * @return int - 304 if the client has the current version, 206 if ranges were requested, 416 if none of the requested
+ * ranges is satisfiable, 200 to send the whole file.
  */
-void sendFile(BIO* socket, char* fileName, char* statusCode) 
+static int conditionalStatus(connection *conn, contentEntry *entry, int *rangeCount)
 {
-   FILE* fp = NULL;
-  
-   unsigned long fileLen = 0;	   
-   fp = fopen(fileName,"r");
-
-   if( fp == NULL ) {
-   		printf("ERROR: unable to open file.%s\n",fileName);
-  		return;
-   }
-   fseek(fp,0,SEEK_END);
-   fileLen = ftell(fp);
-   fseek(fp,0,SEEK_SET);
-   printf("\n\n ________________\n MIMTYPE: %s\n", getMimeType(fileName));
-   char * header = constructHeader(statusCode,fileLen, getMimeType(fileName));
-   // Write the header
-   printf("The header is that is sent\n%s\n",header);
-   BIO_write(socket,header,strlen(header));
-   int bytesread;
-   unsigned char buffer[2048];
+	const httpRequest *request = &conn->request;
+	const stringView *noneMatch = httpFindHeader(request, "If-None-Match");
+	if(noneMatch != NULL){
+		if(httpEtagMatches(noneMatch, entry->etag)){
+			return 304;
+		}
+	} else {
+		const stringView *modifiedSince = httpFindHeader(request, "If-Modified-Since");
+		time_t since = modifiedSince != NULL ? httpParseDate(modifiedSince) : -1;
+		if(since >= 0 && entry->modified <= since){
+			return 304;
+		}
+	}
 
-   // Continuously write the file to bio until the whole file is written
-   while(1){
-	    bytesread = fread(buffer,sizeof(unsigned char),2048,fp);
-		if(bytesread == 0){
-			break;
+	const stringView *range = httpFindHeader(request, "Range");
+	if(range == NULL){
+		return 200;
+	}
+	const stringView *ifRange = httpFindHeader(request, "If-Range");
+	if(ifRange != NULL){
+		// an entity tag is compared strongly, a date must be the exact modification time
+		int current = ifRange->length > 0 && ifRange->data[0] == '"' ?
+			ifRange->length == strlen(entry->etag) && memcmp(ifRange->data, entry->etag, ifRange->length) == 0 :
+			httpParseDate(ifRange) == entry->modified;
+		if(!current){
+			return 200;
 		}
-		
-		if(BIO_write(socket,buffer,bytesread) <= 0){
-			printf("write failed\n");
-			break;
-		}		
-   }
-   BIO_flush(socket); //flush data to the client
-   fclose(fp);
+	}
+	*rangeCount = httpParseRange(range, entry->size, conn->ranges);
+	if(*rangeCount < 0){
+		return 200;
+	}
+	return *rangeCount > 0 ? 206 : 416;
+}
+
+/**
+ * @brief Function name: rangePartHeader
+ * Renders the boundary and header fields in front of the part of a multipart/byteranges response holding the range
+ * given by @param range of the file given by @param entry to @param buffer.
+ *
+ * @param buffer - char* to the buffer receiving the part header, may be NULL to measure it.
+ * @param size - the size of the buffer in bytes.
+ * @param entry - contentEntry* to the file sent.
+ * @param range - const httpRange* to the range of the part.
+ * @param first - non-zero for the first part, which does not start with a line break.
+ * @return size_t - the length of the part header.
+ */
+static size_t rangePartHeader(char *buffer, size_t size, contentEntry *entry, const httpRange *range, int first)
+{
+	int length = snprintf(buffer, size, "%s--" RANGE_BOUNDARY "\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+		first ? "" : "\r\n", entry->mimeType, (long long)range->first, (long long)range->last, (long long)entry->size);
+	return length > 0 ? (size_t)length : 0;
+}
+
+/**
+ * @brief Function name: rangeNextPart
+ * Prepares the next part of the multipart/byteranges response of the connection given by @param conn, called by the
+ * event loop once the previous part was written: the part header is placed in the write buffer and the range of the file
+ * is sent after it. After the last part the closing boundary is prepared.
+ *
+ * @param conn - connection* to the connection of the client.
+ * @return int - 1 if another part (or the closing boundary) was prepared, 0 if the response is complete.
+ */
+int rangeNextPart(connection *conn)
+{
+	if(conn->rangeCount == 0 || conn->rangeIndex > conn->rangeCount){
+		return 0;
+	}
+	if(conn->rangeIndex < conn->rangeCount){
+		const httpRange *range = &conn->ranges[conn->rangeIndex];
+		conn->writeLength = rangePartHeader(conn->writeBuffer, WRITE_BUFFER_SIZE, conn->content, range, 0);
+		conn->fileOffset = range->first;
+		conn->fileRemaining = range->last - range->first + 1;
+	} else {
+		memcpy(conn->writeBuffer, RANGE_CLOSING, sizeof(RANGE_CLOSING) - 1);
+		conn->writeLength = sizeof(RANGE_CLOSING) - 1;
+	}
+	conn->rangeIndex++;
+	conn->writeOffset = 0;
+	return 1;
 }
 
 /**
- * @brief Function name: smartServer. 
- * This function is a multithreaded function called when the requested port or default port for the SSL server could not be binded to,
- * due to the port being blocked, restricted or already reserved. 
+ * @brief Function name: sendFile
+ * This function prepares the appripate file to be written to the connection of the client. 
+ * The function looks the file with the path given by @param fileName up in the content cache (loading it on a miss),
+ * constructs the appropriate response header and places it in the write buffer of the connection. The event loop then
+ * writes the header, thereafter the file straight from the cache whenever the socket is ready (see connectionFlush). 
  * 
- * This function attempts to bind to an alternate port within the range 4000-4049. If no port within this range could be binded to 
- * the function ends the program, alerts; the user that no port could be found and requests the user re-run the ssl server with an alternate port speciifed. 
+ * If the client accepts it (Accept-Encoding), a compressible file is sent brotli or gzip compressed (see contentGetVariant).
+ * A file sent with the status code 200 is subject to the conditional and range fields of the request: the response is
+ * then a 304 without a body, a 206 carrying one range or a multipart/byteranges body with several, or a 416.
  * 
- * If a port could be binded to it functions in the same manner as the function theServer. See function: theServer. 
+ * If the file could not be found, due to it not existing in the root directory or sub-directory of the ssl server program, the 
+ * function returns without preparing anything. 
  * 
- * @return void* - NULL to signify the end of the thread. 
+ * @param conn - connection* to the connection of the client. 
+ * @param fileName - char* pointing to a C-String containing the requested file
+ * @param statusCode - int containing the appropiate status code to send to the client within the response header. 
+ * @return int - 0 if the response was prepared, -1 if the file could not be found.
  */
-void* smartServer()
+int sendFile(connection* conn, char* fileName, int statusCode) 
 {
-	printf("Error, the port specified was closed, attempting to self-correct\n");	
-	int counter = 1;
-	BIO *bio;
-	fflush(stdout);		
-	counter = 1;
-	char * tempPort = findPort(counter);
-	printf("Attempting to connect to port %s", tempPort);
-	bio = BIO_new_accept(tempPort);
-	fflush(stdout);
-	if (BIO_do_accept(bio) <= 0) {
-		printf("Error: Could not setup the socket\n");
-		BIO_free(bio);
-		printf("The server will now exit, please run again with another port number specified.\n");
-		exit(0);
-	}
-
-	BIO_set_nbio_accept(bio,0);
-	while(1) {
-		// Look for a port to bind to. end at 4049
-		while(BIO_do_accept(bio) <= 0) {
-			if(counter > 50){
-				printf("Error: Could not bind to given port and could not find a port within the range 4000-4050 to bind to.\n");
-				printf("The server will shutdown, please re-run and specify another port.");
-				exit(0);
-			}
-			fflush(stdout);
-			printf("ERROR: could not accept socket\n");
-			BIO_free(bio);
-			counter += 1;
-			tempPort = findPort(counter);
-			printf("Attempting to connect to port %s\n", tempPort);
-			bio = NULL ;
-			fflush(stdout);
-			bio = BIO_new_accept(tempPort);
-			if (BIO_do_accept(bio) <= 0) {
-				printf("Error: Could not setup the socket\n");
-				BIO_free(bio);
-				printf("The server will now exit, please run again with another port number specified.\n");
-				exit(0);
-			}
-			BIO_set_nbio_accept(bio,0);			
+   int cached = 0;
+   contentEntry *entry = contentGet(fileName, &cached);
+   statsAdd(cached ? &conn->owner->stats.cacheHits : &conn->owner->stats.cacheMisses, 1);
+   if(entry == NULL) {
+		return -1;
+   }
+   if(conn->writeBuffer == NULL){
+		conn->writeBuffer = slabAlloc(&conn->owner->writeBuffers);
+		if(conn->writeBuffer == NULL){
+			contentRelease(entry);
+			return -1;
+		}
+   }
+   // Accept-Encoding selects a compressed variant of the file, brotli before gzip
+   if(conn->request.state == HTTP_DONE && entry->compressible){
+		contentEntry *variant = NULL;
+		if(httpAcceptsEncoding(&conn->request, "br")){
+			variant = contentGetVariant(entry, ENCODING_BROTLI);
 		}
-		// Set the hostname and port
-		if(BIO_get_accept_name(bio) != NULL){
-			strcpy(connectedHost, BIO_get_accept_name(bio));
+		if(variant == NULL && httpAcceptsEncoding(&conn->request, "gzip")){
+			variant = contentGetVariant(entry, ENCODING_GZIP);
 		}
+		if(variant != NULL){
+			contentRelease(entry);
+			entry = variant;
+		}
+   }
+   int rangeCount = 0;
+   if(statusCode == 200){
+		statusCode = conditionalStatus(conn, entry, &rangeCount);
+   }
 
-		if(BIO_get_accept_port(bio) != NULL){
-			strcpy(connectedPort, BIO_get_accept_port(bio));
+   // Content-Type and Content-Length of the entry are only replaced for range responses
+   char *fields = arenaAlloc(&conn->scratch, RANGE_FIELDS_SIZE);
+   if(fields == NULL){
+		contentRelease(entry);
+		return -1;
+   }
+   int fieldsLength = 0;
+   off_t fileOffset = 0, fileLength = entry->size, bodyLength = entry->size;
+   conn->rangeCount = 0;
+   conn->rangeIndex = 0;
+   if(statusCode == 304){
+		fileLength = bodyLength = 0;
+   } else if(statusCode == 416){
+		fieldsLength = snprintf(fields, RANGE_FIELDS_SIZE, "Content-Range: bytes */%lld\r\nContent-Length: 0\r\n", (long long)entry->size);
+		fileLength = bodyLength = 0;
+   } else if(statusCode == 206 && rangeCount == 1){
+		fileOffset = conn->ranges[0].first;
+		fileLength = bodyLength = conn->ranges[0].last - conn->ranges[0].first + 1;
+		memcpy(fields, entry->headerFields, entry->typeLength);
+		fieldsLength = entry->typeLength + snprintf(fields + entry->typeLength, RANGE_FIELDS_SIZE - entry->typeLength,
+			"Content-Length: %lld\r\nContent-Range: bytes %lld-%lld/%lld\r\n", (long long)bodyLength,
+			(long long)conn->ranges[0].first, (long long)conn->ranges[0].last, (long long)entry->size);
+   } else if(statusCode == 206){
+		// the body is the parts of every range followed by the closing boundary, sent part by part (see rangeNextPart)
+		bodyLength = sizeof(RANGE_CLOSING) - 1;
+		for(int i = 0; i < rangeCount; i++){
+			bodyLength += rangePartHeader(NULL, 0, entry, &conn->ranges[i], i == 0) + conn->ranges[i].last - conn->ranges[i].first + 1;
 		}
-		fflush(stdout);
-		BIO* tempBio = BIO_pop(bio);
-		pthread_t threadID;
-		pthread_create(&threadID, NULL,aClient,tempBio); // spawn a client handler thread (aClient)	
-	} //End infinite listen loop
-	return NULL;	
-}
+		fieldsLength = snprintf(fields, RANGE_FIELDS_SIZE, "Content-Type: multipart/byteranges; boundary=" RANGE_BOUNDARY
+			"\r\nContent-Length: %lld\r\n", (long long)bodyLength);
+		fileOffset = conn->ranges[0].first;
+		fileLength = conn->ranges[0].last - conn->ranges[0].first + 1;
+		conn->rangeCount = rangeCount;
+		conn->rangeIndex = 1;
+   }
 
+   // The header is written first, thereafter the file (see connectionFlush)
+   conn->writeLength = constructHeader(conn->writeBuffer, WRITE_BUFFER_SIZE, statusCode, entry,
+		fieldsLength > 0 ? fields : NULL, fieldsLength, conn->keepAlive);
+   conn->responseLength = conn->writeLength + bodyLength;
+   if(conn->writeLength > 0 && conn->rangeCount > 0){
+		conn->writeLength += rangePartHeader(conn->writeBuffer + conn->writeLength, WRITE_BUFFER_SIZE - conn->writeLength,
+			entry, &conn->ranges[0], 1);
+   }
+   conn->writeOffset = 0;
+   conn->statusCode = statusCode;
+   conn->content = entry;
+   conn->fileOffset = fileOffset;
+   conn->fileRemaining = fileLength;
+   return 0;
+}
 
 /**
- * @brief TFunction name: getMimeType
- * This function is used to determine the mime-type of the file passed in as a paramter. 
- * It extracts the file extension of the filename passed in as @param name and searches the mime-types.tsv file 
- * for the appropriate mime-type. 
- * 
- * If the appropriate mime-type is found, it is returned as a char*, if not, the application/octet-stream mime-type is returned
- * to indicate to the client that the mime-type for the file is unknown. 
+ * @brief Function name: sendStats
+ * Prepares the counters of the workers (see statsRender) as the response to the client of @param conn, in the Prometheus
+ * text format if the client accepts text/plain (as Prometheus does), otherwise as JSON.
+ * The counters are rendered into the write buffer behind the room of the header, which is then placed in front of them.
  * 
- * If a user wishes to add a mime-type + file extension combination to improve compatiblity, they may do so by editing the mime-types.tsv file 
- * found in the root directory of the server. Ensure that the format is adhered to and the number found on the first line of the file is incremented
- * to ensure that the newly added mime-type is considered. 
- * 
- * @param name - char* pointing to a C-Style string containing the path to file to be sent to client.
- * @return char* - the mime-type to use for the file requested.
+ * @param conn - connection* to the connection of the client. 
+ * @return int - 0 if the response was prepared, -1 if no write buffer was available.
  */
-char * getMimeType(char *name) 
+int sendStats(connection *conn)
 {
-	char *ext = strrchr(name, '.');
-    char delimiters[] = " ";
-	char *mimeType = NULL;
-	int found = 0;
-	mimeType = malloc(128 * sizeof(char)); //return variable
-	char line[128];
-	char *token;
-	int line_counter = 1;
-	//ext++; // skip the '.';
-	FILE *mimeFile = fopen(MIMETYPE, "r"); //open the mime-type.tsv
-
-	if(mimeFile != NULL){
-		while(fgets(line, sizeof line, mimeFile) != NULL) {
-			if(line_counter > 1) {
-				if((token = strtok(line,delimiters)) != NULL) {
-					if(strcmp(token,ext) == 0) {
-						// found the appropriate mime-type
-						token = strtok(NULL, delimiters);
-						strcpy(mimeType, token);
-						found = 1;
-						break;
-					}
-				}
-			}
-			line_counter++;
+   if(conn->writeBuffer == NULL){
+		conn->writeBuffer = slabAlloc(&conn->owner->writeBuffers);
+		if(conn->writeBuffer == NULL){
+			return -1;
 		}
-		fclose(mimeFile);
-	}else {
-		printf("WARNING: Mime-types file not found, please add it to server root.\nFile must be named: \"mime-types\"\nType set to: application/octet-stream");
-		mimeType = "application/octet-stream";
-	}
-
-	if(found == 0){
-		mimeType = "application/octet-stream"; //signify unknown mime-type
-	}	
-	return mimeType;
+   }
+   const stringView *accept = httpFindHeader(&conn->request, "Accept");
+   int prometheus = accept != NULL && memmem(accept->data, accept->length, "text/plain", 10) != NULL;
+   char *body = conn->writeBuffer + STATS_HEADER_SIZE;
+   size_t bodyLength = statsRender(body, WRITE_BUFFER_SIZE - STATS_HEADER_SIZE, prometheus);
+   char *fields = arenaAlloc(&conn->scratch, RANGE_FIELDS_SIZE);
+   if(bodyLength == 0 || fields == NULL){
+		return -1;
+   }
+   int fieldsLength = snprintf(fields, RANGE_FIELDS_SIZE, "Content-Type: %s\r\nContent-Length: %zu\r\nCache-Control: no-store\r\n",
+		prometheus ? "text/plain; version=0.0.4" : "application/json", bodyLength);
+   size_t headerLength = constructHeader(conn->writeBuffer, STATS_HEADER_SIZE, 200, NULL, fields, fieldsLength, conn->keepAlive);
+   if(headerLength == 0){
+		return -1;
+   }
+   memmove(conn->writeBuffer + headerLength, body, bodyLength);
+   conn->writeLength = headerLength + bodyLength;
+   conn->responseLength = conn->writeLength;
+   conn->writeOffset = 0;
+   conn->statusCode = 200;
+   conn->rangeCount = 0;
+   conn->fileRemaining = 0;
+   return 0;
 }
+
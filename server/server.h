@@ -13,6 +13,10 @@
  *
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // accept4, cpu affinity
+#endif
+
 #include "openssl/bio.h"
 #include "openssl/ssl.h"
 #include "openssl/err.h"
@@ -23,79 +27,121 @@
 #include <string.h>
 #include <stdio.h>
 #include <string.h> 
+#include <strings.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include "reactor.h"
+#include "session.h"
+#include "content.h"
+#include "mime.h"
+#include "header.h"
+#include "stats.h"
+#include "log.h"
+#include "listener.h"
 
 
 #define STRING_SIZE 80
 #define MIMETYPE "mime-types.tsv"
 
-//! used to output the current port on which the server is listening.
-extern char connectedPort[STRING_SIZE];
+//! the boundary separating the parts of a multipart/byteranges response.
+#define RANGE_BOUNDARY "EHN410-7f3a9c2e5b1d4086"
+
+//! the closing boundary ending a multipart/byteranges response.
+#define RANGE_CLOSING "\r\n--" RANGE_BOUNDARY "--\r\n"
+
+//! the size of the header fields rendered for a 206 or 416 response (in the arena of the connection).
+#define RANGE_FIELDS_SIZE 256
+
+//! the room left for the header in front of the counters rendered by sendStats.
+#define STATS_HEADER_SIZE 512
 
-//! used to output the current hostname on which the server is listening.
-extern char connectedHost[STRING_SIZE];
+//! the PEM certificate file the ssl contexts are created from, read again on SIGHUP.
+extern char *certificateFile;
+
+//! the PEM key file the ssl contexts are created from, read again on SIGHUP.
+extern char *keyFile;
+
+//! non-zero to let the kernel encrypt the responses (kTLS) where it supports it.
+extern int kernelTls;
 
 /**
- * @brief Function name: findPort
- * 	Used as a helper function to find a open port for the server to bind to. 
- * 	This function uses the port 4000 as a base port and adds the contents of @param counter to 4000. 
- *  Returns the string representation of the proposed port. 
- * 	Note: Does not check whether the "counter" variable is beyond a certain threshold - implementation specific. 
- * 	Does error checking to determine if the contents of @param counter is an integer. If it is not "-1" is returned to signify a problem. 
- * 
- * @param counter - Type: Integer. Contents of which are added to 4000 to specify a proposed port. 
- * @return char* - The string representation of the proposed port. 
+ * @brief Function name: createContext
+ * Creates the ssl context used to serve clients from the certificate file @param certificate and the key file @param key.
+ * The PEM passkey is queried if the key is encrypted. 
+ * The context is set up for the non-blocking connections of the event loop and uses the shared session cache (see sessionCacheAttach). 
+ * 
+ * @param certificate - char* to the path of the PEM certificate file. 
+ * @param key - char* to the path of the PEM key file. 
+ * @return SSL_CTX* - the new context, NULL if it could not be created or the files could not be loaded. 
  */
-char* findPort(int);
+SSL_CTX *createContext(char *certificate, char *key);
 
 /**
- * @brief TFunction name: getMimeType
- * This function is used to determine the mime-type of the file passed in as a paramter. 
- * It extracts the file extension of the filename passed in as @param name and searches the mime-types.tsv file 
- * for the appropriate mime-type. 
- * 
- * If the appropriate mime-type is found, it is returned as a char*, if not, the application/octet-stream mime-type is returned
- * to indicate to the client that the mime-type for the file is unknown. 
- * 
- * If a user wishes to add a mime-type + file extension combination to improve compatiblity, they may do so by editing the mime-types.tsv file 
- * found in the root directory of the server. Ensure that the format is adhered to and the number found on the first line of the file is incremented
- * to ensure that the newly added mime-type is considered. 
- * 
- * @param name - char* pointing to a C-Style string containing the path to file to be sent to client.
- * @return char* - the mime-type to use for the file requested.
+ * @brief Function name: reloadCertificates
+ * Creates new ssl contexts (one per listening socket) from certificateFile and keyFile and hands them to the workers (see
+ * poolSwapContexts), new connections use them while the open ones keep the context they were created with. The PEM passkey
+ * given at startup is used for the key. Should the files not load, the previous contexts are kept.
+ *
+ * @return int - 0 on success, -1 if the contexts could not be created.
  */
-char * getMimeType(char *name);
+int reloadCertificates(void);
 
 /**
- * @brief Function name: constructHeader
- * This function constrcuts the response header sent to a client from the ssl server. 
- * Based off of the @param statusCode it constructs the appropiate response, the length of the response 
- * as well as the mimeType of the response file sent back to the client. 
- * Constructs the header according to the HTTP version 1.1 standard. 
+ * @brief Function name: cloneContext
+ * Creates a new ssl context with the certificate and key of the context given by @param source, 
+ * without reading the files or querying the PEM passkey again. 
  * 
- * returns the response header to be sent to the client. 
+ * @param source - SSL_CTX* to the context to copy the certificate and key from. 
+ * @return SSL_CTX* - the new context, NULL if it could not be created. 
+ */
+SSL_CTX *cloneContext(SSL_CTX *source);
+
+/**
+ * @brief Function name: pinThread
+ * Pins the calling thread to the cpu core @param core (modulo the number of online cores). 
  * 
- * @param statusCode - char* to a C-String object containing the response status code to be sent to the client. 
- * @param length - unsigned long containing the length in bytes of the amount of data to be sent to client
- * @param mimeType - char* to a C-String object contsaing the apprtiate mime-type of the data to be sent as a response to the client request. 
- * @return char* - the constructed response header. 
+ * @param core - the index of the core. 
  */
-char *constructHeader(char *, unsigned long, char*);
+void pinThread(int core);
 
 /**
- * @brief Function name: parseRequest
- * This function processing the request received from the client. 
- * Since the ssl server only supports "GET" http requests, it scans the 
- * request received given in @param temp, for the directory of the file requested. 
+ * @brief Function name: signalServer
+ * Intended use is as a multithreaded function. Every other thread blocks SIGHUP, this thread waits for it (sigwait) 
+ * and reloads the mime-types file and the certificate and key (see reloadCertificates), so the reload runs as a normal 
+ * thread rather than in a signal handler. 
+ * The content cache is flushed afterwards since its entries carry the mime-type they were loaded with. 
  * 
- * The requested file is then returned. If a requested file could not be found in the request header,
- * due to HTTP protcol version mismatches or any other unknown reason, NULL is returned.  
+ * @param unused - not used. 
+ * @return void* - Returns NULL, since the intended use is as a POSIX threaded function
+ */
+void *signalServer(void *unused);
+
+/**
+ * @brief Function name: constructHeader
+ * This function constrcuts the response header sent to a client from the ssl server. 
+ * The header is assembled from pre-rendered pieces without formatting anything: the status line of @param statusCode
+ * (see headerStatusLine), the Date field rendered once per second (see headerDate), the header fields prepared by the
+ * content cache for the file sent (its mime-type, length, ETag and Last-Modified) and the Connection field.
+ * Constructs the header according to the HTTP version 1.1 standard. 
  * 
- * @param temp - char* poinuting to a C-String containing the request received from the client.  
- * @return char* - the requested file from the request header. NULL if a file path could not be found in the 
- * request header. 
+ * The header is written to @param buffer, its length is returned.
+ * 
+ * @param buffer - char* to the buffer receiving the header.
+ * @param size - the size of the buffer in bytes.
+ * @param statusCode - int containing the response status code to be sent to the client. 
+ * @param entry - contentEntry* to the cached file sent as the response, NULL for a response that is not a file (only fields are sent).
+ * @param fields - header fields replacing the Content-Type and Content-Length fields of the entry (206 and 416 responses),
+ * NULL to send those of the entry. A 304 response only carries the ETag and Last-Modified fields of the entry.
+ * @param fieldsLength - the length of fields.
+ * @param keepAlive - non-zero if the connection stays open for another request after the response.
+ * @return size_t - the length of the constructed response header, 0 if it does not fit the buffer.
  */
-char* parseRequest(char*);
+size_t constructHeader(char *, size_t, int, contentEntry *, const char *, size_t, int);
 
 /**
  * @brief Function name: sendResponse
@@ -109,16 +155,17 @@ char* parseRequest(char*);
  * sent as a response to the client. 
  * 
  * If client sends a GET / request to the server, the default index.html homepage is sent as a response. 
+ * A request for STATS_PATH is answered with the counters of the server (see sendStats). 
  * 
  * If the requested resource could be found the server root directrory or sub directroy, it is sent to the client. 
  * The main purpose of this function is to determine which response is sent to the clinet. 
- * It calls the sendFile function to send/write the appropriate file to the BIO socket. 
+ * It calls the sendFile function to prepare the appropriate file to be written to the connection. 
  * 
- * @param socket - BIO* pointing to the BIO object on which the client is paired/connected. 
+ * @param conn - connection* pointing to the connection on which the client is paired/connected. 
  * @param resource - char* pointing to a c-string object conting the path to the requested resoure received from the clinet. NULL if the client 
  * sent a malformed request. 
  */
-void sendResponse(BIO*, char *);
+void sendResponse(connection*, char *);
 
 /**
  * @brief Function name: printHelp
@@ -127,74 +174,47 @@ void sendResponse(BIO*, char *);
  */
 void printHelp();
 
-/**
- * @brief Function name: theServer.
- * Intended use is as a multithreaded function. Used to thread the server listening on a port. 
- * Should the server not be able to bind the specifed port, it will spawn a new thread to the smartServer() function in order to 
- * find a reasonable open port and this function will end. 
- * Should the server have the ability to bind to the specified port, it will bind to it and run and inifinite loop listening for socket connections
- * on that port. Once a client attempts to make a connection, the function will spawn a new thread for that client - running the aClient() function 
- * allowing for multiple clients to be handled simultaneously, each within its own thread. 
- * 
- * @param bioPtr - BIO* pointing to a BIO object with the ssl and tcp wrapping already implemented to enable a listening socket
- * @return void* - Returns NULL, since the intended use is as a POSIX threaded function
- */
-void* theServer(void *);
-
 /**
  * @brief Function name: sendFile
- * This function sends or writes the appripate file to the BIO object/socket connected to the client. 
- * The function attempts to open the file with the path given by @param fileName and writes the file in "chunks" of
- * 2048 bytes. The contents of the opened file is read into a buffer and the contents of the buffer are written to the socket 
- * until the end of the file has been reached. The file is read at a rate of 2048 bytes per write. Once the entire contents of the file
- * has been written the BIO object is flushed to ensure all data is sent and the function returns. 
+ * This function prepares the appripate file to be written to the connection of the client. 
+ * The function looks the file with the path given by @param fileName up in the content cache (loading it on a miss),
+ * constructs the appropriate response header and places it in the write buffer of the connection. The event loop then
+ * writes the header, thereafter the file straight from the cache whenever the socket is ready (see connectionFlush). 
  * 
- * This function first constructs the appropriate response header, sends the response header, thereafter sending or writing the 
- * requested file. 
+ * If the client accepts it (Accept-Encoding), a compressible file is sent brotli or gzip compressed (see contentGetVariant).
+ * A file sent with the status code 200 is subject to the conditional and range fields of the request: the response is
+ * then a 304 without a body, a 206 carrying one range or a multipart/byteranges body with several, or a 416.
  * 
- * If the file could not be opened, due to it not existing in the root directory or sub-directory of the ssl server program, the 
- * function returns without writing anything to the client. 
+ * If the file could not be found, due to it not existing in the root directory or sub-directory of the ssl server program, the 
+ * function returns without preparing anything. 
  * 
- * @param socket - BIO* to a BIO object connecting the client to the ssl server. 
+ * @param conn - connection* to the connection of the client. 
  * @param fileName - char* pointing to a C-String containing the requested file
- * @param statusCode - char* pointing to a C-String containing the appropiate status code to send to the client within the response header. 
+ * @param statusCode - int containing the appropiate status code to send to the client within the response header. 
+ * @return int - 0 if the response was prepared, -1 if the file could not be found.
  */
-void sendFile(BIO* socket, char*,char*);
+int sendFile(connection* conn, char*,int);
 
 /**
- * @brief Function name: aClient
- * This a function intended to be used in a multithreaded manner. 
- * This function handles a connection between the secure ssl server and the client. 
- * 
- * This function is spawned when a client connects to the server. 
- * The function first performs the ssl handhake to ensure that the connection between the server and the client is secure. 
- * If the handshake fails for whatever reason, the connection is terminated and the function returns. 
- * Thereafter the client request is read into a buffer.
- * If the client request could not be read or the connection has been disconnected, the function terminates the connection (if connected) and returns. 
- * Once the client request is successfully read, the request is processed and the response is sent or written to the requested client. 
- * Thereafter the connection to the client is terminated and the function returns. 
- * 
- * This function is called in a new thread each time a new client request is received, since each new request is a new connection. 
- * The server does not store any information about a client after the connection is terminated and each connection is treated as the first initial connection.
- * 
- * @param socket - BIO* pointing to a bio object that is connected to the client. The socket on which the current connection is done. 
- * @return void* - Returns NULL, since the intended use is as a POSIX compliant threaded function
+ * @brief Function name: sendStats
+ * Prepares the counters of the workers (see statsRender) as the response to the client of @param conn, in the Prometheus
+ * text format if the client accepts text/plain (as Prometheus does), otherwise as JSON.
+ * 
+ * @param conn - connection* to the connection of the client. 
+ * @return int - 0 if the response was prepared, -1 if no write buffer was available.
  */
-void* aClient(void *);
+int sendStats(connection *conn);
 
 /**
- * @brief Function name: smartServer. 
- * This function is a multithreaded function called when the requested port or default port for the SSL server could not be binded to,
- * due to the port being blocked, restricted or already reserved. 
- * 
- * This function attempts to bind to an alternate port within the range 4000-4049. If no port within this range could be binded to 
- * the function ends the program, alerts; the user that no port could be found and requests the user re-run the ssl server with an alternate port speciifed. 
- * 
- * If a port could be binded to it functions in the same manner as the function theServer. See function: theServer. 
- * 
- * @return void* - NULL to signify the end of the thread. 
+ * @brief Function name: rangeNextPart
+ * Prepares the next part of the multipart/byteranges response of the connection given by @param conn, called by the
+ * event loop once the previous part was written: the part header is placed in the write buffer and the range of the file
+ * is sent after it. After the last part the closing boundary is prepared.
+ *
+ * @param conn - connection* to the connection of the client.
+ * @return int - 1 if another part (or the closing boundary) was prepared, 0 if the response is complete.
  */
-void* smartServer();
+int rangeNextPart(connection *conn);
 
 #endif 
 
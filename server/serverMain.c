@@ -8,19 +8,27 @@
  * @brief  Main file to run the ssl server. 
  * 
  * This program will run a ssl server that is confiurable by PORT, IP and certificates used. 
- * All connections are created and managed using the using the OpenSSL BIO library. 
+ * All connections are served by non-blocking sockets with OpenSSL. 
  * The program can take in commandline arguments to specify the PORT, IP, keys and certificates used for the server. 
  * 
  * If no commandline arguments are specifed, the server defaults to listen on all connected interfaces and port 4001, using
  * the certificates and keys given in the root directory of the server (filenames: cert.key, cert.crt). 
  * 
- * The server first attempts to open the certficate and key files specifed and queries for the PEM passkey on success, a new SSL BIO TCP 
- * listen socket is created. The listen socket runs in it's own thread, spawning a new thread for each client conenction. 
- * The program then continues to wait for user input, should "q" be entered, the program will exit and all connected clients will disconnect. 
- * Should "i" be entered, information regarding the current listening port and hostname for the server is shown. 
+ * The server first attempts to open the certficate and key files specifed and queries for the PEM passkey on success, a TCP 
+ * listen socket is created for every address given with -p (see listener.h). Every listen socket runs in it's own thread, handing every client 
+ * conenction to a fixed pool of worker threads (-w) that serve their connections from epoll event loops without blocking. 
+ * Should a port be taken, one of the next 50 ports is used instead. 
+ * With -j N the server opens N listening sockets on the same port (SO_REUSEPORT), each with its own accept thread, worker and 
+ * ssl context pinned to its own core, so that the kernel balances new connections and handshakes between the cores. 
+ * The program then continues to wait for user input, should "q" be entered, the server stops accepting clients, gives the open connections 
+ * -d seconds to finish the responses they are writing and exits. 
+ * Sending SIGHUP to the server reloads the certificate, key and mime-types without dropping a connection, new connections use the new certificate. 
+ * Should "i" be entered, the addresses the server listens on are shown, followed by the counters of the server (also served at /__stats). 
+ * Should "l" be entered, the latency percentiles of the accept, handshake, request read, first byte and last byte phases of the connections are shown. 
+ * Should "v" be entered, followed by error, warning, info or debug, the level of the logged messages is changed. 
  * 
- * The server continuously prints out debugs to enable the user to view what th server is doing and who is connecting. All resources requested are 
- * are printed out to the terminal window. 
+ * The server logs what it is doing to the terminal window or the file given with -l, at the debug level (-v debug) every connection 
+ * and requested resource is logged. The requests can be written to an access log with -a. 
  * 
  * This server is developed as part of the required practicals for EHN-410 at the University of Pretoria. 
  * 
@@ -38,19 +46,36 @@
  */
 
 #include "server.h"
+#ifdef COUNT_ALLOCATIONS
+#include "alloccount.h"
+#endif
 
-extern char connectedPort[STRING_SIZE]; //used to output the current port on which the server is listening. 
-extern char connectedHost[STRING_SIZE]; //used to output the current hostname on which the server is listening. 
+extern int workerCount; //the number of worker threads serving the connections. 
+extern worker *workers; //the worker threads, holding the latency histograms of their connections. 
 
 
 int main(int argc, char * argv[])
 {
-    char* PORT = "4001";
+    char* addresses[MAX_LISTEN_ADDRESSES] = { "4001" }; // -p: the addresses to listen on, given once per address
+    int addressCount = 0;
+    listenOptions listening = { DEFAULT_LISTEN_BACKLOG, DEFAULT_DEFER_ACCEPT, 0, 1 };
     char* certificate = "webServCert.crt";
     char* key = "webServ.key";
+    int threads = 0; // 0 uses one worker thread per cpu core
+    int queueSize = DEFAULT_QUEUE_SIZE;
+    int maxConnections = DEFAULT_WORKER_CONNECTIONS;
+    int listeners = 1; // -j: the number of SO_REUSEPORT listening sockets, each with its own core
+    long sessionCacheSize = DEFAULT_SESSION_CACHE_SIZE;
+    long sessionTimeout = DEFAULT_SESSION_TIMEOUT;
+    int tickets = 1;
+    long contentMemory = DEFAULT_CONTENT_MEMORY; // -C: megabytes of memory for the cached small files
+    char *errorLog = NULL; // -l: the log file of the messages, the standard output by default
+    char *accessLog = NULL; // -a: the access log, none by default
+    int level = LOG_INFO; // -v: the level of the messages logged
+    int drainTimeout = DEFAULT_DRAIN_TIMEOUT; // -d: the seconds the open responses are given to finish when the server closes
     int ch; // used for commandline flags and parameters (getopt) 
 
-    while((ch = getopt(argc, argv, "p:hc:k:")) != EOF)
+    while((ch = getopt(argc, argv, "p:hc:k:w:q:m:j:s:t:TK:R:zC:r:l:a:v:d:b:D:F:")) != EOF)
     {
         switch (ch)
         {   
@@ -60,8 +85,36 @@ int main(int argc, char * argv[])
                 exit(EXIT_SUCCESS);
             //port specified
             case 'p':
-                PORT = optarg;
-                printf("The port specified is %s\n", PORT);
+                if(addressCount == MAX_LISTEN_ADDRESSES){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                addresses[addressCount++] = optarg;
+                printf("The port specified is %s\n", optarg);
+                break;
+
+            case 'b':
+                listening.backlog = atoi(optarg);
+                if(listening.backlog <= 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'D':
+                listening.deferAccept = atoi(optarg);
+                if(listening.deferAccept < 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'F':
+                listening.fastOpen = atoi(optarg);
+                if(listening.fastOpen < 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
                 break;
 
             case 'c':
@@ -74,6 +127,116 @@ int main(int argc, char * argv[])
                 printf("The key specified is %s\n", key);
                 break;
 
+            case 'w':
+                threads = atoi(optarg);
+                printf("The number of worker threads specified is %d\n", threads);
+                break;
+
+            case 'q':
+                queueSize = atoi(optarg);
+                if(queueSize <= 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'm':
+                maxConnections = atoi(optarg);
+                if(maxConnections <= 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'j':
+                listeners = atoi(optarg);
+                if(listeners <= 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                printf("The number of listening sockets specified is %d\n", listeners);
+                break;
+
+            case 's':
+                sessionCacheSize = atol(optarg);
+                if(sessionCacheSize < 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 't':
+                sessionTimeout = atol(optarg);
+                if(sessionTimeout <= 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'T':
+                tickets = 0;
+                break;
+
+            case 'K':
+                keepAliveTimeout = atoi(optarg);
+                if(keepAliveTimeout <= 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'R':
+                maxRequests = atoi(optarg);
+                if(maxRequests <= 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'z':
+                kernelTls = 1;
+                break;
+
+            case 'C':
+                contentMemory = atol(optarg);
+                if(contentMemory < 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'r':
+                initialRecordSize = atoi(optarg);
+                if(initialRecordSize < 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'l':
+                errorLog = optarg;
+                break;
+
+            case 'a':
+                accessLog = optarg;
+                break;
+
+            case 'v':
+                level = logParseLevel(optarg);
+                if(level < 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'd':
+                drainTimeout = atoi(optarg);
+                if(drainTimeout < 0){
+                    printHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
             case '?':
                 printHelp();
                 break;
@@ -93,90 +256,158 @@ int main(int argc, char * argv[])
 
     // Setup ssl key + cert
 
-    BIO* ssl_server_bio; 
-	SSL_CTX* ctx;
-	SSL* ssl;
-	
-	ctx = SSL_CTX_new(SSLv23_server_method());
-	if (ctx == NULL) 
-	{
-		printf("ERROR: failed to create the SSL context\n");
-		return 0;
-	}
-
     printf("The key is %s\n", key);
-    printf("The port is %s\n", PORT);
+    if(addressCount == 0) {
+        addressCount = 1; // the default port
+    }
+    for(int i = 0; i < addressCount; i++) {
+        printf("The port is %s\n", addresses[i]);
+    }
+    listening.perAddress = listeners;
     printf("The cert is %s\n", certificate);
 
-    if ( !SSL_CTX_use_certificate_file(ctx,certificate, SSL_FILETYPE_PEM) ) 
-	{
-	    printf("ERROR: failed to load certificate file\n");
-        ERR_print_errors_fp(stdout);
-	    return 0;
+    // SIGHUP is handled by the signal thread, every thread created from here on inherits the blocked signal
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    // the workers only copy their messages into ring buffers, the logging thread writes them
+    if(logStart(errorLog, accessLog, level) < 0){
+        return 0;
+    }
+
+    // the session cache and ticket keys are shared by every ssl context
+    if(sessionCacheInit(sessionCacheSize, sessionTimeout, tickets) < 0){
+        printf("ERROR: failed to create the session cache\n");
+        return 0;
+    }
+
+    // the mime-types are read once, and again on SIGHUP
+    if(mimeTableLoad(MIMETYPE) < 0){
+        printf("WARNING: Mime-types file not found, please add it to server root.\nFile must be named: \"%s\"\nType set to: %s\n", MIMETYPE, DEFAULT_MIME_TYPE);
     }
 
-    if ( !SSL_CTX_use_PrivateKey_file(ctx,key, SSL_FILETYPE_PEM) ) 
+    // the served files are cached in memory and invalidated when they change
+    if(contentCacheInit((size_t)contentMemory * 1024 * 1024) < 0){
+        printf("ERROR: failed to create the content cache\n");
+        return 0;
+    }
+
+    // the Date field of the responses is rendered once per second instead of for every response
+    if(headerClockStart() < 0){
+        printf("ERROR: failed to start the clock thread\n");
+        return 0;
+    }
+
+    // the files are read again on SIGHUP, with the passkey queried now
+    certificateFile = certificate;
+    keyFile = key;
+    SSL_CTX* contexts[listeners];
+    contexts[0] = createContext(certificate, key);
+    if (contexts[0] == NULL) 
     {
-	    printf("ERROR: failed to load key file\n");
-        ERR_print_errors_fp(stdout);
-	    return 0;
+        logFlush();
+        return 0;
+    }
+
+    // every listener of the -j mode gets its own ssl context, so that no state is shared between the cores
+    for(int i = 1; i < listeners; i++){
+        contexts[i] = cloneContext(contexts[0]);
+        if(contexts[i] == NULL){
+            logFlush();
+            return 0;
+        }
     }
 
-    ssl_server_bio = BIO_new_ssl(ctx, 0);
-	if (ssl_server_bio == NULL) 
-	{
-		printf("ERROR: failed retrieving the BIO object\n");
-        ERR_print_errors_fp(stdout);
-		return 0;
-	}
-
-	BIO_get_ssl(ssl_server_bio, &ssl);
-	SSL_set_mode(ssl, SSL_MODE_AUTO_RETRY);		
-	
-    printf("Attempting to create socket on port %s\n", PORT);
-    BIO *bio;
-    bio = BIO_new_accept(PORT);
-    BIO_set_accept_bios(bio, ssl_server_bio);	    
-	BIO_set_nbio_accept(bio,0);    
-
-    // if the socket fails to bind to the TCP wrapper. 
-    if (BIO_do_accept(bio) <= 0) {
+    // a client closing its connection mid-response must not terminate the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // the worker threads serve the connections accepted by the server thread(s)
+    if(poolStart(threads, queueSize, maxConnections, contexts, listeners) < 0){
+        printf("ERROR: failed to start the worker threads\n");
+        return 0;
+    }
+
+    pthread_t signalThread;
+    pthread_create(&signalThread, NULL, signalServer, NULL);
+    // with -j N every address gets N sockets on the same port, the kernel balances new connections between them
+    if(listenersStart(addresses, addressCount, &listening) < 0) {
         printf("Error: Could not setup the socket\n");
-        BIO_free(bio);
         printf("The server will now exit, please run again with another port number specified.\n");
+        logFlush();
         exit(0);
     }
 
     printf("Server online\n");
-
-    // create the server thread
-    pthread_t threadID;
- 	pthread_create(&threadID,NULL,theServer,bio);
     fflush(stdout);
     while(1) {
         fflush(stdout);
         printf("ENTER \"q\" to close server\n");
         printf("ENTER \"i\" to display status\n");
+        printf("ENTER \"l\" to display the connection latency histograms\n");
+        printf("ENTER \"v\" followed by error, warning, info or debug to change the log level\n");
         char input;
         scanf(" %c",&input);
         if( input == 'q'){
             break;
         } else if(input == 'i') {
             printf("\nYou have requested the server status:\n");
-            if(strcmp(connectedHost,"empty") == 0) {
-                printf("The server has not received any connections.\n");
+            listenersPrint(stdout);
+            printf("\n");
+            statsPrint(stdout);
+            sessionPrintStats(stdout);
+            contentPrintStats(stdout);
+            diskPrintStats(stdout);
+            reactorPrintStats(stdout);
+#ifdef COUNT_ALLOCATIONS
+            // the allocations since the status was last shown, zero per response once the worker pools are warm
+            static unsigned long lastAllocations = 0, lastOpensslAllocations = 0, lastResponses = 0;
+            unsigned long allocations = allocationCount(), opensslAllocations = opensslAllocationCount(), responses = 0;
+            for(int i = 0; i < workerCount; i++) {
+                responses += atomic_load(&workers[i].stats.responses);
+            }
+            printf("Heap allocations since the last status: %lu by the server, %lu by OpenSSL",
+                allocations - lastAllocations, opensslAllocations - lastOpensslAllocations);
+            if(responses > lastResponses) {
+                printf(" (%.2f and %.2f per response)", (double)(allocations - lastAllocations) / (responses - lastResponses),
+                    (double)(opensslAllocations - lastOpensslAllocations) / (responses - lastResponses));
+            }
+            printf("\n");
+            lastAllocations = allocationCount();
+            lastOpensslAllocations = opensslAllocationCount();
+            lastResponses = responses;
+#endif
+            if(kernelTls) {
+                printf("Connections using kernel TLS:     %lu\n", atomic_load(&kernelTlsConnections));
+            }
+            printf("\n");
+         } else if(input == 'l') {
+            printf("\nConnection phase latencies (all workers):\n");
+            for(int phase = 0; phase < PHASE_COUNT; phase++) {
+                histogramPrint(stdout, phaseNames[phase], &workers[0].phases[phase], workerCount, sizeof(worker));
+            }
+            printf("\n");
+         } else if(input == 'v') {
+            char name[16];
+            int newLevel = scanf(" %15s", name) == 1 ? logParseLevel(name) : -1;
+            if(newLevel < 0) {
+                printf("INFO: unknown log level. Please enter error, warning, info or debug\n");
             } else {
-                printf("The connected host is: %s\n", connectedHost);
-                printf("The connected port is: %s\n\n", connectedPort);
+                logSetLevel(newLevel);
+                printf("Logging %s messages and above\n", logLevelNames[newLevel]);
             }
          } else { 
             printf("INFO: unknown command. Please Enter a valid command \n");
         }         	  
     }	
-	printf("\nServer closed\n");
-	pthread_cancel(threadID);
-	BIO_free(bio);
-    BIO_free_all(bio);
-	return 0;
+    // stop accepting, then let the workers finish the responses they are writing
+    printf("\nNo longer accepting clients, the open connections are given %d seconds to finish\n", drainTimeout);
+    fflush(stdout);
+    listenersStop();
+    poolDrain(drainTimeout);
+    logFlush();
+    printf("Server closed\n");
+    return 0;
 }
     
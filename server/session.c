@@ -0,0 +1,461 @@
+
+/**
+ * @file session.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Session cache implementation file.
+ * This file contains the sharded server-side session cache and the rotating session ticket keys shared by
+ * every ssl context of the server.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "server.h"
+#include "openssl/rand.h"
+#include "openssl/evp.h"
+#include "openssl/core_names.h"
+
+//! the counters of the session cache and the handshakes.
+sessionStats sessionCounters;
+
+//! the shards of the session cache, NULL if the cache is disabled.
+static sessionShard *shards = NULL;
+
+//! the number of seconds a session stays valid.
+static long sessionTimeout = DEFAULT_SESSION_TIMEOUT;
+
+//! non-zero if session tickets are issued.
+static int ticketsEnabled = 1;
+
+//! the ticket keys, index 0 is the newest key and is used to issue tickets.
+static ticketKey ticketKeys[TICKET_KEYS];
+
+//! the number of valid ticket keys.
+static int ticketKeyCount = 0;
+
+//! protects the ticket keys, written only when the keys are rotated.
+static pthread_rwlock_t ticketLock = PTHREAD_RWLOCK_INITIALIZER;
+
+//! the session id context, sessions are only resumed by contexts with the same id context.
+static const unsigned char sessionContextId[] = "EHN410-server";
+
+/**
+ * @brief Function name: sessionHash
+ * Hashes the session id given by @param id (FNV-1a).
+ *
+ * @param id - the session id.
+ * @param length - the length of the session id.
+ * @return size_t - the hash of the id.
+ */
+static size_t sessionHash(const unsigned char *id, unsigned int length)
+{
+	size_t hash = 14695981039346656037UL;
+	for(unsigned int i = 0; i < length; i++){
+		hash ^= id[i];
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+/**
+ * @brief Function name: shardUnlink
+ * Removes the entry given by @param entry from the hash bucket and the least-recently-used list of @param shard.
+ * The shard must be locked, the entry is not freed.
+ *
+ * @param shard - sessionShard* to the shard holding the entry.
+ * @param entry - sessionEntry* to the entry to remove.
+ * @param hash - the hash of the session id of the entry.
+ */
+static void shardUnlink(sessionShard *shard, sessionEntry *entry, size_t hash)
+{
+	sessionEntry **link = &shard->buckets[hash & shard->mask];
+	while(*link != NULL && *link != entry){
+		link = &(*link)->next;
+	}
+	if(*link == entry){
+		*link = entry->next;
+	}
+	if(entry->lruPrev != NULL){
+		entry->lruPrev->lruNext = entry->lruNext;
+	} else {
+		shard->lruHead = entry->lruNext;
+	}
+	if(entry->lruNext != NULL){
+		entry->lruNext->lruPrev = entry->lruPrev;
+	} else {
+		shard->lruTail = entry->lruPrev;
+	}
+	shard->count--;
+}
+
+/**
+ * @brief Function name: shardFind
+ * Finds the entry with the session id @param id in @param shard. The shard must be locked.
+ *
+ * @param shard - sessionShard* to the shard to search.
+ * @param id - the session id.
+ * @param length - the length of the session id.
+ * @param hash - the hash of the session id.
+ * @return sessionEntry* - the entry, NULL if the session is not cached.
+ */
+static sessionEntry *shardFind(sessionShard *shard, const unsigned char *id, unsigned int length, size_t hash)
+{
+	for(sessionEntry *entry = shard->buckets[hash & shard->mask]; entry != NULL; entry = entry->next){
+		if(entry->idLength == length && memcmp(entry->id, id, length) == 0){
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Function name: shardPushFront
+ * Links the entry given by @param entry at the front of the least-recently-used list of @param shard.
+ * The shard must be locked and the entry must not be linked in the list.
+ *
+ * @param shard - sessionShard* to the shard holding the entry.
+ * @param entry - sessionEntry* to the entry.
+ */
+static void shardPushFront(sessionShard *shard, sessionEntry *entry)
+{
+	entry->lruPrev = NULL;
+	entry->lruNext = shard->lruHead;
+	if(shard->lruHead != NULL){
+		shard->lruHead->lruPrev = entry;
+	}
+	shard->lruHead = entry;
+	if(shard->lruTail == NULL){
+		shard->lruTail = entry;
+	}
+}
+
+/**
+ * @brief Function name: sessionNew
+ * OpenSSL callback called when a new session was established. The session is serialized and stored in its
+ * shard, evicting the least recently used session if the shard is full.
+ *
+ * @param ssl - SSL* to the connection that created the session.
+ * @param session - SSL_SESSION* to the new session.
+ * @return int - 0, the session is copied and no reference to it is kept.
+ */
+static int sessionNew(SSL *ssl, SSL_SESSION *session)
+{
+	(void)ssl;
+	unsigned int idLength;
+	const unsigned char *id = SSL_SESSION_get_id(session, &idLength);
+	int derLength = i2d_SSL_SESSION(session, NULL);
+	if(idLength == 0 || derLength <= 0 || derLength > MAX_SESSION_SIZE){
+		return 0;
+	}
+	sessionEntry *entry = malloc(sizeof(sessionEntry) + derLength);
+	if(entry == NULL){
+		return 0;
+	}
+	unsigned char *der = entry->der;
+	entry->derLength = i2d_SSL_SESSION(session, &der);
+	memcpy(entry->id, id, idLength);
+	entry->idLength = idLength;
+	entry->expires = time(NULL) + sessionTimeout;
+
+	size_t hash = sessionHash(id, idLength);
+	sessionShard *shard = &shards[hash % SESSION_SHARDS];
+	sessionEntry *evicted = NULL;
+	pthread_mutex_lock(&shard->lock);
+	sessionEntry *old = shardFind(shard, id, idLength, hash);
+	if(old != NULL){
+		shardUnlink(shard, old, hash);
+	} else if(shard->count >= shard->capacity && shard->lruTail != NULL){
+		evicted = shard->lruTail;
+		shardUnlink(shard, evicted, sessionHash(evicted->id, evicted->idLength));
+	}
+	size_t bucket = hash & shard->mask;
+	entry->next = shard->buckets[bucket];
+	shard->buckets[bucket] = entry;
+	shardPushFront(shard, entry);
+	shard->count++;
+	pthread_mutex_unlock(&shard->lock);
+
+	free(old);
+	if(evicted != NULL){
+		free(evicted);
+		atomic_fetch_add_explicit(&sessionCounters.evicted, 1, memory_order_relaxed);
+	}
+	atomic_fetch_add_explicit(&sessionCounters.stored, 1, memory_order_relaxed);
+	return 0;
+}
+
+/**
+ * @brief Function name: sessionGet
+ * OpenSSL callback called when a client offers a session id. The session is looked up in its shard and,
+ * if it has not expired, returned to OpenSSL as a new session object.
+ *
+ * @param ssl - SSL* to the connection resuming the session.
+ * @param id - the session id offered by the client.
+ * @param length - the length of the session id.
+ * @param copy - set to 0, the returned session belongs to OpenSSL.
+ * @return SSL_SESSION* - the session, NULL if it is not cached or has expired.
+ */
+static SSL_SESSION *sessionGet(SSL *ssl, const unsigned char *id, int length, int *copy)
+{
+	(void)ssl;
+	*copy = 0;
+	if(length <= 0 || length > SSL_MAX_SSL_SESSION_ID_LENGTH){
+		atomic_fetch_add_explicit(&sessionCounters.misses, 1, memory_order_relaxed);
+		return NULL;
+	}
+	size_t hash = sessionHash(id, length);
+	sessionShard *shard = &shards[hash % SESSION_SHARDS];
+	unsigned char der[MAX_SESSION_SIZE];
+	int derLength = 0;
+	sessionEntry *expired = NULL;
+
+	pthread_mutex_lock(&shard->lock);
+	sessionEntry *entry = shardFind(shard, id, length, hash);
+	if(entry != NULL){
+		shardUnlink(shard, entry, hash);
+		if(entry->expires < time(NULL)){
+			expired = entry;
+		} else {
+			derLength = entry->derLength;
+			memcpy(der, entry->der, derLength);
+			// re-link as the most recently used entry
+			size_t bucket = hash & shard->mask;
+			entry->next = shard->buckets[bucket];
+			shard->buckets[bucket] = entry;
+			shardPushFront(shard, entry);
+			shard->count++;
+		}
+	}
+	pthread_mutex_unlock(&shard->lock);
+	free(expired);
+
+	if(derLength == 0){
+		atomic_fetch_add_explicit(&sessionCounters.misses, 1, memory_order_relaxed);
+		return NULL;
+	}
+	const unsigned char *derPtr = der;
+	SSL_SESSION *session = d2i_SSL_SESSION(NULL, &derPtr, derLength);
+	atomic_fetch_add_explicit(session != NULL ? &sessionCounters.hits : &sessionCounters.misses, 1, memory_order_relaxed);
+	return session;
+}
+
+/**
+ * @brief Function name: sessionRemove
+ * OpenSSL callback called when a session must no longer be resumed (for example after a fatal alert).
+ *
+ * @param ctx - SSL_CTX* to the context the session belongs to.
+ * @param session - SSL_SESSION* to the session to remove.
+ */
+static void sessionRemove(SSL_CTX *ctx, SSL_SESSION *session)
+{
+	(void)ctx;
+	unsigned int idLength;
+	const unsigned char *id = SSL_SESSION_get_id(session, &idLength);
+	size_t hash = sessionHash(id, idLength);
+	sessionShard *shard = &shards[hash % SESSION_SHARDS];
+	pthread_mutex_lock(&shard->lock);
+	sessionEntry *entry = shardFind(shard, id, idLength, hash);
+	if(entry != NULL){
+		shardUnlink(shard, entry, hash);
+	}
+	pthread_mutex_unlock(&shard->lock);
+	free(entry);
+}
+
+/**
+ * @brief Function name: ticketKeyGenerate
+ * Fills the ticket key given by @param key with a new random name and new random keys.
+ *
+ * @param key - ticketKey* to the key to generate.
+ * @return int - 0 on success, -1 if no random bytes were available.
+ */
+static int ticketKeyGenerate(ticketKey *key)
+{
+	if(RAND_bytes(key->name, sizeof(key->name)) != 1 ||
+	   RAND_bytes(key->aesKey, sizeof(key->aesKey)) != 1 ||
+	   RAND_bytes(key->hmacKey, sizeof(key->hmacKey)) != 1){
+		return -1;
+	}
+	key->created = time(NULL);
+	return 0;
+}
+
+/**
+ * @brief Function name: ticketKeysRotate
+ * Replaces the newest ticket key with a new one once it is older than the session timeout. The older keys
+ * move down the ring so that tickets issued with them are still accepted (and renewed) until they drop out.
+ */
+static void ticketKeysRotate(void)
+{
+	pthread_rwlock_wrlock(&ticketLock);
+	if(time(NULL) - ticketKeys[0].created >= sessionTimeout){
+		ticketKey fresh;
+		if(ticketKeyGenerate(&fresh) == 0){
+			memmove(&ticketKeys[1], &ticketKeys[0], (TICKET_KEYS - 1) * sizeof(ticketKey));
+			ticketKeys[0] = fresh;
+			if(ticketKeyCount < TICKET_KEYS){
+				ticketKeyCount++;
+			}
+		}
+	}
+	pthread_rwlock_unlock(&ticketLock);
+}
+
+/**
+ * @brief Function name: ticketKeyCallback
+ * OpenSSL callback used to encrypt a new session ticket (@param enc set) with the newest ticket key, or to
+ * find the key a ticket presented by a client was encrypted with.
+ *
+ * @param ssl - SSL* to the connection.
+ * @param keyName - the name of the key, written when encrypting and read when decrypting.
+ * @param iv - the initialisation vector of the ticket.
+ * @param cipher - EVP_CIPHER_CTX* to initialise with the AES key.
+ * @param mac - EVP_MAC_CTX* to initialise with the HMAC key.
+ * @param enc - non-zero when a ticket is issued, zero when a ticket is presented.
+ * @return int - 1 on success, 2 if the ticket is valid but must be renewed, 0 if the ticket key is unknown, -1 on an error.
+ */
+static int ticketKeyCallback(SSL *ssl, unsigned char keyName[16], unsigned char *iv, EVP_CIPHER_CTX *cipher, EVP_MAC_CTX *mac, int enc)
+{
+	(void)ssl;
+	ticketKey key;
+	int result = 1;
+
+	if(time(NULL) - ticketKeys[0].created >= sessionTimeout){
+		ticketKeysRotate();
+	}
+	if(enc){
+		pthread_rwlock_rdlock(&ticketLock);
+		key = ticketKeys[0];
+		pthread_rwlock_unlock(&ticketLock);
+		if(RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1){
+			return -1;
+		}
+		memcpy(keyName, key.name, sizeof(key.name));
+	} else {
+		int found = -1;
+		pthread_rwlock_rdlock(&ticketLock);
+		for(int i = 0; i < ticketKeyCount; i++){
+			if(memcmp(keyName, ticketKeys[i].name, sizeof(ticketKeys[i].name)) == 0){
+				key = ticketKeys[i];
+				found = i;
+				break;
+			}
+		}
+		pthread_rwlock_unlock(&ticketLock);
+		if(found < 0){
+			atomic_fetch_add_explicit(&sessionCounters.ticketsRejected, 1, memory_order_relaxed);
+			return 0;
+		}
+		result = found == 0 ? 1 : 2; // tickets of an older key are renewed with the newest key
+	}
+
+	OSSL_PARAM params[3];
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmacKey, sizeof(key.hmacKey));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if(!EVP_MAC_CTX_set_params(mac, params)){
+		return -1;
+	}
+	if(enc){
+		if(!EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), NULL, key.aesKey, iv)){
+			return -1;
+		}
+		atomic_fetch_add_explicit(&sessionCounters.ticketsIssued, 1, memory_order_relaxed);
+	} else {
+		if(!EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), NULL, key.aesKey, iv)){
+			return -1;
+		}
+		atomic_fetch_add_explicit(&sessionCounters.ticketsAccepted, 1, memory_order_relaxed);
+	}
+	return result;
+}
+
+/**
+ * @brief Function name: sessionCacheInit
+ * Creates the shared session cache and the first session ticket key.
+ *
+ * @param size - the number of sessions kept in the cache, 0 disables the cache.
+ * @param timeout - the number of seconds a session stays valid, the ticket keys are rotated at the same interval.
+ * @param tickets - non-zero to issue session tickets.
+ * @return int - 0 on success, -1 if the cache could not be created.
+ */
+int sessionCacheInit(size_t size, long timeout, int tickets)
+{
+	sessionTimeout = timeout;
+	ticketsEnabled = tickets;
+	if(ticketKeyGenerate(&ticketKeys[0]) < 0){
+		logError("could not generate the session ticket key");
+		return -1;
+	}
+	ticketKeyCount = 1;
+
+	if(size == 0){
+		return 0;
+	}
+	shards = calloc(SESSION_SHARDS, sizeof(sessionShard));
+	if(shards == NULL){
+		return -1;
+	}
+	for(int i = 0; i < SESSION_SHARDS; i++){
+		sessionShard *shard = &shards[i];
+		shard->capacity = (size + SESSION_SHARDS - 1) / SESSION_SHARDS;
+		size_t buckets = 2;
+		while(buckets < shard->capacity){
+			buckets <<= 1;
+		}
+		shard->buckets = calloc(buckets, sizeof(sessionEntry*));
+		if(shard->buckets == NULL){
+			return -1;
+		}
+		shard->mask = buckets - 1;
+		pthread_mutex_init(&shard->lock, NULL);
+	}
+	return 0;
+}
+
+/**
+ * @brief Function name: sessionCacheAttach
+ * Configures the ssl context given by @param ctx to use the shared session cache and ticket keys
+ * instead of its own internal cache. Every context of the server is attached so that a session created on
+ * one core can be resumed on another.
+ *
+ * @param ctx - SSL_CTX* to the context to configure.
+ */
+void sessionCacheAttach(SSL_CTX *ctx)
+{
+	SSL_CTX_set_session_id_context(ctx, sessionContextId, sizeof(sessionContextId) - 1);
+	SSL_CTX_set_timeout(ctx, sessionTimeout);
+	if(shards != NULL){
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+		SSL_CTX_sess_set_new_cb(ctx, sessionNew);
+		SSL_CTX_sess_set_get_cb(ctx, sessionGet);
+		SSL_CTX_sess_set_remove_cb(ctx, sessionRemove);
+	} else {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	}
+	if(ticketsEnabled){
+		SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticketKeyCallback);
+	} else {
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+	}
+}
+
+/**
+ * @brief Function name: sessionPrintStats
+ * Prints the session cache and handshake counters to @param out.
+ *
+ * @param out - FILE* to write the counters to.
+ */
+void sessionPrintStats(FILE *out)
+{
+	fprintf(out, "Session cache: %lu hits, %lu misses, %lu stored, %lu evicted\n",
+		atomic_load(&sessionCounters.hits), atomic_load(&sessionCounters.misses),
+		atomic_load(&sessionCounters.stored), atomic_load(&sessionCounters.evicted));
+	fprintf(out, "Session tickets: %lu issued, %lu accepted, %lu rejected\n",
+		atomic_load(&sessionCounters.ticketsIssued), atomic_load(&sessionCounters.ticketsAccepted),
+		atomic_load(&sessionCounters.ticketsRejected));
+}
@@ -0,0 +1,142 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+/**
+ * @file session.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the server-side ssl session cache and the rotating session ticket keys
+ * that allow clients to resume a previous session instead of performing a full handshake.
+ * See files session.c and serverMain.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include "openssl/ssl.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+//! the number of independently locked shards of the session cache.
+#define SESSION_SHARDS 16
+
+//! the default number of sessions kept in the cache.
+#define DEFAULT_SESSION_CACHE_SIZE 20480
+
+//! the default number of seconds a session (and a ticket key) stays valid.
+#define DEFAULT_SESSION_TIMEOUT 300
+
+//! the largest serialized session stored in the cache.
+#define MAX_SESSION_SIZE 4096
+
+//! the number of ticket keys kept, the newest issues tickets and all of them are accepted.
+#define TICKET_KEYS 3
+
+//! A cached session, serialized to DER so that it can be shared between ssl contexts and threads.
+typedef struct sessionEntry
+{
+	//! the next entry in the same hash bucket.
+	struct sessionEntry *next;
+	//! the previous entry in the least-recently-used list of the shard.
+	struct sessionEntry *lruPrev;
+	//! the next entry in the least-recently-used list of the shard.
+	struct sessionEntry *lruNext;
+	//! the time after which the session may no longer be resumed.
+	time_t expires;
+	//! the session id.
+	unsigned char id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+	//! the length of the session id.
+	unsigned int idLength;
+	//! the length of the serialized session.
+	int derLength;
+	//! the serialized session.
+	unsigned char der[];
+} sessionEntry;
+
+//! A shard of the session cache, with its own lock, hash table and least-recently-used list.
+typedef struct sessionShard
+{
+	//! protects every field of the shard.
+	pthread_mutex_t lock;
+	//! the hash buckets, the number of buckets is a power of two.
+	sessionEntry **buckets;
+	//! the number of buckets minus one.
+	size_t mask;
+	//! the most recently used entry.
+	sessionEntry *lruHead;
+	//! the least recently used entry, evicted first.
+	sessionEntry *lruTail;
+	//! the number of entries in the shard.
+	size_t count;
+	//! the maximum number of entries in the shard.
+	size_t capacity;
+} sessionShard;
+
+//! A session ticket key, tickets carry the name of the key they were encrypted with.
+typedef struct ticketKey
+{
+	//! the name identifying the key.
+	unsigned char name[16];
+	//! the AES-256 key used to encrypt the tickets.
+	unsigned char aesKey[32];
+	//! the HMAC-SHA256 key used to authenticate the tickets.
+	unsigned char hmacKey[32];
+	//! the time the key was created.
+	time_t created;
+} ticketKey;
+
+//! The counters of the session cache, read by the server console (the handshakes are counted by the workers, see stats.h).
+typedef struct sessionStats
+{
+	//! sessions found in the cache for a client offering a session id.
+	atomic_ulong hits;
+	//! session ids offered by a client that were not (or no longer) in the cache.
+	atomic_ulong misses;
+	//! sessions stored in the cache.
+	atomic_ulong stored;
+	//! sessions evicted from a full cache.
+	atomic_ulong evicted;
+	//! session tickets issued.
+	atomic_ulong ticketsIssued;
+	//! session tickets accepted.
+	atomic_ulong ticketsAccepted;
+	//! session tickets rejected since their key was unknown (rotated out).
+	atomic_ulong ticketsRejected;
+} sessionStats;
+
+//! the counters of the session cache.
+extern sessionStats sessionCounters;
+
+/**
+ * @brief Function name: sessionCacheInit
+ * Creates the shared session cache and the first session ticket key.
+ *
+ * @param size - the number of sessions kept in the cache, 0 disables the cache.
+ * @param timeout - the number of seconds a session stays valid, the ticket keys are rotated at the same interval.
+ * @param tickets - non-zero to issue session tickets.
+ * @return int - 0 on success, -1 if the cache could not be created.
+ */
+int sessionCacheInit(size_t size, long timeout, int tickets);
+
+/**
+ * @brief Function name: sessionCacheAttach
+ * Configures the ssl context given by @param ctx to use the shared session cache and ticket keys
+ * instead of its own internal cache. Every context of the server is attached so that a session created on
+ * one core can be resumed on another.
+ *
+ * @param ctx - SSL_CTX* to the context to configure.
+ */
+void sessionCacheAttach(SSL_CTX *ctx);
+
+/**
+ * @brief Function name: sessionPrintStats
+ * Prints the session cache and handshake counters to @param out.
+ *
+ * @param out - FILE* to write the counters to.
+ */
+void sessionPrintStats(FILE *out);
+
+#endif
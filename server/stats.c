@@ -0,0 +1,147 @@
+/**
+ * @file stats.c
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief  Worker counter implementation file.
+ * This file contains the functions adding up the counters of the workers and rendering them for the server console
+ * and the stats endpoint.
+ * @version 0.1
+ * @date 2019-02-13
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+#include "stats.h"
+#include "pool.h"
+#include <stdarg.h>
+
+//! the status codes counted apart, any other code is counted as the last one (500).
+const int statsStatusCodes[STATS_STATUS_CODES] = {200, 206, 304, 400, 404, 416, 503, 500};
+
+/**
+ * @brief Function name: statsCountStatus
+ * Counts a response with the status code @param statusCode in the counters given by @param stats.
+ *
+ * @param stats - workerStats* to the counters of the worker.
+ * @param statusCode - the status code of the response.
+ */
+void statsCountStatus(workerStats *stats, int statusCode)
+{
+	int index = 0;
+	while(index < STATS_STATUS_CODES - 1 && statsStatusCodes[index] != statusCode){
+		index++;
+	}
+	statsAdd(&stats->statuses[index], 1);
+}
+
+/**
+ * @brief Function name: statsCollect
+ * Adds up the counters of every worker into @param total.
+ *
+ * @param total - workerStats* receiving the sums.
+ */
+void statsCollect(workerStats *total)
+{
+	// every counter is an atomic_ulong, the structure is added up counter by counter
+	size_t counters = offsetof(workerStats, cacheMisses) / sizeof(atomic_ulong) + 1;
+	atomic_ulong *sums = (atomic_ulong*)total;
+	for(size_t i = 0; i < counters; i++){
+		atomic_init(&sums[i], 0);
+	}
+	for(int w = 0; w < workerCount; w++){
+		atomic_ulong *counts = (atomic_ulong*)&workers[w].stats;
+		for(size_t i = 0; i < counters; i++){
+			statsAdd(&sums[i], atomic_load_explicit(&counts[i], memory_order_relaxed));
+		}
+	}
+}
+
+/**
+ * @brief Function name: statsPrint
+ * Prints the counters of all workers to @param out.
+ *
+ * @param out - FILE* to write the counters to.
+ */
+void statsPrint(FILE *out)
+{
+	workerStats total;
+	statsCollect(&total);
+	unsigned long handshakes = total.handshakes, resumed = total.resumed;
+	fprintf(out, "Connections: %lu accepted, %lu active\n", (unsigned long)total.connections, (unsigned long)total.active);
+	fprintf(out, "Handshakes: %lu full, %lu resumed (%.1f%% resumed)\n", handshakes, resumed,
+		handshakes + resumed > 0 ? 100.0 * resumed / (handshakes + resumed) : 0.0);
+	fprintf(out, "Status codes:");
+	for(int i = 0; i < STATS_STATUS_CODES; i++){
+		fprintf(out, " %d: %lu", statsStatusCodes[i], (unsigned long)total.statuses[i]);
+	}
+	fprintf(out, "\nResponse bytes: %lu, content cache: %lu hits, %lu misses\n", (unsigned long)total.responseBytes,
+		(unsigned long)total.cacheHits, (unsigned long)total.cacheMisses);
+}
+
+/**
+ * @brief Function name: append
+ * Appends the formatted text to the buffer given by @param buffer, keeping track of its length in @param length.
+ * Once the buffer is full @param length is set past its size.
+ *
+ * @param buffer - char* to the buffer.
+ * @param size - the size of the buffer in bytes.
+ * @param length - size_t* to the length of the text in the buffer.
+ * @param format - the printf format of the text.
+ */
+static void append(char *buffer, size_t size, size_t *length, const char *format, ...)
+{
+	if(*length >= size){
+		return;
+	}
+	va_list args;
+	va_start(args, format);
+	int written = vsnprintf(buffer + *length, size - *length, format, args);
+	va_end(args);
+	*length += written > 0 ? (size_t)written : 0;
+}
+
+/**
+ * @brief Function name: statsRender
+ * Renders the counters of all workers to @param buffer, as a JSON object or in the Prometheus text format.
+ *
+ * @param buffer - char* to the buffer receiving the counters.
+ * @param size - the size of the buffer in bytes.
+ * @param prometheus - non-zero for the Prometheus text format, 0 for JSON.
+ * @return size_t - the length of the rendered counters, 0 if they do not fit the buffer.
+ */
+size_t statsRender(char *buffer, size_t size, int prometheus)
+{
+	workerStats total;
+	statsCollect(&total);
+	const char *names[] = {"connections", "active", "handshakes", "resumed", "responses", "response_bytes", "records",
+		"write_calls", "cache_hits", "cache_misses"};
+	unsigned long values[] = {total.connections, total.active, total.handshakes, total.resumed, total.responses,
+		total.responseBytes, total.records, total.writeCalls, total.cacheHits, total.cacheMisses};
+	size_t count = sizeof(values) / sizeof(values[0]);
+	size_t length = 0;
+	if(prometheus){
+		for(size_t i = 0; i < count; i++){
+			// the active connections go up and down, everything else only counts up
+			const char *suffix = i == 1 ? "" : "_total";
+			append(buffer, size, &length, "# TYPE ssl_server_%s%s %s\nssl_server_%s%s %lu\n", names[i], suffix,
+				i == 1 ? "gauge" : "counter", names[i], suffix, values[i]);
+		}
+		append(buffer, size, &length, "# TYPE ssl_server_status_total counter\n");
+		for(int i = 0; i < STATS_STATUS_CODES; i++){
+			append(buffer, size, &length, "ssl_server_status_total{code=\"%d\"} %lu\n", statsStatusCodes[i],
+				(unsigned long)total.statuses[i]);
+		}
+	} else {
+		append(buffer, size, &length, "{");
+		for(size_t i = 0; i < count; i++){
+			append(buffer, size, &length, "\"%s\":%lu,", names[i], values[i]);
+		}
+		append(buffer, size, &length, "\"status\":{");
+		for(int i = 0; i < STATS_STATUS_CODES; i++){
+			append(buffer, size, &length, "%s\"%d\":%lu", i > 0 ? "," : "", statsStatusCodes[i], (unsigned long)total.statuses[i]);
+		}
+		append(buffer, size, &length, "}}\n");
+	}
+	return length < size ? length : 0;
+}
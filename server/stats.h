@@ -0,0 +1,111 @@
+#ifndef STATS_H
+#define STATS_H
+
+/**
+ * @file stats.h
+ * @authors Mohamed Ameen Omar (u16055323)
+ * @authors Douglas Healy (u16018100)
+ * @authors Llewellyn Moyse (u15100708)
+ * @brief Header This header provides the counters of the workers (connections, handshakes, responses by status code,
+ * bytes written, content cache hits). Every worker writes only its own counters, which fill cache lines of their own,
+ * readers add up the counters of every worker. They are shown by the server console and served as JSON or in the
+ * Prometheus text format at STATS_PATH.
+ * See files stats.c, reactor.c and server.c
+ *
+ * @copyright Copyright &copy; 2019 - EHN 410 Group 7
+ *
+ */
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+
+//! the size of a cache line, used to keep data written by different threads apart.
+#define CACHE_LINE_SIZE 64
+
+//! the path the counters are served at.
+#define STATS_PATH "/__stats"
+
+//! the number of status codes counted apart, see statsStatusCodes.
+#define STATS_STATUS_CODES 8
+
+//! the status codes counted apart, any other code is counted as the last one (500).
+extern const int statsStatusCodes[STATS_STATUS_CODES];
+
+//! The counters of a worker, only written by the worker itself. They start and end on a cache line boundary.
+typedef struct workerStats
+{
+	//! the connections adopted by the worker.
+	_Alignas(CACHE_LINE_SIZE) atomic_ulong connections;
+	//! the connections the worker is serving.
+	atomic_ulong active;
+	//! the full ssl handshakes completed.
+	atomic_ulong handshakes;
+	//! the ssl handshakes that resumed a previous session.
+	atomic_ulong resumed;
+	//! the responses written by the worker.
+	atomic_ulong responses;
+	//! the responses written per status code, indexed like statsStatusCodes.
+	atomic_ulong statuses[STATS_STATUS_CODES];
+	//! the bytes of the responses written by the worker.
+	atomic_ulong responseBytes;
+	//! the TLS records written by the worker (without kTLS SSL_sendfile, the kernel forms those records).
+	atomic_ulong records;
+	//! the write system calls (write and sendfile) made on the connections of the worker, including the handshakes.
+	atomic_ulong writeCalls;
+	//! the requested files found in the content cache.
+	atomic_ulong cacheHits;
+	//! the requested files loaded into the content cache (or not found).
+	atomic_ulong cacheMisses;
+} workerStats;
+
+/**
+ * @brief Function name: statsAdd
+ * Adds @param amount to the counter given by @param counter. Only the worker owning the counter writes it, so a plain
+ * load and store is enough and no locked instruction is needed.
+ *
+ * @param counter - atomic_ulong* to the counter.
+ * @param amount - the amount added.
+ */
+static inline void statsAdd(atomic_ulong *counter, unsigned long amount)
+{
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+/**
+ * @brief Function name: statsCountStatus
+ * Counts a response with the status code @param statusCode in the counters given by @param stats.
+ *
+ * @param stats - workerStats* to the counters of the worker.
+ * @param statusCode - the status code of the response.
+ */
+void statsCountStatus(workerStats *stats, int statusCode);
+
+/**
+ * @brief Function name: statsCollect
+ * Adds up the counters of every worker into @param total.
+ *
+ * @param total - workerStats* receiving the sums.
+ */
+void statsCollect(workerStats *total);
+
+/**
+ * @brief Function name: statsPrint
+ * Prints the counters of all workers to @param out.
+ *
+ * @param out - FILE* to write the counters to.
+ */
+void statsPrint(FILE *out);
+
+/**
+ * @brief Function name: statsRender
+ * Renders the counters of all workers to @param buffer, as a JSON object or in the Prometheus text format.
+ *
+ * @param buffer - char* to the buffer receiving the counters.
+ * @param size - the size of the buffer in bytes.
+ * @param prometheus - non-zero for the Prometheus text format, 0 for JSON.
+ * @return size_t - the length of the rendered counters, 0 if they do not fit the buffer.
+ */
+size_t statsRender(char *buffer, size_t size, int prometheus);
+
+#endif